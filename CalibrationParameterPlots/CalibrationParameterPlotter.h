@@ -19,22 +19,57 @@
 #include "Detector.h"
 #include "ParameterSet.h"
 #include "CalibrationParameterReader.h"
+#include "ParameterStore.h"
+#include "../Common/PlotBundle.h"
+#include "../Common/RenderManifest.h"
 
 
 class CalibrationParameterPlotter {
 public:
+  CalibrationParameterPlotter();
   CalibrationParameterPlotter(const TString& geometryFile);
+  CalibrationParameterPlotter(const TrackerTopologyVersion topology);
 
+  // treeFile may also be a list or glob of the treeFiles of a split
+  // campaign (see TreeFileSet), read as if they were merged
   void plot(const TString& treeFile, const TString& outNamePrefix="CalibPars") const;
+  void plot(const ParameterStore& store, const TString& outNamePrefix="CalibPars") const;
+
+  // plots for one detector, <outNamePrefix>_<detector>_Layer<n>.pdf
+  void plot(const ParameterSet& pars, const TString& outNamePrefix) const;
+
+  // Only layers whose plot content changed since the manifest was
+  // written are rendered again. The manifest is not owned.
+  void setRenderManifest(RenderManifest* manifest) { manifest_ = manifest; }
+
+  // Print all layers into the bundle instead of one file per layer. The
+  // manifest is then ignored, since the bundle is written anew as a
+  // whole. The bundle is not owned.
+  void setPlotBundle(PlotBundle* bundle) { bundle_ = bundle; }
+
+  // number of IOV trees read ahead while the current one is processed
+  void setReadahead(const unsigned int depth) { readahead_ = depth; }
+
+  // read the IOV trees in n forked processes instead of threads
+  void setNumberOfProcesses(const unsigned int n) { nProcesses_ = n; }
+
+  // for IOVs of several treeFiles sharing runs
+  void setOverlapPolicy(const IOVOverlapPolicy policy) { overlapPolicy_ = policy; }
+
+  // appended to outNamePrefix per type, e.g. "_LA-Deco"
+  TString outNameSuffix(const CalibrationParameterType type) const;
 
 
 private:
   Tracker tracker_;
-
-  // plots for one detector
-  void plot(const ParameterSet& pars, const TString& outNamePrefix) const;
+  RenderManifest* manifest_;
+  PlotBundle* bundle_;
+  unsigned int readahead_;
+  unsigned int nProcesses_;
+  IOVOverlapPolicy overlapPolicy_;
 
   // little helpers
+  void setStyle() const;
   TString yTitle(const CalibrationParameterType type) const;
   int color(const unsigned int ring, const unsigned int nRings) const;
   int markerStyle(const unsigned int ring, const unsigned int nRings) const;
@@ -43,9 +78,26 @@ private:
 };
 
 
+// Without geometry file, only plotting from a ParameterStore is possible
+CalibrationParameterPlotter::CalibrationParameterPlotter()
+  : manifest_(0), bundle_(0), readahead_(0), nProcesses_(1), overlapPolicy_(OverlapIsError) {
+  setStyle();
+}
+
+
 CalibrationParameterPlotter::CalibrationParameterPlotter(const TString& geometryFile) 
-  : tracker_(Tracker(geometryFile)) {
+  : tracker_(geometryFile), manifest_(0), bundle_(0), readahead_(0), nProcesses_(1), overlapPolicy_(OverlapIsError) {
+  setStyle();
+}
+
 
+CalibrationParameterPlotter::CalibrationParameterPlotter(const TrackerTopologyVersion topology) 
+  : tracker_(topology), manifest_(0), bundle_(0), readahead_(0), nProcesses_(1), overlapPolicy_(OverlapIsError) {
+  setStyle();
+}
+
+
+void CalibrationParameterPlotter::setStyle() const {
   // Suppress message when canvas has been saved
   gErrorIgnoreLevel = 1001;
 
@@ -120,6 +172,15 @@ CalibrationParameterPlotter::CalibrationParameterPlotter(const TString& geometry
 }
 
 
+TString CalibrationParameterPlotter::outNameSuffix(const CalibrationParameterType type) const {
+  if(      type == PixelLA     ) return "_LA";
+  else if( type == StripLADeco ) return "_LA-Deco";
+  else if( type == StripLAPeak ) return "_LA-Peak";
+  else if( type == StripBPDeco ) return "_BP";
+  else                           return "";
+}
+
+
 TString CalibrationParameterPlotter::yTitle(const CalibrationParameterType type) const {
   if(      type == StripBPDeco ) return "#DeltaW^{shift}_{BP} [% of module thickness]";
   else if( type == StripLADeco ) return "deco-mode tan(#theta^{shift}_{LA})";
@@ -252,16 +313,19 @@ void CalibrationParameterPlotter::plot(const ParameterSet& pars, const TString&
   for(unsigned int iLayer = 0; iLayer < pars.nRBins(); ++iLayer) {
     TString titletxt = toStr(det)+" layer ";
     titletxt += iLayer+1;
-    TPaveText* title = createTitle(titletxt);
 
     TString outName = outNamePrefix+"_"+toStr(det)+"_Layer";
     outName += iLayer+1;
 
-    std::vector<TGraph*> graphs;
-    std::vector<TH1*> starts;
-    TLegend* leg = createLegend(pars.nZBins());
-    // loop over rings = units in z
+    // collect the data of all rings first, since they decide
+    // whether this layer needs to be rendered at all
     const unsigned int nRings = pars.nZBins();
+    std::vector<unsigned int> rings;
+    std::vector<TString> entries;
+    std::vector< std::vector<double> > values(nRings);
+    std::vector< std::vector<double> > startValues(nRings);
+    std::vector< std::vector<double> > errors(nRings);
+    // loop over rings = units in z
     for(unsigned int iRingCounter = 0; iRingCounter < nRings; ++iRingCounter) {
       // want the legend get filled column-wise: need to re-order
       // sequence to first even entries then odd in case of more
@@ -276,40 +340,20 @@ void CalibrationParameterPlotter::plot(const ParameterSet& pars, const TString&
 	  iRing = offset + (iRingCounter-1)/2;
 	}
       }
+      rings.push_back(iRing);
 
-      std::vector<double> iovs;
-      std::vector<double> zeros;
-      std::vector<double> values;
-      std::vector<double> errors;
-
-      TString hname = "start";
-      hname += iRing;
-      TH1* start = static_cast<TH1*>(frame->Clone(hname));
       for(unsigned int iov = 0; iov < pars.nIOVs(); ++iov) {
 	const double finalval = scale*pars.value(iRing,iLayer,iov);
 	const double delta = scale*pars.delta(iRing,iLayer,iov);
 	const double startval = finalval - delta;
 	const double error = scale*pars.error(iRing,iLayer,iov);
-	iovs.push_back(iov+1);
-	values.push_back(finalval);
-	start->SetBinContent(1+iov,startval);
-	zeros.push_back(0);
-	errors.push_back(error);
+	values.at(iRingCounter).push_back(finalval);
+	startValues.at(iRingCounter).push_back(startval);
+	errors.at(iRingCounter).push_back(error);
 	if( std::min(startval,finalval) < yMin ) yMin = std::min(startval,finalval);
 	if( std::max(startval,finalval) > yMax ) yMax = std::max(startval,finalval);
       }
-      TGraph* graph = new TGraphErrors(iovs.size(),&(iovs.front()),&(values.front()),
-				       &(zeros.front()),&(errors.front()));
-      graph->SetMarkerStyle( markerStyle(iRing,nRings) );
-      graph->SetMarkerColor( color(iRing,nRings) );
-      graph->SetLineColor(graph->GetMarkerColor());
-      graphs.push_back(graph);
 
-      start->SetLineWidth(2);
-      start->SetLineStyle(2);
-      start->SetLineColor(graph->GetLineColor());
-      starts.push_back(start);
-	
       const unsigned int rMin = pars.zBinMin(iRing);
       const unsigned int rMax = pars.zBinMax(iRing);
       TString entry = "ring ";
@@ -320,12 +364,58 @@ void CalibrationParameterPlotter::plot(const ParameterSet& pars, const TString&
 	entry += "-";
 	entry += rMax+1;
       }
-      leg->AddEntry(graph,entry,"P");
+      entries.push_back(entry);
 
     }	// end of loop over rings
 
     const double deltaY = yMax-yMin;
-    frame->GetYaxis()->SetRangeUser(yMin-0.4*deltaY,yMax+deltaY);
+    const double yMinFrame = yMin-0.4*deltaY;
+    const double yMaxFrame = yMax+deltaY;
+
+    // skip the layer if exactly the same plot has been rendered before
+    ContentHash hash;
+    hash.add(titletxt).add(yTitle(pars.type())).add(nIOVs).add(yMinFrame).add(yMaxFrame);
+    hash.add(gStyle->GetPadLeftMargin()).add(gStyle->GetPadRightMargin()).add(gStyle->GetPadTopMargin());
+    for(unsigned int i = 0; i < nRings; ++i) {
+      hash.add(entries.at(i)).add(markerStyle(rings.at(i),nRings)).add(color(rings.at(i),nRings));
+      hash.add(&(values.at(i).front()),values.at(i).size()*sizeof(double));
+      hash.add(&(errors.at(i).front()),errors.at(i).size()*sizeof(double));
+    }
+    if( bundle_ == 0 && manifest_ != 0 && manifest_->isUpToDate(outName+".pdf",hash) ) continue;
+
+    TPaveText* title = createTitle(titletxt);
+    std::vector<TGraph*> graphs;
+    std::vector<TH1*> starts;
+    TLegend* leg = createLegend(nRings);
+    std::vector<double> iovs;
+    std::vector<double> zeros(pars.nIOVs(),0.);
+    for(unsigned int iov = 0; iov < pars.nIOVs(); ++iov) {
+      iovs.push_back(iov+1);
+    }
+    for(unsigned int i = 0; i < nRings; ++i) {
+      const unsigned int iRing = rings.at(i);
+      TGraph* graph = new TGraphErrors(iovs.size(),&(iovs.front()),&(values.at(i).front()),
+				       &(zeros.front()),&(errors.at(i).front()));
+      graph->SetMarkerStyle( markerStyle(iRing,nRings) );
+      graph->SetMarkerColor( color(iRing,nRings) );
+      graph->SetLineColor(graph->GetMarkerColor());
+      graphs.push_back(graph);
+
+      TString hname = "start";
+      hname += iRing;
+      TH1* start = static_cast<TH1*>(frame->Clone(hname));
+      for(unsigned int iov = 0; iov < pars.nIOVs(); ++iov) {
+	start->SetBinContent(1+iov,startValues.at(i).at(iov));
+      }
+      start->SetLineWidth(2);
+      start->SetLineStyle(2);
+      start->SetLineColor(graph->GetLineColor());
+      starts.push_back(start);
+	
+      leg->AddEntry(graph,entries.at(i),"P");
+    }
+
+    frame->GetYaxis()->SetRangeUser(yMinFrame,yMaxFrame);
 
     frame->Draw("HIST");
     // for(std::vector<TH1*>::reverse_iterator hit = starts.rbegin();
@@ -340,7 +430,18 @@ void CalibrationParameterPlotter::plot(const ParameterSet& pars, const TString&
     }
     leg->Draw("same");
     title->Draw("same");
-    can->SaveAs(outName+".pdf");
+    if( bundle_ != 0 ) {
+      bundle_->add(can,outName,titletxt);
+      for(unsigned int i = 0; i < nRings; ++i) {
+	TString gname = entries.at(i);
+	gname.ReplaceAll(" ","");
+	gname.ReplaceAll("-","to");
+	bundle_->write(graphs.at(i),gname);
+      }
+    } else {
+      can->SaveAs(outName+".pdf");
+      if( manifest_ != 0 ) manifest_->update(outName+".pdf",hash);
+    }
     
     for(std::vector<TGraph*>::iterator git = graphs.begin();
 	git != graphs.end(); ++git) {
@@ -362,20 +463,27 @@ void CalibrationParameterPlotter::plot(const ParameterSet& pars, const TString&
 
 void CalibrationParameterPlotter::plot(const TString& treeFile, const TString& outNamePrefix) const {
   std::cout << "Reading fitted calibration parameters" << std::endl;
-  const CalibrationParameterReader reader(&tracker_);
+  CalibrationParameterReader reader(&tracker_,readahead_,nProcesses_);
+  reader.setOverlapPolicy(overlapPolicy_);
   CalibrationParameterType types[4] = { PixelLA, StripLADeco, StripLAPeak, StripBPDeco };
   for(int t = 0; t < 4; ++t) {
     std::map<Detector,ParameterSet> parsPerDet = reader.read(types[t],treeFile);
     for(std::map<Detector,ParameterSet>::const_iterator it = parsPerDet.begin();
 	it != parsPerDet.end(); ++it) {
       it->second.print();
-      TString outName = outNamePrefix;
-      if(      types[t] == PixelLA     ) outName += "_LA";
-      else if( types[t] == StripLADeco ) outName += "_LA-Deco";
-      else if( types[t] == StripLAPeak ) outName += "_LA-Peak";
-      else if( types[t] == StripBPDeco ) outName += "_BP";
-      
-      plot(it->second,outName);
+      plot(it->second,outNamePrefix+outNameSuffix(types[t]));
+    }
+  }
+}
+
+
+void CalibrationParameterPlotter::plot(const ParameterStore& store, const TString& outNamePrefix) const {
+  CalibrationParameterType types[4] = { PixelLA, StripLADeco, StripLAPeak, StripBPDeco };
+  for(int t = 0; t < 4; ++t) {
+    std::map<Detector,ParameterSet> parsPerDet = store.read(types[t]);
+    for(std::map<Detector,ParameterSet>::const_iterator it = parsPerDet.begin();
+	it != parsPerDet.end(); ++it) {
+      plot(it->second,outNamePrefix+outNameSuffix(types[t]));
     }
   }
 }
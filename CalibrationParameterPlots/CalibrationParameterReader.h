@@ -15,55 +15,171 @@
 #include "TString.h"
 #include "TTree.h"
 
+#include "../Common/ForkedShards.h"
+#include "../Common/PrefetchPipeline.h"
 #include "Detector.h"
 #include "IOV.h"
+#include "ModuleParameterIndex.h"
+#include "ParameterAggregator.h"
 #include "ParameterSet.h"
+#include "TreeFileSet.h"
+
+
+// How trees of different treeFiles of one campaign that start with the
+// same run are treated: as an error, or the tree of the file earlier
+// (later) in the list is used
+enum IOVOverlapPolicy { OverlapIsError=0, PreferEarlierFile, PreferLaterFile };
 
 
 class CalibrationParameterReader {
 public:
-  CalibrationParameterReader(const Tracker* tracker)
-    : tracker_(tracker) { }
+  // With readahead > 0, the trees of the next IOVs are read in a
+  // background thread while the current IOV is processed.
+  // With nProcesses > 1, the IOVs are instead split among as many
+  // forked worker processes, which do not use threads nor share any
+  // ROOT state; the result is identical to the one of the serial read.
+  CalibrationParameterReader(const Tracker* tracker, const unsigned int readahead = 0, const unsigned int nProcesses = 1)
+    : tracker_(tracker), readahead_(readahead), nProcesses_(nProcesses), overlapPolicy_(OverlapIsError) { }
+
+  void setOverlapPolicy(const IOVOverlapPolicy policy) { overlapPolicy_ = policy; }
 
-  std::map<Detector,ParameterSet> read(const CalibrationParameterType type, const TString& fileName) const;
+  // The results may be split over several treeFiles, given as a list
+  // of file names and glob patterns (see TreeFileSet). Their IOVs are
+  // merged into one catalogue ordered by run, and each tree is read
+  // directly from its file, which is opened once.
+  // If an index is given, it is filled with the parameter of each
+  // module in each IOV and finalized.
+  std::map<Detector,ParameterSet> read(const CalibrationParameterType type, const TString& fileNames, ModuleParameterIndex* index = 0) const;
 
 
 private:
   struct TreeInfo {
     TreeInfo()
-      : name(""), iov(IOV()) {}
-    TreeInfo(const TString& theName, const unsigned int min, const unsigned int max)
-      : name(theName), iov(IOV(min,max)) {}
+      : name(""), iov(IOV()), fileIdx(0) {}
+    TreeInfo(const TString& theName, const unsigned int min, const unsigned int max, const size_t theFileIdx)
+      : name(theName), iov(IOV(min,max)), fileIdx(theFileIdx) {}
 
     TString name;
     IOV iov;
+    size_t fileIdx;		// in the TreeFileSet
   };
 
-  struct ParInfo {
-    ParInfo()
-      : det(UNKNOWN), value(9999999.), delta(999999.), error(9999999.) {}
-    ParInfo(const Detector detector, const double val, const double delt, const double err,
-	    const unsigned int ring, const unsigned int layer)
-      : det(detector), value(val), delta(delt), error(err) {
-      rings.insert(ring);
-      layers.insert(layer);
-    }
-    
-    Detector det;
+  // module entries of the tree of one IOV
+  struct IOVColumns {
+    IOVColumns()
+      : iovIdx(0) {}
+
+    size_t iovIdx;
+    std::vector<unsigned int> detIds;
+    std::vector<float> values;
+    std::vector<float> deltas;
+    std::vector<float> errors;
+    std::vector<int> parIdxs;
+  };
+
+  // one aggregated parameter of one IOV, as passed from the worker
+  // processes to the parent
+  struct ParRecord {
+    ParRecord() {}
+    ParRecord(const size_t theIOVIdx, const unsigned int theOrigParIdx, const ParameterAggregator::ParInfo& pi)
+      : iovIdx(theIOVIdx), origParIdx(theOrigParIdx), det(pi.det),
+	minRing(pi.minRing), maxRing(pi.maxRing), minLayer(pi.minLayer), maxLayer(pi.maxLayer),
+	value(pi.value), delta(pi.delta), error(pi.error) {}
+
+    size_t iovIdx;
+    unsigned int origParIdx;
+    int det;
+    unsigned int minRing;
+    unsigned int maxRing;
+    unsigned int minLayer;
+    unsigned int maxLayer;
     double value;
     double delta;
     double error;
-    std::set<unsigned int> rings;
-    std::set<unsigned int> layers;
   };
 
-  const Tracker* tracker_;
+  // parameter of one module in one IOV, as passed from the worker
+  // processes to the parent
+  struct ModuleRecord {
+    size_t iovIdx;
+    unsigned int detId;
+    int parIdx;
+  };
 
-  std::vector<TreeInfo> getTreeInfo(const CalibrationParameterType type, TFile& file) const;
+  const Tracker* tracker_;
+  const unsigned int readahead_;
+  const unsigned int nProcesses_;
+  IOVOverlapPolicy overlapPolicy_;
+
+  std::vector<TreeInfo> getTreeInfo(const CalibrationParameterType type, TreeFileSet& files) const;
+  std::vector<TreeInfo> getTreeInfo(const CalibrationParameterType type, TFile& file, const size_t fileIdx) const;
+  void readIOV(TFile& file, const TString& treeName, IOVColumns& cols) const;
+  void aggregate(const IOVColumns& cols, ParameterAggregator& values) const;
+  void store(const CalibrationParameterType type, const IOV& iov, const ParRecord& rec, std::map<Detector,ParameterSet>& result) const;
+  void readForked(const CalibrationParameterType type, const std::vector<TString>& fileNames, const std::vector<TreeInfo>& treeInfoPerIOV, std::map<Detector,ParameterSet>& result, ModuleParameterIndex* index) const;
+  void fillIndex(const ForkedShards<ModuleRecord>& shards, const std::vector<TreeInfo>& treeInfoPerIOV, ModuleParameterIndex* index) const;
 };
 
 
-std::vector<CalibrationParameterReader::TreeInfo> CalibrationParameterReader::getTreeInfo(const CalibrationParameterType type, TFile& file) const {
+// The IOVs of all files, ordered by run. The trees of all files are
+// ordered by their first run, and an IOV ends before the first run of
+// the next tree, which may be in another file; the last tree only marks
+// the end of the last IOV. Trees of different files starting with the
+// same run are treated according to the overlap policy.
+std::vector<CalibrationParameterReader::TreeInfo> CalibrationParameterReader::getTreeInfo(const CalibrationParameterType type, TreeFileSet& files) const {
+  std::vector<TreeInfo> treeInfos;
+  if( type == NONE ) return treeInfos;
+
+  for(size_t fileIdx = 0; fileIdx < files.nFiles(); ++fileIdx) {
+    const std::vector<TreeInfo> treeInfosOfFile = getTreeInfo(type,files.file(fileIdx),fileIdx);
+    if( treeInfosOfFile.empty() ) {
+      std::cout << "WARNING: no IOVs in file '" << files.fileName(fileIdx) << "'" << std::endl;
+    }
+    treeInfos.insert(treeInfos.end(),treeInfosOfFile.begin(),treeInfosOfFile.end());
+  }
+
+  // by first run, and for the same first run by file
+  std::stable_sort(treeInfos.begin(),treeInfos.end(),
+		   [](const TreeInfo& a, const TreeInfo& b) { return a.iov.minRun() < b.iov.minRun(); });
+  std::vector<TreeInfo> starts;
+  for(size_t i = 0; i < treeInfos.size(); ) {
+    size_t last = i;
+    while( last+1 < treeInfos.size() && treeInfos[last+1].iov.minRun() == treeInfos[i].iov.minRun() ) ++last;
+    const TreeInfo& first = treeInfos[i];
+    if( treeInfos[last].fileIdx != first.fileIdx ) {
+      if( overlapPolicy_ == OverlapIsError ) {
+	std::cerr << "\n\nERROR tree '" << first.name << "' is in file '" << files.fileName(first.fileIdx)
+		  << "' and in file '" << files.fileName(treeInfos[last].fileIdx) << "'\n" << std::endl;
+	throw std::exception();
+      }
+      const TreeInfo& used = overlapPolicy_ == PreferEarlierFile ? first : treeInfos[last];
+      std::cout << "Tree '" << first.name << "' is in several files, using '" << files.fileName(used.fileIdx) << "'" << std::endl;
+      starts.push_back(used);
+    } else {
+      starts.push_back(first);
+    }
+    i = last+1;
+  }
+  if( starts.empty() ) return starts;
+
+  for(size_t i = 0; i+1 < starts.size(); ++i) {
+    starts.at(i).iov = IOV(starts.at(i).iov.minRun(),starts.at(i+1).iov.minRun()-1);
+  }
+  starts.pop_back();		// don't need last tree (I think)
+
+  std::cout << "Found the following IOVs" << std::endl;
+  for(size_t i = 0; i < starts.size(); ++i) {
+    std::cout << starts.at(i).name << ": " << starts.at(i).iov.minRun() << " - " << starts.at(i).iov.maxRun();
+    if( files.nFiles() > 1 ) std::cout << "  (" << files.fileName(starts.at(i).fileIdx) << ")";
+    std::cout << std::endl;
+  }
+
+  return starts;
+}
+
+
+// The trees of the file, with their first run; ordered by run
+std::vector<CalibrationParameterReader::TreeInfo> CalibrationParameterReader::getTreeInfo(const CalibrationParameterType type, TFile& file, const size_t fileIdx) const {
 
   if( type == NONE ) return std::vector<TreeInfo>(0);
 
@@ -87,7 +203,7 @@ std::vector<CalibrationParameterReader::TreeInfo> CalibrationParameterReader::ge
       name.ReplaceAll(treeBaseName,"");
       if( name.IsDigit() && name.Atoi() > 0 ) {
 	const unsigned int min = static_cast<unsigned int>(name.Atoi());
-	treeInfos.push_back(TreeInfo(treeBaseName+name,min,9999999));
+	treeInfos.push_back(TreeInfo(treeBaseName+name,min,9999999,fileIdx));
       } else {
 	std::cerr << "\n\nERROR reading tree '" << key->GetName() << std::endl;
 	std::cout << "when looking for all IOVs of '" << treeBaseName << "'\n" << std::endl;
@@ -95,114 +211,240 @@ std::vector<CalibrationParameterReader::TreeInfo> CalibrationParameterReader::ge
       }
     }
   }
-  for(size_t i = 0; i < treeInfos.size()-1; ++i) {
-    treeInfos.at(i).iov = IOV(treeInfos.at(i).iov.minRun(),treeInfos.at(i+1).iov.minRun()-1);
-  }
-  treeInfos.pop_back();		// don't need last tree (I think)
+  // the keys are not necessarily ordered by run
+  std::sort(treeInfos.begin(),treeInfos.end(),
+	    [](const TreeInfo& a, const TreeInfo& b) { return a.iov.minRun() < b.iov.minRun(); });
 
-  std::cout << "Found the following IOVs" << std::endl;
-  for(size_t i = 0; i < treeInfos.size(); ++i) {
-    std::cout << treeInfos.at(i).name << ": " << treeInfos.at(i).iov.minRun() << " - " << treeInfos.at(i).iov.maxRun() << std::endl;
+  return treeInfos;
+}
+  
+
+void CalibrationParameterReader::readIOV(TFile& file, const TString& treeName, IOVColumns& cols) const {
+  cols.detIds.clear();
+  cols.values.clear();
+  cols.deltas.clear();
+  cols.errors.clear();
+  cols.parIdxs.clear();
+
+  // get tree for this IOV
+  TTree* tree = 0;
+  file.GetObject(treeName,tree);
+  if( tree == 0 ) {
+    std::cerr << "\n\nERROR reading tree '" << treeName << "' from file\n" << std::endl;
+    throw std::exception();
   }
 
+  // tree variables
+  unsigned int id = 0;
+  float value = 0.;
+  struct treeStruct {
+    float delta;
+    float error;
+    int parIdx;
+  } results;
+  tree->SetBranchAddress("detId",&id);
+  tree->SetBranchAddress("value",&value);
+  tree->SetBranchAddress("treeStruct",&results);
+
+  // loop over tree (modules)
+  for(int iE = 0; iE < tree->GetEntries(); ++iE) {
+    tree->GetEntry(iE);
+
+    if( results.parIdx > -1 ) {	// parIdx == -1 for modules withouth LA/BP calibration parameters
+      cols.detIds.push_back(id);
+      cols.values.push_back(value);
+      cols.deltas.push_back(results.delta);
+      cols.errors.push_back(results.error);
+      cols.parIdxs.push_back(results.parIdx);
+    }
 
-  return treeInfos;
+  } // end of loop over tree
+  delete tree;
 }
-  
 
-std::map<Detector,ParameterSet> CalibrationParameterReader::read(const CalibrationParameterType type, const TString& fileName) const {
 
-  // open file with alignment results
-  TFile file(fileName,"READ");
-  if( !file.IsOpen() ) {
-    std::cerr << "\n\nERROR opening file '" << fileName << "'\n" << std::endl;
-    throw std::exception();
+void CalibrationParameterReader::aggregate(const IOVColumns& cols, ParameterAggregator& values) const {
+  values.reset();
+
+  for(size_t i = 0; i < cols.detIds.size(); ++i) {
+    // detector and module information
+    const unsigned int id = cols.detIds[i];
+    const Detector det = tracker_->detector(id);
+    const unsigned int ring = tracker_->ring(id);
+    const unsigned int layer = tracker_->layer(id);
+
+    // store in temporary table
+    values.add(cols.parIdxs[i],det,cols.values[i],cols.deltas[i],cols.errors[i],ring,layer);
   }
+}
+
+
+void CalibrationParameterReader::store(const CalibrationParameterType type, const IOV& iov, const ParRecord& rec, std::map<Detector,ParameterSet>& result) const {
+  const Detector det = static_cast<Detector>(rec.det);
+
+  // create an entry in result for this detector
+  std::map<Detector,ParameterSet>::iterator it = result.find(det);
+  if( it == result.end() ) it = result.insert(std::make_pair(det,ParameterSet(type,det))).first;
+
+  it->second.add(rec.minRing,rec.maxRing,rec.minLayer,rec.maxLayer,iov,rec.value,rec.delta,rec.error,rec.origParIdx);
+}
+
+
+std::map<Detector,ParameterSet> CalibrationParameterReader::read(const CalibrationParameterType type, const TString& fileNames, ModuleParameterIndex* index) const {
+
+  // files with alignment results, opened when their trees are listed
+  TreeFileSet files(fileNames);
 
   // get name of all trees of this base name for different IOVs
-  std::vector<TreeInfo> treeInfoPerIOV = getTreeInfo(type,file);
+  std::vector<TreeInfo> treeInfoPerIOV = getTreeInfo(type,files);
 
   // the result: parameters for all detectors and IOVs
   std::map<Detector,ParameterSet> result;
 
-  // loop over IOVs
-  for(std::vector<TreeInfo>::const_iterator iovIt = treeInfoPerIOV.begin();
-      iovIt != treeInfoPerIOV.end(); ++iovIt) {
-    
-    // get tree for this IOV
-    TTree* tree = 0;
-    file.GetObject(iovIt->name,tree);
-    if( tree == 0 ) {
-      std::cerr << "\n\nERROR reading tree '" << iovIt->name << "' from file\n" << std::endl;
-      throw std::exception();
-    }
+  if( nProcesses_ > 1 ) {
+    // workers open the files themselves and share the sensors read here
+    files.close();
+    tracker_->load(detectorMask(type));
+    readForked(type,files.fileNames(),treeInfoPerIOV,result,index);
+    return result;
+  }
 
-    // helper object to temporarily store parameters and granularity info
-    std::map<int,ParInfo> values;
-
-    // tree variables
-    unsigned int id = 0;
-    float value = 0.;
-    struct treeStruct {
-      float delta;
-      float error;
-      int parIdx;
-    } results;
-    tree->SetBranchAddress("detId",&id);
-    tree->SetBranchAddress("value",&value);
-    tree->SetBranchAddress("treeStruct",&results);
-
-    // loop over tree (modules)
-    for(int iE = 0; iE < tree->GetEntries(); ++iE) {
-      tree->GetEntry(iE);
-
-      if( results.parIdx > -1 ) {	// parIdx == -1 for modules withouth LA/BP calibration parameters
-
-	// detector and module information
-	const Detector det = tracker_->detector(id);
-	const unsigned int ring = tracker_->ring(id);
-	const unsigned int layer = tracker_->layer(id);
-
-	// store in temporary map
-	std::map<int,ParInfo>::iterator valueIt = values.find(results.parIdx);
-	if( valueIt == values.end() ) {
-	  values[results.parIdx] = ParInfo(det,value,results.delta,results.error,ring,layer);
-	} else {
-	  valueIt->second.rings.insert(ring);
-	  valueIt->second.layers.insert(layer);
-	}
-
-	// create an entry in result for this detector
-	if( result.find(det) == result.end() ) result[det] = ParameterSet(type,det);
+  // helper object to temporarily store parameters and granularity info,
+  // reused for all IOVs
+  ParameterAggregator values;
 
-      }
-    
-    } // end of loop over tree
-    delete tree;
+  // reading: fill the module entries of the next IOV
+  size_t nextIOV = 0;
+  auto readNextIOV = [&](IOVColumns& cols) -> bool {
+    if( nextIOV == treeInfoPerIOV.size() ) return false;
+    cols.iovIdx = nextIOV++;
+    const TreeInfo& info = treeInfoPerIOV.at(cols.iovIdx);
+    readIOV(files.file(info.fileIdx),info.name,cols);
 
-    // store results
-    for(std::map<int,ParInfo>::const_iterator valIt = values.begin();
-	valIt != values.end(); ++valIt) {
-      const int origParIdx = valIt->first;
-      const ParInfo& pi = valIt->second;
-      const unsigned int minZIdx = *std::min_element(pi.rings.begin(),pi.rings.end());
-      const unsigned int maxZIdx = *std::max_element(pi.rings.begin(),pi.rings.end());
-      const unsigned int minRIdx = *std::min_element(pi.layers.begin(),pi.layers.end());
-      const unsigned int maxRIdx = *std::max_element(pi.layers.begin(),pi.layers.end());
+    return true;
+  };
 
-      // std::cout << "Adding result:" << std::endl;
-      // std::cout << "  zIdx: " << minZIdx << " - " << maxZIdx << std::endl;
-      // std::cout << "  rIdx: " << minRIdx << " - " << maxRIdx << std::endl;
-      // std::cout << "   val: " << pi.value << std::endl;
-      // std::cout << "  orig: " << origParIdx << std::endl;
+  // processing: aggregate the module entries of one IOV into the parameters
+  auto processIOV = [&](const IOVColumns& cols) {
+    const IOV& iov = treeInfoPerIOV.at(cols.iovIdx).iov;
+    aggregate(cols,values);
 
-      result[pi.det].add(minZIdx,maxZIdx,minRIdx,maxRIdx,iovIt->iov,pi.value,pi.delta,pi.error,origParIdx);
-    } // end of loop over stored values
+    // store results
+    if( index != 0 ) index->add(iov,cols.detIds,cols.parIdxs);
+    for(unsigned int origParIdx = 0; origParIdx < values.size(); ++origParIdx) {
+      const ParameterAggregator::ParInfo& pi = values.par(origParIdx);
+      if( !pi.filled ) continue;
+      store(type,iov,ParRecord(cols.iovIdx,origParIdx,pi),result);
+      if( index != 0 ) index->setParameter(cols.iovIdx,origParIdx,pi.value,pi.error);
+    }
+  };
 
-  } // end of loop over IOVs
+  // loop over IOVs
+  PrefetchPipeline<IOVColumns> pipeline(readahead_);
+  pipeline.run(readNextIOV,processIOV);
+  if( readahead_ > 0 ) pipeline.printStats("Reading IOVs");
+  if( index != 0 ) {
+    index->finalize();
+    index->print();
+  }
 
-  file.Close();
+  files.close();
 
   return result;
 }
+
+
+// Each worker reads a contiguous range of IOVs, so the records of
+// the shards in order are already sorted by IOV and, within an IOV,
+// by the original parameter index, as in the serial read. If an index
+// is filled, the workers also write the parameter of each module into
+// a second set of shards.
+void CalibrationParameterReader::readForked(const CalibrationParameterType type, const std::vector<TString>& fileNames, const std::vector<TreeInfo>& treeInfoPerIOV, std::map<Detector,ParameterSet>& result, ModuleParameterIndex* index) const {
+  const size_t nIOVs = treeInfoPerIOV.size();
+  const unsigned int nWorkers = std::max(1u,std::min(nProcesses_,static_cast<unsigned int>(nIOVs)));
+
+  auto readShard = [&](const unsigned int shard, ShardWriter<ParRecord>& out, ShardWriter<ModuleRecord>* modules) {
+    TreeFileSet files(fileNames);	// only the files of this worker's IOVs are opened
+    IOVColumns cols;
+    ParameterAggregator values;
+    for(size_t iovIdx = shard*nIOVs/nWorkers; iovIdx < (shard+1)*nIOVs/nWorkers; ++iovIdx) {
+      const TreeInfo& info = treeInfoPerIOV.at(iovIdx);
+      readIOV(files.file(info.fileIdx),info.name,cols);
+      aggregate(cols,values);
+      for(unsigned int origParIdx = 0; origParIdx < values.size(); ++origParIdx) {
+	const ParameterAggregator::ParInfo& pi = values.par(origParIdx);
+	if( pi.filled ) out.add(ParRecord(iovIdx,origParIdx,pi));
+      }
+      for(size_t i = 0; modules != 0 && i < cols.detIds.size(); ++i) {
+	ModuleRecord rec = { iovIdx, cols.detIds[i], cols.parIdxs[i] };
+	modules->add(rec);
+      }
+    }
+    files.close();
+  };
+
+  ForkedShards<ParRecord> shards(nWorkers);
+  ForkedShards<ModuleRecord> moduleShards(nWorkers);
+  if( index != 0 ) {
+    auto work = [&](const unsigned int shard, ShardWriter<ParRecord>& out, ShardWriter<ModuleRecord>& modules) {
+      readShard(shard,out,&modules);
+    };
+    shards.run(work,moduleShards);
+  } else {
+    auto work = [&](const unsigned int shard, ShardWriter<ParRecord>& out) {
+      readShard(shard,out,0);
+    };
+    shards.run(work);
+  }
+
+  size_t nRecords = 0;
+  for(unsigned int shard = 0; shard < shards.nShards(); ++shard) {
+    const ParRecord* recs = shards.records(shard);
+    for(size_t i = 0; i < shards.nRecords(shard); ++i) {
+      store(type,treeInfoPerIOV.at(recs[i].iovIdx).iov,recs[i],result);
+    }
+    nRecords += shards.nRecords(shard);
+  }
+  std::cout << "Read " << nIOVs << " IOVs in " << nWorkers << " processes (" << nRecords << " parameters)" << std::endl;
+
+  if( index != 0 ) {
+    fillIndex(moduleShards,treeInfoPerIOV,index);
+    for(unsigned int shard = 0; shard < shards.nShards(); ++shard) {
+      const ParRecord* recs = shards.records(shard);
+      for(size_t i = 0; i < shards.nRecords(shard); ++i) {
+	index->setParameter(recs[i].iovIdx,recs[i].origParIdx,recs[i].value,recs[i].error);
+      }
+    }
+    index->finalize();
+    index->print();
+  }
+}
+
+
+// As above, the module records of the shards in order are sorted by IOV
+void CalibrationParameterReader::fillIndex(const ForkedShards<ModuleRecord>& shards, const std::vector<TreeInfo>& treeInfoPerIOV, ModuleParameterIndex* index) const {
+  const size_t nIOVs = treeInfoPerIOV.size();
+
+  // IOVs without modules have no records but still need to be added
+  std::vector<unsigned int> detIds;
+  std::vector<int> parIdxs;
+  size_t nextIOV = 0;
+  for(unsigned int shard = 0; shard < shards.nShards(); ++shard) {
+    const ModuleRecord* recs = shards.records(shard);
+    for(size_t i = 0; i < shards.nRecords(shard); ++i) {
+      while( nextIOV < recs[i].iovIdx ) {
+	index->add(treeInfoPerIOV.at(nextIOV++).iov,detIds,parIdxs);
+	detIds.clear();
+	parIdxs.clear();
+      }
+      detIds.push_back(recs[i].detId);
+      parIdxs.push_back(recs[i].parIdx);
+    }
+  }
+  while( nextIOV < nIOVs ) {
+    index->add(treeInfoPerIOV.at(nextIOV++).iov,detIds,parIdxs);
+    detIds.clear();
+    parIdxs.clear();
+  }
+}
 #endif
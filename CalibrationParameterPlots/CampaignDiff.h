@@ -0,0 +1,361 @@
+#ifndef CAMPAIGN_DIFF_H
+#define CAMPAIGN_DIFF_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include "TCanvas.h"
+#include "TGraph.h"
+#include "TH1.h"
+#include "TH1D.h"
+#include "TLegend.h"
+#include "TString.h"
+
+#include "Detector.h"
+#include "IOV.h"
+#include "ParameterSet.h"
+#include "../Common/PlotBundle.h"
+
+
+// Differences between the calibration parameters of two campaigns,
+// e.g. a new alignment campaign and the previous one.
+//
+// The parameters are matched by type, detector and granularity element
+// (same ring and layer ranges). Since the IOV boundaries of the two
+// campaigns can differ, each pair of IOVs with overlapping run ranges
+// gives one entry, with the difference new - old in units of the
+// combined error,
+//   pull = (new - old) / sqrt( error_old^2 + error_new^2 ).
+//
+// Both the parameters of a ParameterSet and their IOVs are ordered, so
+// the join is a merge of the two sorted lists on either level and
+// linear in the number of parameters x IOVs.
+class CampaignDiff {
+public:
+  struct Entry {
+    CalibrationParameterType type;
+    Detector det;
+    unsigned int zMin;
+    unsigned int zMax;
+    unsigned int rMin;
+    unsigned int rMax;
+    unsigned int runMin;	// overlap of the two IOVs
+    unsigned int runMax;
+    double valueOld;
+    double errorOld;
+    double valueNew;
+    double errorNew;
+    double diff;
+    double pull;		// NaN if the combined error is 0
+  };
+
+  CampaignDiff()
+    : nUnmatchedOld_(0), nUnmatchedNew_(0), bundle_(0) {}
+
+  void add(const ParameterSet& parsOld, const ParameterSet& parsNew);
+  void add(const std::map<Detector,ParameterSet>& parsOld, const std::map<Detector,ParameterSet>& parsNew);
+
+  // Print the summary plots into the bundle instead of one file
+  // per plot. The bundle is not owned.
+  void setPlotBundle(PlotBundle* bundle) { bundle_ = bundle; }
+
+  size_t nEntries() const { return entries_.size(); }
+  const Entry& entry(const size_t i) const { return entries_.at(i); }
+
+  // parameters (or whole detectors) in only one of the campaigns
+  unsigned int nUnmatchedOld() const { return nUnmatchedOld_; }
+  unsigned int nUnmatchedNew() const { return nUnmatchedNew_; }
+
+  // entries ordered by decreasing |pull|, those without pull last
+  std::vector<size_t> ranking() const;
+
+  // the nMax entries with the largest |pull|
+  void print(std::ostream& out, const size_t nMax = 20) const;
+
+  // per type: pull distribution per detector,
+  // <outNamePrefix>_<type>_Pulls.pdf, and pull vs run,
+  // <outNamePrefix>_<type>_PullVsRun.pdf
+  void plot(const TString& outNamePrefix = "CalibDiff") const;
+
+
+private:
+  std::vector<Entry> entries_;
+  unsigned int nUnmatchedOld_;
+  unsigned int nUnmatchedNew_;
+  PlotBundle* bundle_;
+
+  void join(const CalibrationParameterType type, const Detector det, const GranularityElement& ge,
+	    const Parameter& parOld, const Parameter& parNew);
+  int color(const Detector det) const;
+  void save(TCanvas* can, const TString& outName, const TString& title) const;
+};
+
+
+void CampaignDiff::add(const std::map<Detector,ParameterSet>& parsOld, const std::map<Detector,ParameterSet>& parsNew) {
+  std::map<Detector,ParameterSet>::const_iterator itOld = parsOld.begin();
+  std::map<Detector,ParameterSet>::const_iterator itNew = parsNew.begin();
+  while( itOld != parsOld.end() || itNew != parsNew.end() ) {
+    if( itNew == parsNew.end() || ( itOld != parsOld.end() && itOld->first < itNew->first ) ) {
+      nUnmatchedOld_ += std::distance(itOld->second.parametersBegin(),itOld->second.parametersEnd());
+      ++itOld;
+    } else if( itOld == parsOld.end() || itNew->first < itOld->first ) {
+      nUnmatchedNew_ += std::distance(itNew->second.parametersBegin(),itNew->second.parametersEnd());
+      ++itNew;
+    } else {
+      add(itOld->second,itNew->second);
+      ++itOld;
+      ++itNew;
+    }
+  }
+}
+
+
+// Elements that are equivalent in the ordering but not identical,
+// i.e. overlapping ring or layer ranges, are not matched
+void CampaignDiff::add(const ParameterSet& parsOld, const ParameterSet& parsNew) {
+  if( parsOld.type() != parsNew.type() || parsOld.detector() != parsNew.detector() ) {
+    std::cerr << "\n\nERROR in CampaignDiff: comparing " << toStr(parsOld.type()) << " " << toStr(parsOld.detector())
+	      << " with " << toStr(parsNew.type()) << " " << toStr(parsNew.detector()) << "\n" << std::endl;
+    throw std::exception();
+  }
+
+  ParameterSet::ParameterIt itOld = parsOld.parametersBegin();
+  ParameterSet::ParameterIt itNew = parsNew.parametersBegin();
+  while( itOld != parsOld.parametersEnd() || itNew != parsNew.parametersEnd() ) {
+    if( itNew == parsNew.parametersEnd() || ( itOld != parsOld.parametersEnd() && itOld->first < itNew->first ) ) {
+      ++nUnmatchedOld_;
+      ++itOld;
+    } else if( itOld == parsOld.parametersEnd() || itNew->first < itOld->first ) {
+      ++nUnmatchedNew_;
+      ++itNew;
+    } else {
+      const GranularityElement& ge = itOld->first;
+      if( ge.zMin() == itNew->first.zMin() && ge.zMax() == itNew->first.zMax() &&
+	  ge.rMin() == itNew->first.rMin() && ge.rMax() == itNew->first.rMax() ) {
+	join(parsOld.type(),parsOld.detector(),ge,itOld->second,itNew->second);
+      } else {
+	++nUnmatchedOld_;
+	++nUnmatchedNew_;
+      }
+      ++itOld;
+      ++itNew;
+    }
+  }
+}
+
+
+// Interval-overlap join of the two IOV lists: of two overlapping IOVs,
+// the one ending first cannot overlap with any later IOV of the other
+// list, hence only that one is advanced
+void CampaignDiff::join(const CalibrationParameterType type, const Detector det, const GranularityElement& ge,
+			const Parameter& parOld, const Parameter& parNew) {
+  Parameter::ValueIt itOld = parOld.valuesBegin();
+  Parameter::ValueIt itNew = parNew.valuesBegin();
+  while( itOld != parOld.valuesEnd() && itNew != parNew.valuesEnd() ) {
+    const IOV& iovOld = itOld->first;
+    const IOV& iovNew = itNew->first;
+    const unsigned int runMin = std::max(iovOld.minRun(),iovNew.minRun());
+    const unsigned int runMax = std::min(iovOld.maxRun(),iovNew.maxRun());
+    if( runMin <= runMax ) {
+      Entry e;
+      e.type = type;
+      e.det = det;
+      e.zMin = ge.zMin();
+      e.zMax = ge.zMax();
+      e.rMin = ge.rMin();
+      e.rMax = ge.rMax();
+      e.runMin = runMin;
+      e.runMax = runMax;
+      e.valueOld = itOld->second.at(0);
+      e.errorOld = itOld->second.at(2);
+      e.valueNew = itNew->second.at(0);
+      e.errorNew = itNew->second.at(2);
+      e.diff = e.valueNew - e.valueOld;
+      const double err = std::sqrt( e.errorOld*e.errorOld + e.errorNew*e.errorNew );
+      e.pull = err > 0. ? e.diff/err : std::numeric_limits<double>::quiet_NaN();
+      entries_.push_back(e);
+    }
+    if( iovOld.maxRun() < iovNew.maxRun() ) ++itOld;
+    else if( iovNew.maxRun() < iovOld.maxRun() ) ++itNew;
+    else {
+      ++itOld;
+      ++itNew;
+    }
+  }
+}
+
+
+std::vector<size_t> CampaignDiff::ranking() const {
+  std::vector<size_t> order(entries_.size());
+  for(size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(),order.end(),[this](const size_t a, const size_t b) {
+      const double pa = entries_[a].pull;
+      const double pb = entries_[b].pull;
+      if( std::isnan(pa) ) return false;
+      if( std::isnan(pb) ) return true;
+      return std::abs(pa) > std::abs(pb);
+    });
+
+  return order;
+}
+
+
+void CampaignDiff::print(std::ostream& out, const size_t nMax) const {
+  out << entries_.size() << " matched parameter IOVs, " << nUnmatchedOld_ << " parameters only in old, "
+      << nUnmatchedNew_ << " only in new campaign" << std::endl;
+  const std::vector<size_t> order = ranking();
+  char txt[300];
+  snprintf(txt,300,"  %4s  %-12s %-5s %-7s %-7s %-15s %12s %12s %12s %8s",
+	   "rank","type","det","z","r","runs","old","new","new-old","pull");
+  out << txt << std::endl;
+  for(size_t i = 0; i < order.size() && i < nMax; ++i) {
+    const Entry& e = entries_[order[i]];
+    TString z("");
+    z += e.zMin;
+    if( e.zMax != e.zMin ) {
+      z += "-";
+      z += e.zMax;
+    }
+    TString r("");
+    r += e.rMin;
+    if( e.rMax != e.rMin ) {
+      r += "-";
+      r += e.rMax;
+    }
+    snprintf(txt,300,"  %4lu  %-12s %-5s %-7s %-7s %-15s % 12.5g % 12.5g % 12.5g % 8.2f",
+	     static_cast<unsigned long>(i+1),toStr(e.type).Data(),toStr(e.det).Data(),z.Data(),r.Data(),
+	     IOV(e.runMin,e.runMax)().Data(),e.valueOld,e.valueNew,e.diff,e.pull);
+    out << txt << std::endl;
+  }
+}
+
+
+int CampaignDiff::color(const Detector det) const {
+  if( det == BPIX ) return kBlack;
+  if( det == FPIX ) return kRed;
+  if( det == TIB  ) return kBlue;
+  if( det == TOB  ) return kGreen+2;
+
+  else              return kOrange;
+}
+
+
+void CampaignDiff::save(TCanvas* can, const TString& outName, const TString& title) const {
+  if( bundle_ != 0 ) bundle_->add(can,outName,title);
+  else               can->SaveAs(outName+".pdf");
+}
+
+
+void CampaignDiff::plot(const TString& outNamePrefix) const {
+  // entries per type and detector
+  typedef std::map< Detector, std::vector<size_t> > EntriesPerDet;
+  std::map<CalibrationParameterType,EntriesPerDet> groups;
+  for(size_t i = 0; i < entries_.size(); ++i) {
+    if( std::isnan(entries_[i].pull) ) continue;
+    groups[entries_[i].type][entries_[i].det].push_back(i);
+  }
+
+  TCanvas* can = new TCanvas("can_"+outNamePrefix,"campaign differences",500,500);
+  for(std::map<CalibrationParameterType,EntriesPerDet>::const_iterator itT = groups.begin();
+      itT != groups.end(); ++itT) {
+    const TString outName = outNamePrefix+"_"+toStr(itT->first);
+
+    // pull distributions
+    double pullMax = 5.;
+    for(EntriesPerDet::const_iterator itD = itT->second.begin(); itD != itT->second.end(); ++itD) {
+      for(size_t i = 0; i < itD->second.size(); ++i) {
+	pullMax = std::max(pullMax,std::abs(entries_[itD->second[i]].pull));
+      }
+    }
+    pullMax = std::ceil(1.05*pullMax);
+    can->cd();
+    TLegend* leg = new TLegend(0.65,0.7,0.9,0.9);
+    leg->SetBorderSize(0);
+    leg->SetFillStyle(0);
+    leg->SetTextFont(42);
+    std::vector<TH1*> hists;
+    double yMax = 0.;
+    for(EntriesPerDet::const_iterator itD = itT->second.begin(); itD != itT->second.end(); ++itD) {
+      TH1* h = new TH1D("hPulls_"+outName+"_"+toStr(itD->first),";(new - old) / #sigma;parameter IOVs",
+			static_cast<int>(4*pullMax),-pullMax,pullMax);
+      for(size_t i = 0; i < itD->second.size(); ++i) {
+	h->Fill(entries_[itD->second[i]].pull);
+      }
+      h->SetLineColor(color(itD->first));
+      h->SetLineWidth(2);
+      yMax = std::max(yMax,h->GetMaximum());
+      leg->AddEntry(h,toStr(itD->first),"L");
+      hists.push_back(h);
+    }
+    for(size_t i = 0; i < hists.size(); ++i) {
+      hists[i]->GetYaxis()->SetRangeUser(0.,1.3*yMax);
+      hists[i]->Draw(i == 0 ? "HIST" : "HISTsame");
+    }
+    leg->Draw("same");
+    save(can,outName+"_Pulls",toStr(itT->first)+": pulls new vs old");
+    if( bundle_ != 0 ) {
+      for(size_t i = 0; i < hists.size(); ++i) {
+	bundle_->write(hists[i],hists[i]->GetName());
+      }
+    }
+    for(size_t i = 0; i < hists.size(); ++i) {
+      delete hists[i];
+    }
+    delete leg;
+
+    // pull vs first run of the overlap
+    can->Clear();
+    can->cd();
+    leg = new TLegend(0.65,0.7,0.9,0.9);
+    leg->SetBorderSize(0);
+    leg->SetFillStyle(0);
+    leg->SetTextFont(42);
+    double runMin = 1E10;
+    double runMax = 0.;
+    std::vector<TGraph*> graphs;
+    for(EntriesPerDet::const_iterator itD = itT->second.begin(); itD != itT->second.end(); ++itD) {
+      std::vector<double> runs;
+      std::vector<double> pulls;
+      for(size_t i = 0; i < itD->second.size(); ++i) {
+	const Entry& e = entries_[itD->second[i]];
+	runs.push_back(e.runMin);
+	pulls.push_back(e.pull);
+	runMin = std::min(runMin,runs.back());
+	runMax = std::max(runMax,runs.back());
+      }
+      TGraph* g = new TGraph(runs.size(),&(runs.front()),&(pulls.front()));
+      g->SetName("gPullVsRun_"+outName+"_"+toStr(itD->first));
+      g->SetMarkerStyle(20);
+      g->SetMarkerSize(0.6);
+      g->SetMarkerColor(color(itD->first));
+      leg->AddEntry(g,toStr(itD->first),"P");
+      graphs.push_back(g);
+    }
+    TH1* frame = new TH1D("hFrame_"+outName,";first run;(new - old) / #sigma",1000,runMin-1,runMax+1);
+    frame->GetYaxis()->SetRangeUser(-pullMax,pullMax);
+    frame->SetLineStyle(2);
+    frame->Draw("HIST");
+    for(size_t i = 0; i < graphs.size(); ++i) {
+      graphs[i]->Draw("Psame");
+    }
+    leg->Draw("same");
+    save(can,outName+"_PullVsRun",toStr(itT->first)+": pulls vs run");
+    for(size_t i = 0; i < graphs.size(); ++i) {
+      if( bundle_ != 0 ) bundle_->write(graphs[i],graphs[i]->GetName());
+      delete graphs[i];
+    }
+    delete frame;
+    delete leg;
+    can->Clear();
+  }
+  delete can;
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include <exception>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <vector>
 
 #include "TFile.h"
 #include "TString.h"
@@ -23,6 +25,64 @@ TString toStr(Detector det) {
 }
 
 
+// Bit layouts of the CMS tracker DetIds, as in TrackerTopology
+// (Geometry/TrackerNumberingBuilder/data/trackerParameters.xml).
+// The layout of the strip detectors is the same in all versions.
+enum TrackerTopologyVersion { TopologyFromFile=-1, Phase0Topology, Phase1Topology };
+
+struct DetIdField {
+  unsigned int startBit;
+  unsigned int mask;
+
+  constexpr unsigned int operator()(const unsigned int id) const { return (id >> startBit) & mask; }
+};
+
+struct DetIdLayout {
+  DetIdField pxbLayer;
+  DetIdField pxbModule;
+  DetIdField pxfSide;
+  DetIdField pxfDisk;
+  DetIdField tibLayer;
+  DetIdField tibSide;		// str_fw_bw
+  DetIdField tibModule;
+  DetIdField tidSide;
+  DetIdField tidWheel;
+  DetIdField tidRing;
+  DetIdField tobLayer;
+  DetIdField tobSide;		// rod_fw_bw
+  DetIdField tobModule;
+  DetIdField tecSide;
+  DetIdField tecWheel;
+  DetIdField tecRing;
+};
+
+constexpr DetIdLayout detIdLayouts[2] = {
+  // Phase0Topology
+  { {16,0xF}, {2,0x3F}, {23,0x3}, {16,0xF},
+    {14,0x7}, {12,0x3}, {2,0x3},
+    {13,0x3}, {11,0x3}, {9,0x3},
+    {14,0x7}, {12,0x3}, {2,0x7},
+    {18,0x3}, {14,0xF}, {5,0x7} },
+  // Phase1Topology
+  { {20,0xF}, {2,0x3FF}, {23,0x3}, {18,0xF},
+    {14,0x7}, {12,0x3}, {2,0x3},
+    {13,0x3}, {11,0x3}, {9,0x3},
+    {14,0x7}, {12,0x3}, {2,0x7},
+    {18,0x3}, {14,0xF}, {5,0x7} }
+};
+
+constexpr DetIdField detIdDetector = {28,0xF}; // 1 for Tracker
+constexpr DetIdField detIdSubdet = {25,0x7};   // 1-6 for BPIX...TEC
+
+
+// Bit masks to select detectors, e.g. BPIXMask | FPIXMask
+enum DetectorMask {
+  NoDetectorMask=0,
+  BPIXMask=1<<BPIX, FPIXMask=1<<FPIX, TIBMask=1<<TIB, TIDMask=1<<TID, TOBMask=1<<TOB, TECMask=1<<TEC,
+  AllDetectorsMask=0x3F
+};
+
+
 class Tracker {
 private:
   struct SensorInfo {
@@ -41,28 +101,72 @@ private:
 
 
 public:
-  Tracker() {}
-  Tracker(const TString& fileName) { initCMS(fileName); }
+  Tracker()
+    : topology_(TopologyFromFile), mask_(NoDetectorMask), loaded_(NoDetectorMask) {}
+
+  // Sensors are read from the geometry file lazily, one detector at
+  // a time when the first of its sensors is accessed, and only for
+  // the detectors in the mask (see DetectorMask). The Tracker may be
+  // shared by several threads.
+  Tracker(const TString& fileName, const unsigned int mask = AllDetectorsMask)
+    : topology_(TopologyFromFile), fileName_(fileName), mask_(mask), loaded_(NoDetectorMask) {}
+
+  // Decodes the sensor information arithmetically from the DetId,
+  // no geometry file needed. In addition to the detectors known
+  // from the geometry file, also TID and TEC are decoded.
+  Tracker(const TrackerTopologyVersion topology)
+    : topology_(topology), mask_(AllDetectorsMask), loaded_(AllDetectorsMask) {}
 
-  Detector detector(const unsigned int id) const { return findSensor(id)->second.det; }
+  // Reads the sensors of these detectors now instead of on first
+  // access, e.g. before forking processes that share them
+  void load(const unsigned int mask) const;
+
+  // Compares the decoded sensor information with the geometry file
+  // and returns the number of differing sensors
+  unsigned int crossCheck(const TString& fileName) const;
+
+  Detector detector(const unsigned int id) const { return sensor(id).det; }
 
   // ring refers to units along global z
-  unsigned int ring(const unsigned int id) const { return findSensor(id)->second.ring; }
+  unsigned int ring(const unsigned int id) const { return sensor(id).ring; }
 
   // layer refers to units along global r
-  unsigned int layer(const unsigned int id) const { return findSensor(id)->second.layer; }
+  unsigned int layer(const unsigned int id) const { return sensor(id).layer; }
 
 
 private:
-  Sensors sensors_;
+  TrackerTopologyVersion topology_;
+  TString fileName_;
+  unsigned int mask_;
+
+  // filled on demand, guarded by mutex_
+  mutable std::mutex mutex_;
+  mutable unsigned int loaded_;
+  mutable Sensors sensors_;
+  mutable std::vector< std::vector<Long64_t> > entriesPerDet_; // tree entries of each detector
 
-  void initCMS(const TString& fileName);
+  void initCMS(const unsigned int mask) const;
   SensorIt findSensor(const unsigned int id) const;
+  SensorInfo decode(const unsigned int id) const;
+  SensorInfo sensor(const unsigned int id) const {
+    return topology_ == TopologyFromFile ? findSensor(id)->second : decode(id);
+  }
 };
 
 
 Tracker::SensorIt Tracker::findSensor(const unsigned int id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
   SensorIt it = sensors_.find(id);
+  const unsigned int subdet = detIdSubdet(id);
+  if( it == sensors_.end() && detIdDetector(id) == 1 && subdet >= 1 && subdet <= TEC+1 ) {
+    // the sub-detector bits are the same in all topologies
+    const unsigned int detBit = 1u << (subdet-1);
+    if( (mask_ & detBit) && !(loaded_ & detBit) ) {
+      initCMS(detBit);
+      loaded_ |= detBit;
+      it = sensors_.find(id);
+    }
+  }
   if( it == sensors_.end() ) {
     std::cerr << "\n\nERROR in Tracker: trying to access unknown sensor '" << id << "'\n" << std::endl;
     throw std::exception();
@@ -72,14 +176,107 @@ Tracker::SensorIt Tracker::findSensor(const unsigned int id) const {
 }
 
 
+// Same conventions as in initCMS(), in addition
+// TID: ring = wheels from -z to +z (0-5),  layer = ring-1 (0-2)
+// TEC: ring = wheels from -z to +z (0-17), layer = ring-1 (0-6)
+Tracker::SensorInfo Tracker::decode(const unsigned int id) const {
+  if( detIdDetector(id) != 1 ) {
+    std::cerr << "\n\nERROR in Tracker: '" << id << "' is not a tracker DetId\n" << std::endl;
+    throw std::exception();
+  }
+  const DetIdLayout& dl = detIdLayouts[topology_];
+  const unsigned int subdet = detIdSubdet(id);
+  if( subdet == 1 ) {
+    return SensorInfo(BPIX,dl.pxbLayer(id)-1,dl.pxbModule(id)-1);
+  } else if( subdet == 2 ) {
+    return SensorInfo(FPIX,0,dl.pxfSide(id)==1 ? 0 : 1);
+  } else if( subdet == 3 ) {
+    const unsigned int side = dl.tibSide(id);
+    const unsigned int module = dl.tibModule(id);
+    unsigned int ring = 999999;
+    if(      side == 1 ) ring = 3-module;
+    else if( side == 2 ) ring = 2+module;
+    return SensorInfo(TIB,dl.tibLayer(id)-1,ring);
+  } else if( subdet == 4 ) {
+    const unsigned int side = dl.tidSide(id);
+    const unsigned int wheel = dl.tidWheel(id);
+    unsigned int ring = 999999;
+    if(      side == 1 ) ring = 3-wheel;
+    else if( side == 2 ) ring = 2+wheel;
+    return SensorInfo(TID,dl.tidRing(id)-1,ring);
+  } else if( subdet == 5 ) {
+    const unsigned int side = dl.tobSide(id);
+    const unsigned int module = dl.tobModule(id);
+    unsigned int ring = 999999;
+    if(      side == 1 ) ring = 6-module;
+    else if( side == 2 ) ring = 5+module;
+    return SensorInfo(TOB,dl.tobLayer(id)-1,ring);
+  } else if( subdet == 6 ) {
+    const unsigned int side = dl.tecSide(id);
+    const unsigned int wheel = dl.tecWheel(id);
+    unsigned int ring = 999999;
+    if(      side == 1 ) ring = 9-wheel;
+    else if( side == 2 ) ring = 8+wheel;
+    return SensorInfo(TEC,dl.tecRing(id)-1,ring);
+  }
+
+  std::cerr << "\n\nERROR in Tracker: unknown sub-detector " << subdet << " in DetId '" << id << "'\n" << std::endl;
+  throw std::exception();
+
+  return SensorInfo();
+}
+
+
+// Sensors in detectors not known to initCMS (TID, TEC) are not compared
+unsigned int Tracker::crossCheck(const TString& fileName) const {
+  if( topology_ == TopologyFromFile ) return 0;
+
+  const Tracker fromFile(fileName);
+  fromFile.load(AllDetectorsMask);
+  unsigned int nDiffs = 0;
+  for(SensorIt it = fromFile.sensors_.begin(); it != fromFile.sensors_.end(); ++it) {
+    const SensorInfo& expected = it->second;
+    if( expected.det == UNKNOWN ) continue;
+    const SensorInfo decoded = decode(it->first);
+    if( decoded.det != expected.det || decoded.layer != expected.layer || decoded.ring != expected.ring ) {
+      if( nDiffs < 10 ) {
+	std::cout << "  sensor " << it->first << ": file " << toStr(expected.det) << " layer " << expected.layer << " ring " << expected.ring
+		  << ", decoded " << toStr(decoded.det) << " layer " << decoded.layer << " ring " << decoded.ring << std::endl;
+      }
+      ++nDiffs;
+    }
+  }
+  std::cout << "Cross-check of DetId decoding with '" << fileName << "': " << nDiffs << " differing sensors" << std::endl;
+
+  return nDiffs;
+}
+
+
+void Tracker::load(const unsigned int mask) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const unsigned int toLoad = mask & mask_ & ~loaded_;
+  if( toLoad == NoDetectorMask ) return;
+  initCMS(toLoad);
+  loaded_ |= toLoad;
+}
+
+
 // dimensions in cm
-void Tracker::initCMS(const TString& fileName) {
-  std::cout << "Initialising CMS" << std::endl;
-    
+//
+// Reads the sensors of the detectors in the mask. The SubdetId of all
+// entries is read only once, the other branches only for the entries
+// of the requested detectors.
+void Tracker::initCMS(const unsigned int mask) const {
+  std::cout << "Initialising CMS" << std::flush;
+  for(int det = BPIX; det <= TEC; ++det) {
+    if( mask & (1u << det) ) std::cout << " " << toStr(static_cast<Detector>(det)) << std::flush;
+  }
+  std::cout << std::endl;
+
   // open file with tracker info
-  TFile file(fileName,"READ");
+  TFile file(fileName_,"READ");
   if( !file.IsOpen() ) {
-    std::cerr << "\n\nERROR opening file '" << fileName << "'\n" << std::endl;
+    std::cerr << "\n\nERROR opening file '" << fileName_ << "'\n" << std::endl;
     throw std::exception();
   }
 
@@ -87,7 +284,7 @@ void Tracker::initCMS(const TString& fileName) {
   const TString treeName = "TrackerTreeGenerator/TrackerTree/TrackerTree";
   file.GetObject(treeName,tree);
   if( tree == 0 ) {
-    std::cerr << "\n\nERROR reading tree '" << treeName << "' from file '" << fileName << "'\n" << std::endl;
+    std::cerr << "\n\nERROR reading tree '" << treeName << "' from file '" << fileName_ << "'\n" << std::endl;
     throw std::exception();
   }
   
@@ -97,58 +294,84 @@ void Tracker::initCMS(const TString& fileName) {
   unsigned int theLayer = 0;
   unsigned int theSide = 0;
   unsigned int theModule = 0;
+
+  // the detector encoding in tree
+  // BPIX: 1
+  // FPIX: 2
+  // TIB:  3
+  // TID:  4
+  // TOB:  5
+  // TEC:  6
+  if( entriesPerDet_.empty() ) {
+    entriesPerDet_.resize(TEC+1);
+    TBranch* subdetBranch = tree->GetBranch("SubdetId");
+    if( subdetBranch == 0 ) {
+      std::cerr << "\n\nERROR no branch 'SubdetId' in tree '" << treeName << "'\n" << std::endl;
+      throw std::exception();
+    }
+    subdetBranch->SetAddress(&theDetId);
+    const Long64_t nEntries = tree->GetEntries();
+    for(Long64_t iE = 0; iE < nEntries; ++iE) {
+      subdetBranch->GetEntry(iE);
+      if( theDetId >= 1 && theDetId <= 6 ) entriesPerDet_.at(theDetId-1).push_back(iE);
+    }
+  }
+
+  tree->SetBranchStatus("*",0);
+  tree->SetBranchStatus("RawId",1);
+  tree->SetBranchStatus("SubdetId",1);
+  tree->SetBranchStatus("Layer",1);
+  tree->SetBranchStatus("Side",1);
+  tree->SetBranchStatus("Module",1);
   tree->SetBranchAddress("RawId",&theSensorId);
   tree->SetBranchAddress("SubdetId",&theDetId);
   tree->SetBranchAddress("Layer",&theLayer);
   tree->SetBranchAddress("Side",&theSide);
   tree->SetBranchAddress("Module",&theModule);
 
-  for(int iE = 0; iE < tree->GetEntries(); ++iE) {
-    tree->GetEntry(iE);
-    
-    // the detector encoding in tree
-    // BPIX: 1
-    // FPIX: 2
-    // TIB:  3
-    // TID:  4
-    // TOB:  5
-    // TEC:  6
-    Detector theDet = UNKNOWN;
-    if(      theDetId == 1 ) theDet = BPIX;
-    else if( theDetId == 2 ) theDet = FPIX;
-    else if( theDetId == 3 ) theDet = TIB;
-    else if( theDetId == 5 ) theDet = TOB;
-
-    // in this script, 'ring' refers to units along z
-    unsigned int theRing = 999999;	// so far, only for BPIX, TIB and TOB
-    if( theDet == BPIX ) {
-      // translate 'module' index into rings
-      theRing = theModule-1;
-      theLayer = theLayer-1;
-
-    } else if( theDet == FPIX ) {
-      // translate 'side' index into rings
-      theRing = theSide==1 ? 0 : 1;
-      theLayer = 0;
-
-    } else if( theDet == TIB ) {
-      // translate 'side' and 'module' indices into rings
-      // side   : 1 for -z, 2 for +x
-      // module : 1,2,3 for rings from z=0 to +/-z
-      if(       theSide == 1 ) theRing = 3-theModule;
-      else if ( theSide == 2 ) theRing = 2+theModule;
-      theLayer = theLayer-1;
-
-    } else if( theDet == TOB ) {
-      // translate 'side' and 'module' indices into rings
-      // side   : 1 for -z, 2 for +x
-      // module : 1,2,3,4,5,6 for rings from z=0 to +/-z
-      if(       theSide == 1 ) theRing = 6-theModule;
-      else if ( theSide == 2 ) theRing = 5+theModule;
-      theLayer = theLayer-1;
-    }    
-
-    sensors_[theSensorId] = SensorInfo(theDet,theLayer,theRing);
+  for(int det = BPIX; det <= TEC; ++det) {
+    if( !(mask & (1u << det)) ) continue;
+    const std::vector<Long64_t>& entries = entriesPerDet_.at(det);
+    for(size_t i = 0; i < entries.size(); ++i) {
+      tree->GetEntry(entries[i]);
+
+      Detector theDet = UNKNOWN;
+      if(      theDetId == 1 ) theDet = BPIX;
+      else if( theDetId == 2 ) theDet = FPIX;
+      else if( theDetId == 3 ) theDet = TIB;
+      else if( theDetId == 5 ) theDet = TOB;
+
+      // in this script, 'ring' refers to units along z
+      unsigned int theRing = 999999;	// so far, only for BPIX, TIB and TOB
+      if( theDet == BPIX ) {
+	// translate 'module' index into rings
+	theRing = theModule-1;
+	theLayer = theLayer-1;
+
+      } else if( theDet == FPIX ) {
+	// translate 'side' index into rings
+	theRing = theSide==1 ? 0 : 1;
+	theLayer = 0;
+
+      } else if( theDet == TIB ) {
+	// translate 'side' and 'module' indices into rings
+	// side   : 1 for -z, 2 for +x
+	// module : 1,2,3 for rings from z=0 to +/-z
+	if(       theSide == 1 ) theRing = 3-theModule;
+	else if ( theSide == 2 ) theRing = 2+theModule;
+	theLayer = theLayer-1;
+
+      } else if( theDet == TOB ) {
+	// translate 'side' and 'module' indices into rings
+	// side   : 1 for -z, 2 for +x
+	// module : 1,2,3,4,5,6 for rings from z=0 to +/-z
+	if(       theSide == 1 ) theRing = 6-theModule;
+	else if ( theSide == 2 ) theRing = 5+theModule;
+	theLayer = theLayer-1;
+      }    
+
+      sensors_[theSensorId] = SensorInfo(theDet,theLayer,theRing);
+    }
   }
 
   delete tree;
@@ -0,0 +1,79 @@
+#ifndef IOV_INDEX_H
+#define IOV_INDEX_H
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include "IOV.h"
+
+
+// Sorted index over the boundaries of a set of IOVs to find
+// the IOV of a given run in O(log nIOVs). The position returned
+// by lookup() is the same as the IOV index used in ParameterSet.
+class IOVIndex {
+public:
+  IOVIndex() {}
+  IOVIndex(const IOVIt begin, const IOVIt end);
+
+  unsigned int size() const { return runMins_.size(); }
+  IOV iov(const unsigned int idx) const { return IOV(runMins_.at(idx),runMaxs_.at(idx)); }
+
+  // position of the IOV containing run, -1 if the run is not in any IOV
+  int lookup(const unsigned int run) const;
+
+  // positions of the IOVs containing runs[0...n-1]
+  void lookup(const unsigned int* runs, const size_t n, int* iovIdx) const;
+
+
+private:
+  std::vector<unsigned int> runMins_;
+  std::vector<unsigned int> runMaxs_;
+
+  int find(const unsigned int run) const;
+};
+
+
+IOVIndex::IOVIndex(const IOVIt begin, const IOVIt end) {
+  for(IOVIt it = begin; it != end; ++it) {
+    if( runMins_.size() > 0 && it->minRun() <= runMaxs_.back() ) {
+      std::cerr << "\n\nERROR in IOVIndex: overlapping IOVs " << (it->minRun()) << " <= " << runMaxs_.back() << "\n" << std::endl;
+      throw std::exception();
+    }
+    runMins_.push_back(it->minRun());
+    runMaxs_.push_back(it->maxRun());
+  }
+}
+
+
+int IOVIndex::lookup(const unsigned int run) const {
+  return find(run);
+}
+
+
+// Runs in a batch typically come in long stretches from the same IOV,
+// hence check the IOV of the previous run before searching.
+void IOVIndex::lookup(const unsigned int* runs, const size_t n, int* iovIdx) const {
+  int last = -1;
+  for(size_t i = 0; i < n; ++i) {
+    const unsigned int run = runs[i];
+    if( !( last > -1 && runMins_[last] <= run && run <= runMaxs_[last] ) ) {
+      last = find(run);
+    }
+    iovIdx[i] = last;
+  }
+}
+
+
+int IOVIndex::find(const unsigned int run) const {
+  // first IOV with runMin > run; the candidate is the one before
+  std::vector<unsigned int>::const_iterator it = std::upper_bound(runMins_.begin(),runMins_.end(),run);
+  if( it == runMins_.begin() ) return -1;
+  const int idx = static_cast<int>(it-runMins_.begin()) - 1;
+  if( run > runMaxs_[idx] ) return -1; // in a gap between IOVs
+
+  return idx;
+}
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef MODULE_PARAMETER_INDEX_H
+#define MODULE_PARAMETER_INDEX_H
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "TString.h"
+
+#include "IOV.h"
+
+
+// Inverted index from the modules to the calibration parameters, e.g.
+//   "what LA value applied to module 302055684 in each IOV?"
+// Each module (detId) gets a dense slot; per IOV, the slot is assigned
+// the parIdx of the parameter it belongs to, or -1 if it has none.
+//
+// Since the assignment rarely changes between IOVs, it is stored
+// run-length encoded: per slot, only the IOVs where the parIdx changes
+// are kept, as (first IOV, parIdx) runs in one contiguous array ordered
+// by slot. The values are stored once per parameter and IOV.
+//
+// The index is filled IOV by IOV with add() and setParameter(), e.g. by
+// CalibrationParameterReader, and becomes usable after finalize().
+class ModuleParameterIndex {
+public:
+  ModuleParameterIndex()
+    : finalized_(false) {}
+
+  // IOVs have to be added in order; modules without parameter
+  // in this IOV may be omitted or given with parIdx -1
+  void add(const IOV& iov, const std::vector<unsigned int>& detIds, const std::vector<int>& parIdxs);
+  void setParameter(const unsigned int iovIdx, const int parIdx, const float value, const float error);
+  void finalize();
+
+  unsigned int nIOVs() const { return iovs_.size(); }
+  const IOV& iov(const unsigned int iovIdx) const { return iovs_.at(iovIdx); }
+  size_t nModules() const { return detIds_.size(); }
+  unsigned int detId(const size_t slot) const { return detIds_.at(slot); }
+  size_t nRuns() const { return runIOVs_.size(); }
+
+  // slot of the module, -1 if not in the index
+  long slot(const unsigned int detId) const;
+
+  int parIdx(const unsigned int detId, const unsigned int iovIdx) const;
+  float value(const unsigned int detId, const unsigned int iovIdx) const;
+  float error(const unsigned int detId, const unsigned int iovIdx) const;
+
+  // parIdx and value of the module for all IOVs; modules not in the
+  // index and IOVs without parameter give -1 and NaN
+  void history(const unsigned int detId, std::vector<int>& parIdxs, std::vector<float>& values) const;
+
+  // parIdx and value of all modules, indexed by slot, for one IOV
+  void expand(const unsigned int iovIdx, std::vector<int>& parIdxs, std::vector<float>& values) const;
+
+  // values of all modules for all IOVs, [slot*nIOVs()+iovIdx]
+  void expand(std::vector<float>& values) const;
+
+  void print() const;
+
+
+private:
+  struct Run {
+    size_t slot;
+    unsigned int iovIdx;
+    int parIdx;
+  };
+
+  std::vector<IOV> iovs_;
+  std::vector<unsigned int> detIds_;			// [slot]
+  std::unordered_map<unsigned int,size_t> slots_;	// detId -> slot
+  std::vector< std::vector<float> > values_;		// [iov][parIdx]
+  std::vector< std::vector<float> > errors_;
+
+  // while filling: current parIdx of each slot and the IOV in
+  // which it was last seen, and the runs in the order of the IOVs
+  std::vector<int> current_;
+  std::vector<unsigned int> lastSeen_;
+  std::vector<Run> pending_;
+  bool finalized_;
+
+  // runs of slot s are [runStart_[s],runStart_[s+1])
+  std::vector<size_t> runStart_;
+  std::vector<unsigned int> runIOVs_;
+  std::vector<int> runParIdxs_;
+
+  void checkFinalized() const;
+  int parIdxOfSlot(const size_t slot, const unsigned int iovIdx) const;
+  float lookup(const std::vector< std::vector<float> >& table, const unsigned int iovIdx, const int parIdx) const;
+};
+
+
+void ModuleParameterIndex::add(const IOV& iov, const std::vector<unsigned int>& detIds, const std::vector<int>& parIdxs) {
+  if( finalized_ ) {
+    std::cerr << "\n\nERROR in ModuleParameterIndex: adding IOV " << iov() << " after finalize()\n" << std::endl;
+    throw std::exception();
+  }
+  if( detIds.size() != parIdxs.size() ) {
+    std::cerr << "\n\nERROR in ModuleParameterIndex: inconsistent number of modules\n" << std::endl;
+    throw std::exception();
+  }
+  const unsigned int iovIdx = iovs_.size();
+  iovs_.push_back(iov);
+  values_.push_back(std::vector<float>());
+  errors_.push_back(std::vector<float>());
+
+  for(size_t i = 0; i < detIds.size(); ++i) {
+    std::unordered_map<unsigned int,size_t>::const_iterator it = slots_.find(detIds[i]);
+    if( it == slots_.end() ) {
+      it = slots_.insert(std::make_pair(detIds[i],detIds_.size())).first;
+      detIds_.push_back(detIds[i]);
+      current_.push_back(-1);
+      lastSeen_.push_back(iovIdx);
+    }
+    const size_t s = it->second;
+    lastSeen_[s] = iovIdx;
+    if( current_[s] != parIdxs[i] ) {
+      current_[s] = parIdxs[i];
+      Run run = { s, iovIdx, parIdxs[i] };
+      pending_.push_back(run);
+    }
+  }
+
+  // modules not in this IOV have no parameter
+  for(size_t s = 0; s < detIds_.size(); ++s) {
+    if( lastSeen_[s] != iovIdx && current_[s] != -1 ) {
+      current_[s] = -1;
+      Run run = { s, iovIdx, -1 };
+      pending_.push_back(run);
+    }
+  }
+}
+
+
+void ModuleParameterIndex::setParameter(const unsigned int iovIdx, const int parIdx, const float value, const float error) {
+  if( iovIdx >= iovs_.size() || parIdx < 0 ) {
+    std::cerr << "\n\nERROR in ModuleParameterIndex: no IOV " << iovIdx << " or parIdx " << parIdx << " < 0\n" << std::endl;
+    throw std::exception();
+  }
+  std::vector<float>& values = values_[iovIdx];
+  std::vector<float>& errors = errors_[iovIdx];
+  if( parIdx >= static_cast<int>(values.size()) ) {
+    values.resize(parIdx+1,std::numeric_limits<float>::quiet_NaN());
+    errors.resize(parIdx+1,std::numeric_limits<float>::quiet_NaN());
+  }
+  values[parIdx] = value;
+  errors[parIdx] = error;
+}
+
+
+// Counting sort of the runs by slot; within a slot, they stay
+// ordered by IOV
+void ModuleParameterIndex::finalize() {
+  if( finalized_ ) return;
+
+  const size_t nSlots = detIds_.size();
+  runStart_.assign(nSlots+1,0);
+  for(size_t i = 0; i < pending_.size(); ++i) {
+    ++runStart_[pending_[i].slot+1];
+  }
+  for(size_t s = 0; s < nSlots; ++s) {
+    runStart_[s+1] += runStart_[s];
+  }
+  std::vector<size_t> next(runStart_.begin(),runStart_.end()-1);
+  runIOVs_.resize(pending_.size());
+  runParIdxs_.resize(pending_.size());
+  for(size_t i = 0; i < pending_.size(); ++i) {
+    const size_t pos = next[pending_[i].slot]++;
+    runIOVs_[pos] = pending_[i].iovIdx;
+    runParIdxs_[pos] = pending_[i].parIdx;
+  }
+
+  std::vector<Run>().swap(pending_);
+  std::vector<int>().swap(current_);
+  std::vector<unsigned int>().swap(lastSeen_);
+  finalized_ = true;
+}
+
+
+void ModuleParameterIndex::checkFinalized() const {
+  if( !finalized_ ) {
+    std::cerr << "\n\nERROR in ModuleParameterIndex: finalize() has not been called\n" << std::endl;
+    throw std::exception();
+  }
+}
+
+
+long ModuleParameterIndex::slot(const unsigned int detId) const {
+  std::unordered_map<unsigned int,size_t>::const_iterator it = slots_.find(detId);
+  if( it == slots_.end() ) return -1;
+
+  return static_cast<long>(it->second);
+}
+
+
+// last run starting at or before the IOV
+int ModuleParameterIndex::parIdxOfSlot(const size_t slot, const unsigned int iovIdx) const {
+  const std::vector<unsigned int>::const_iterator begin = runIOVs_.begin()+runStart_[slot];
+  const std::vector<unsigned int>::const_iterator end = runIOVs_.begin()+runStart_[slot+1];
+  const std::vector<unsigned int>::const_iterator it = std::upper_bound(begin,end,iovIdx);
+  if( it == begin ) return -1;
+
+  return runParIdxs_[it-runIOVs_.begin()-1];
+}
+
+
+float ModuleParameterIndex::lookup(const std::vector< std::vector<float> >& table, const unsigned int iovIdx, const int parIdx) const {
+  if( parIdx < 0 || parIdx >= static_cast<int>(table[iovIdx].size()) ) return std::numeric_limits<float>::quiet_NaN();
+
+  return table[iovIdx][parIdx];
+}
+
+
+int ModuleParameterIndex::parIdx(const unsigned int detId, const unsigned int iovIdx) const {
+  checkFinalized();
+  const long s = slot(detId);
+  if( s < 0 || iovIdx >= iovs_.size() ) return -1;
+
+  return parIdxOfSlot(s,iovIdx);
+}
+
+
+float ModuleParameterIndex::value(const unsigned int detId, const unsigned int iovIdx) const {
+  const int p = parIdx(detId,iovIdx);
+  return p < 0 ? std::numeric_limits<float>::quiet_NaN() : lookup(values_,iovIdx,p);
+}
+
+
+float ModuleParameterIndex::error(const unsigned int detId, const unsigned int iovIdx) const {
+  const int p = parIdx(detId,iovIdx);
+  return p < 0 ? std::numeric_limits<float>::quiet_NaN() : lookup(errors_,iovIdx,p);
+}
+
+
+void ModuleParameterIndex::history(const unsigned int detId, std::vector<int>& parIdxs, std::vector<float>& values) const {
+  checkFinalized();
+  const unsigned int nIOVs = iovs_.size();
+  parIdxs.assign(nIOVs,-1);
+  values.assign(nIOVs,std::numeric_limits<float>::quiet_NaN());
+  const long s = slot(detId);
+  if( s < 0 ) return;
+
+  // each run lasts until the next one starts
+  for(size_t r = runStart_[s]; r < runStart_[s+1]; ++r) {
+    const unsigned int last = r+1 < runStart_[s+1] ? runIOVs_[r+1] : nIOVs;
+    for(unsigned int iov = runIOVs_[r]; iov < last; ++iov) {
+      parIdxs[iov] = runParIdxs_[r];
+      values[iov] = lookup(values_,iov,runParIdxs_[r]);
+    }
+  }
+}
+
+
+void ModuleParameterIndex::expand(const unsigned int iovIdx, std::vector<int>& parIdxs, std::vector<float>& values) const {
+  checkFinalized();
+  if( iovIdx >= iovs_.size() ) {
+    std::cerr << "\n\nERROR in ModuleParameterIndex: no IOV " << iovIdx << "\n" << std::endl;
+    throw std::exception();
+  }
+  const size_t nSlots = detIds_.size();
+  parIdxs.resize(nSlots);
+  values.resize(nSlots);
+  for(size_t s = 0; s < nSlots; ++s) {
+    parIdxs[s] = parIdxOfSlot(s,iovIdx);
+    values[s] = lookup(values_,iovIdx,parIdxs[s]);
+  }
+}
+
+
+void ModuleParameterIndex::expand(std::vector<float>& values) const {
+  checkFinalized();
+  const unsigned int nIOVs = iovs_.size();
+  values.assign(detIds_.size()*nIOVs,std::numeric_limits<float>::quiet_NaN());
+  for(size_t s = 0; s < detIds_.size(); ++s) {
+    float* row = &values[s*nIOVs];
+    for(size_t r = runStart_[s]; r < runStart_[s+1]; ++r) {
+      const unsigned int last = r+1 < runStart_[s+1] ? runIOVs_[r+1] : nIOVs;
+      for(unsigned int iov = runIOVs_[r]; iov < last; ++iov) {
+	row[iov] = lookup(values_,iov,runParIdxs_[r]);
+      }
+    }
+  }
+}
+
+
+void ModuleParameterIndex::print() const {
+  std::cout << "ModuleParameterIndex: " << nModules() << " modules, " << nIOVs() << " IOVs, "
+	    << (finalized_ ? nRuns() : pending_.size()) << " runs" << std::endl;
+}
+
+#endif
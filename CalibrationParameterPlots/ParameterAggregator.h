@@ -0,0 +1,79 @@
+#ifndef PARAMETER_AGGREGATOR_H
+#define PARAMETER_AGGREGATOR_H
+
+#include <vector>
+
+#include "Detector.h"
+
+
+// Collects, for one IOV, the value and the granularity of each
+// calibration parameter from the module entries of the tree.
+//
+// The parameters are stored in a flat vector indexed by parIdx,
+// which is a small dense integer, and only the min/max ring and layer
+// of the modules sharing a parameter are kept. The vector is reused
+// for the next IOV after reset(), hence once it has reached its
+// final size, adding modules does not allocate any memory.
+class ParameterAggregator {
+public:
+  struct ParInfo {
+    ParInfo()
+      : filled(false), det(UNKNOWN), value(9999999.), delta(999999.), error(9999999.),
+	minRing(0), maxRing(0), minLayer(0), maxLayer(0) {}
+
+    bool filled;
+    Detector det;
+    double value;
+    double delta;
+    double error;
+    unsigned int minRing;
+    unsigned int maxRing;
+    unsigned int minLayer;
+    unsigned int maxLayer;
+  };
+
+  ParameterAggregator() {}
+
+  void reset();
+  void add(const int parIdx, const Detector det, const double value, const double delta, const double error,
+	   const unsigned int ring, const unsigned int layer);
+
+  // parameters are accessed by parIdx in [0,size()), only filled ones are valid
+  unsigned int size() const { return pars_.size(); }
+  const ParInfo& par(const unsigned int parIdx) const { return pars_[parIdx]; }
+
+
+private:
+  std::vector<ParInfo> pars_;
+};
+
+
+void ParameterAggregator::reset() {
+  for(std::vector<ParInfo>::iterator it = pars_.begin(); it != pars_.end(); ++it) {
+    it->filled = false;
+  }
+}
+
+
+// The value is taken from the first module of a parameter
+void ParameterAggregator::add(const int parIdx, const Detector det, const double value, const double delta, const double error,
+			      const unsigned int ring, const unsigned int layer) {
+  if( parIdx >= static_cast<int>(pars_.size()) ) pars_.resize(parIdx+1);
+  ParInfo& pi = pars_[parIdx];
+  if( !pi.filled ) {
+    pi.filled = true;
+    pi.det = det;
+    pi.value = value;
+    pi.delta = delta;
+    pi.error = error;
+    pi.minRing = pi.maxRing = ring;
+    pi.minLayer = pi.maxLayer = layer;
+  } else {
+    if( ring < pi.minRing ) pi.minRing = ring;
+    if( ring > pi.maxRing ) pi.maxRing = ring;
+    if( layer < pi.minLayer ) pi.minLayer = layer;
+    if( layer > pi.maxLayer ) pi.maxLayer = layer;
+  }
+}
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef PARAMETER_CORRELATION_H
+#define PARAMETER_CORRELATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "TFile.h"
+#include "TH2.h"
+#include "TH2D.h"
+#include "TString.h"
+
+#include "Detector.h"
+#include "IOV.h"
+#include "ParameterSet.h"
+
+
+// Correlations between the calibration parameter series over the IOVs,
+// e.g. of Lorentz-angle and backplane parameters, or of the LA in deco
+// and peak mode.
+//
+// Each (type,detector,granularity element) parameter is one series,
+// with one value per IOV of the merged list of IOVs of all sets. Since
+// the IOVs of different sets need not be the same, the merged IOVs are
+// the intervals between all IOV boundaries, and a value is assigned to
+// all merged IOVs within its IOV. The
+// series are centred and scaled to unit norm over the IOVs where they
+// have a value, and IOVs without value are set to 0, i.e. to the mean
+// of the series. The correlation matrix is then Z * Z^T, computed in
+// tiles of series x blocks of IOVs, so that the rows of both tiles stay
+// in the cache, with a 4x4 register block in the innermost loop. The
+// tiles of the upper triangle are distributed over threads.
+//
+// With missing values, the correlation of two series is thus computed
+// over all IOVs with the missing values replaced by the mean, which
+// shrinks it towards 0 if the series overlap only partially; the number
+// of common IOVs is given with each pair.
+class ParameterCorrelation {
+public:
+  struct Pair {
+    unsigned int series1;
+    unsigned int series2;
+    double correlation;
+    unsigned int nCommonIOVs;
+  };
+
+  ParameterCorrelation(const std::vector<ParameterSet>& pars, const unsigned int nThreads = 1);
+
+  unsigned int nSeries() const { return keys_.size(); }
+  unsigned int nIOVs() const { return iovs_.size(); }
+  const IOV& iov(const unsigned int i) const { return iovs_.at(i); }
+  TString seriesName(const unsigned int series) const;
+  CalibrationParameterType seriesType(const unsigned int series) const { return keys_.at(series).type; }
+
+  // NaN if one of the series has less than 2 values or no spread
+  double correlation(const unsigned int series1, const unsigned int series2) const {
+    return corr_.at(static_cast<size_t>(series1)*nPad_+series2);
+  }
+  unsigned int nCommonIOVs(const unsigned int series1, const unsigned int series2) const;
+
+  // the nPairs pairs with the largest |correlation| and at least
+  // minCommonIOVs common IOVs, optionally only of different types
+  std::vector<Pair> strongestPairs(const unsigned int nPairs, const unsigned int minCommonIOVs = 5, const bool differentTypesOnly = false) const;
+  void print(std::ostream& out, const std::vector<Pair>& pairs) const;
+
+  // matrix as TH2D 'correlations' with the series names as bin labels
+  void write(const TString& fileName) const;
+
+
+private:
+  static const unsigned int tileSize_ = 64;	// series per tile, multiple of 4
+  static const unsigned int iovBlockSize_ = 256;
+
+  struct SeriesKey {
+    CalibrationParameterType type;
+    Detector det;
+    unsigned int zMin;
+    unsigned int zMax;
+    unsigned int rMin;
+    unsigned int rMax;
+  };
+
+  std::vector<SeriesKey> keys_;
+  std::vector<IOV> iovs_;
+  size_t nPad_;				// nSeries rounded up to tileSize_
+  std::vector<double> z_;		// [series*nIOVs+iov], normalised
+  std::vector<uint64_t> masks_;		// [series*nWords_+word], IOVs with value
+  size_t nWords_;
+  std::vector<unsigned char> valid_;	// [series]
+  std::vector<double> corr_;		// [series1*nPad_+series2]
+
+  void fill(const std::vector<ParameterSet>& pars);
+  void normalise();
+  void multiply(const unsigned int nThreads);
+  void multiplyTile(const size_t iBegin, const size_t jBegin);
+};
+
+
+ParameterCorrelation::ParameterCorrelation(const std::vector<ParameterSet>& pars, const unsigned int nThreads)
+  : nPad_(0), nWords_(0) {
+  fill(pars);
+  normalise();
+  multiply(nThreads);
+}
+
+
+void ParameterCorrelation::fill(const std::vector<ParameterSet>& pars) {
+  // merged IOVs in time order: the intervals between all IOV starts
+  // and ends that are covered by at least one IOV
+  std::map<unsigned long,int> nStarted; // change of the number of IOVs covering a run
+  for(size_t s = 0; s < pars.size(); ++s) {
+    for(IOVIt it = pars[s].IOVsBegin(); it != pars[s].IOVsEnd(); ++it) {
+      ++nStarted[it->minRun()];
+      --nStarted[static_cast<unsigned long>(it->maxRun())+1];
+    }
+  }
+  iovs_.clear();
+  int nCovering = 0;
+  for(std::map<unsigned long,int>::const_iterator it = nStarted.begin(); it != nStarted.end(); ++it) {
+    nCovering += it->second;
+    std::map<unsigned long,int>::const_iterator next = it;
+    ++next;
+    if( nCovering > 0 && next != nStarted.end() ) {
+      iovs_.push_back(IOV(it->first,next->first-1));
+    }
+  }
+  const size_t nIOVs = iovs_.size();
+
+  for(size_t s = 0; s < pars.size(); ++s) {
+    for(ParameterSet::ParameterIt it = pars[s].parametersBegin(); it != pars[s].parametersEnd(); ++it) {
+      SeriesKey key;
+      key.type = pars[s].type();
+      key.det = pars[s].detector();
+      key.zMin = it->first.zMin();
+      key.zMax = it->first.zMax();
+      key.rMin = it->first.rMin();
+      key.rMax = it->first.rMax();
+      keys_.push_back(key);
+    }
+  }
+  nPad_ = (keys_.size()+tileSize_-1)/tileSize_*tileSize_;
+  nWords_ = (nIOVs+63)/64;
+  z_.assign(nPad_*nIOVs,std::numeric_limits<double>::quiet_NaN());
+  masks_.assign(nPad_*nWords_,0);
+
+  size_t series = 0;
+  for(size_t s = 0; s < pars.size(); ++s) {
+    for(ParameterSet::ParameterIt it = pars[s].parametersBegin(); it != pars[s].parametersEnd(); ++it, ++series) {
+      double* row = &z_[series*nIOVs];
+      uint64_t* mask = &masks_[series*nWords_];
+      // both lists are in time order
+      size_t iov = 0;
+      for(Parameter::ValueIt itVal = it->second.valuesBegin(); itVal != it->second.valuesEnd(); ++itVal) {
+	const IOV& valIOV = itVal->first;
+	while( iov < nIOVs && iovs_[iov].minRun() < valIOV.minRun() ) ++iov;
+	for(; iov < nIOVs && iovs_[iov].maxRun() <= valIOV.maxRun(); ++iov) {
+	  row[iov] = itVal->second.at(0);
+	  mask[iov/64] |= uint64_t(1) << (iov%64);
+	}
+      }
+    }
+  }
+}
+
+
+void ParameterCorrelation::normalise() {
+  const size_t nIOVs = iovs_.size();
+  valid_.assign(nPad_,0);
+  for(size_t s = 0; s < nPad_; ++s) {
+    double* row = &z_[s*nIOVs];
+    double sum = 0.;
+    unsigned int n = 0;
+    for(size_t i = 0; i < nIOVs; ++i) {
+      if( std::isnan(row[i]) ) continue;
+      sum += row[i];
+      ++n;
+    }
+    const double mean = n > 0 ? sum/n : 0.;
+    double sum2 = 0.;
+    for(size_t i = 0; i < nIOVs; ++i) {
+      row[i] = std::isnan(row[i]) ? 0. : row[i]-mean;
+      sum2 += row[i]*row[i];
+    }
+    if( n < 2 || !( sum2 > 0. ) ) {
+      std::fill(row,row+nIOVs,0.);
+      continue;
+    }
+    const double norm = 1./std::sqrt(sum2);
+    for(size_t i = 0; i < nIOVs; ++i) {
+      row[i] *= norm;
+    }
+    valid_[s] = 1;
+  }
+}
+
+
+void ParameterCorrelation::multiply(const unsigned int nThreads) {
+  corr_.assign(nPad_*nPad_,0.);
+
+  // tiles of the upper triangle
+  std::vector< std::pair<size_t,size_t> > tiles;
+  for(size_t i = 0; i < nPad_; i += tileSize_) {
+    for(size_t j = i; j < nPad_; j += tileSize_) {
+      tiles.push_back(std::make_pair(i,j));
+    }
+  }
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for(size_t t = next++; t < tiles.size(); t = next++) {
+      multiplyTile(tiles[t].first,tiles[t].second);
+    }
+  };
+  if( nThreads <= 1 ) {
+    work();
+  } else {
+    std::vector<std::thread> threads;
+    for(unsigned int i = 0; i < nThreads; ++i) {
+      threads.push_back(std::thread(work));
+    }
+    for(unsigned int i = 0; i < nThreads; ++i) {
+      threads[i].join();
+    }
+  }
+
+  // lower triangle, and series without correlation
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  for(size_t i = 0; i < nPad_; ++i) {
+    for(size_t j = i; j < nPad_; ++j) {
+      double& c = corr_[i*nPad_+j];
+      if( !valid_[i] || !valid_[j] ) c = nan;
+      corr_[j*nPad_+i] = c;
+    }
+  }
+}
+
+
+// C[i][j] += sum_k Z[i][k]*Z[j][k] for the tile of series [iBegin,iBegin+tileSize_)
+// x [jBegin,jBegin+tileSize_), one block of IOVs after the other
+void ParameterCorrelation::multiplyTile(const size_t iBegin, const size_t jBegin) {
+  const size_t nIOVs = iovs_.size();
+  for(size_t kBegin = 0; kBegin < nIOVs; kBegin += iovBlockSize_) {
+    const size_t kEnd = std::min(nIOVs,kBegin+iovBlockSize_);
+    for(size_t i = iBegin; i < iBegin+tileSize_; i += 4) {
+      const double* a0 = &z_[(i+0)*nIOVs];
+      const double* a1 = &z_[(i+1)*nIOVs];
+      const double* a2 = &z_[(i+2)*nIOVs];
+      const double* a3 = &z_[(i+3)*nIOVs];
+      for(size_t j = jBegin; j < jBegin+tileSize_; j += 4) {
+	if( j+3 < i ) continue;	// below the diagonal
+	const double* b0 = &z_[(j+0)*nIOVs];
+	const double* b1 = &z_[(j+1)*nIOVs];
+	const double* b2 = &z_[(j+2)*nIOVs];
+	const double* b3 = &z_[(j+3)*nIOVs];
+	double c00 = 0., c01 = 0., c02 = 0., c03 = 0.;
+	double c10 = 0., c11 = 0., c12 = 0., c13 = 0.;
+	double c20 = 0., c21 = 0., c22 = 0., c23 = 0.;
+	double c30 = 0., c31 = 0., c32 = 0., c33 = 0.;
+	for(size_t k = kBegin; k < kEnd; ++k) {
+	  const double x0 = a0[k], x1 = a1[k], x2 = a2[k], x3 = a3[k];
+	  const double y0 = b0[k], y1 = b1[k], y2 = b2[k], y3 = b3[k];
+	  c00 += x0*y0; c01 += x0*y1; c02 += x0*y2; c03 += x0*y3;
+	  c10 += x1*y0; c11 += x1*y1; c12 += x1*y2; c13 += x1*y3;
+	  c20 += x2*y0; c21 += x2*y1; c22 += x2*y2; c23 += x2*y3;
+	  c30 += x3*y0; c31 += x3*y1; c32 += x3*y2; c33 += x3*y3;
+	}
+	double* c0 = &corr_[(i+0)*nPad_+j];
+	double* c1 = &corr_[(i+1)*nPad_+j];
+	double* c2 = &corr_[(i+2)*nPad_+j];
+	double* c3 = &corr_[(i+3)*nPad_+j];
+	c0[0] += c00; c0[1] += c01; c0[2] += c02; c0[3] += c03;
+	c1[0] += c10; c1[1] += c11; c1[2] += c12; c1[3] += c13;
+	c2[0] += c20; c2[1] += c21; c2[2] += c22; c2[3] += c23;
+	c3[0] += c30; c3[1] += c31; c3[2] += c32; c3[3] += c33;
+      }
+    }
+  }
+}
+
+
+TString ParameterCorrelation::seriesName(const unsigned int series) const {
+  const SeriesKey& key = keys_.at(series);
+  TString name = toStr(key.type)+" "+toStr(key.det)+" z ";
+  name += key.zMin;
+  if( key.zMax != key.zMin ) {
+    name += "-";
+    name += key.zMax;
+  }
+  name += " r ";
+  name += key.rMin;
+  if( key.rMax != key.rMin ) {
+    name += "-";
+    name += key.rMax;
+  }
+
+  return name;
+}
+
+
+unsigned int ParameterCorrelation::nCommonIOVs(const unsigned int series1, const unsigned int series2) const {
+  const uint64_t* m1 = &masks_[static_cast<size_t>(series1)*nWords_];
+  const uint64_t* m2 = &masks_[static_cast<size_t>(series2)*nWords_];
+  unsigned int n = 0;
+  for(size_t w = 0; w < nWords_; ++w) {
+    n += __builtin_popcountll(m1[w] & m2[w]);
+  }
+
+  return n;
+}
+
+
+std::vector<ParameterCorrelation::Pair> ParameterCorrelation::strongestPairs(const unsigned int nPairs, const unsigned int minCommonIOVs, const bool differentTypesOnly) const {
+  // min-heap on |correlation| of the best pairs so far
+  auto stronger = [](const Pair& a, const Pair& b) { return std::abs(a.correlation) > std::abs(b.correlation); };
+  std::vector<Pair> pairs;
+  for(unsigned int i = 0; i < nSeries(); ++i) {
+    if( !valid_[i] ) continue;
+    for(unsigned int j = i+1; j < nSeries(); ++j) {
+      if( !valid_[j] ) continue;
+      if( differentTypesOnly && keys_[i].type == keys_[j].type ) continue;
+      const double c = correlation(i,j);
+      if( pairs.size() == nPairs && !( std::abs(c) > std::abs(pairs.front().correlation) ) ) continue;
+      const unsigned int nCommon = nCommonIOVs(i,j);
+      if( nCommon < minCommonIOVs ) continue;
+      Pair p = { i, j, c, nCommon };
+      pairs.push_back(p);
+      std::push_heap(pairs.begin(),pairs.end(),stronger);
+      if( pairs.size() > nPairs ) {
+	std::pop_heap(pairs.begin(),pairs.end(),stronger);
+	pairs.pop_back();
+      }
+    }
+  }
+  std::sort_heap(pairs.begin(),pairs.end(),stronger);
+
+  return pairs;
+}
+
+
+void ParameterCorrelation::print(std::ostream& out, const std::vector<Pair>& pairs) const {
+  out << nSeries() << " parameter series in " << nIOVs() << " IOVs, " << pairs.size() << " most strongly correlated pairs:" << std::endl;
+  char txt[300];
+  for(size_t i = 0; i < pairs.size(); ++i) {
+    snprintf(txt,300,"  %4lu  %-32s  %-32s  % 7.4f  (%u IOVs)",
+	     static_cast<unsigned long>(i+1),seriesName(pairs[i].series1).Data(),seriesName(pairs[i].series2).Data(),
+	     pairs[i].correlation,pairs[i].nCommonIOVs);
+    out << txt << std::endl;
+  }
+}
+
+
+void ParameterCorrelation::write(const TString& fileName) const {
+  TFile file(fileName,"RECREATE");
+  if( file.IsZombie() ) {
+    std::cerr << "\n\nERROR opening file '" << fileName << "'\n" << std::endl;
+    throw std::exception();
+  }
+  const int n = nSeries();
+  TH2* h = new TH2D("correlations","correlations of the calibration parameters",n,0,n,n,0,n);
+  h->SetDirectory(0);
+  for(int i = 0; i < n; ++i) {
+    h->GetXaxis()->SetBinLabel(i+1,seriesName(i));
+    h->GetYaxis()->SetBinLabel(i+1,seriesName(i));
+    for(int j = 0; j < n; ++j) {
+      const double c = correlation(i,j);
+      if( !std::isnan(c) ) h->SetBinContent(i+1,j+1,c);
+    }
+  }
+  file.WriteTObject(h);
+  file.Close();
+  delete h;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef PARAMETER_LOOKUP_H
+#define PARAMETER_LOOKUP_H
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "Detector.h"
+#include "IOV.h"
+#include "IOVIndex.h"
+#include "ParameterSet.h"
+
+
+// Fast per-run access to the calibration parameters, e.g.
+//   "what was the TIB layer-2 ring-3 LA value for run R?"
+// The values of each ParameterSet are copied into a flat
+// [zBin][rBin][iov] table, and the IOV of a run is found
+// with an IOVIndex in O(log nIOVs).
+//
+// Runs outside all IOVs and bins without a parameter in
+// that IOV give NaN.
+class ParameterLookup {
+public:
+  ParameterLookup() {}
+  ParameterLookup(const std::map<Detector,ParameterSet>& pars) { add(pars); }
+
+  void add(const ParameterSet& pars);
+  void add(const std::map<Detector,ParameterSet>& pars);
+
+  bool contains(const CalibrationParameterType type, const Detector det) const {
+    return tables_.find(Key(type,det)) != tables_.end();
+  }
+  const IOVIndex& iovIndex(const CalibrationParameterType type, const Detector det) const {
+    return table(type,det).iovs;
+  }
+
+  double value(const CalibrationParameterType type, const Detector det,
+	       const unsigned int zBin, const unsigned int rBin,
+	       const unsigned int run) const;
+
+  // values[i] is the parameter value for runs[i]
+  void lookup(const CalibrationParameterType type, const Detector det,
+	      const unsigned int zBin, const unsigned int rBin,
+	      const unsigned int* runs, const size_t n, double* values) const;
+
+
+private:
+  typedef std::pair<CalibrationParameterType,Detector> Key;
+
+  struct Table {
+    Table()
+      : nZBins(0), nRBins(0) {}
+
+    IOVIndex iovs;
+    unsigned int nZBins;
+    unsigned int nRBins;
+    std::vector<double> values;	// [zBin][rBin][iov]
+
+    const double* series(const unsigned int zBin, const unsigned int rBin) const {
+      if( zBin >= nZBins || rBin >= nRBins ) {
+	std::cerr << "\n\nERROR in ParameterLookup: trying to access bin outside range\n" << std::endl;
+	throw std::exception();
+      }
+      return &(values[(zBin*nRBins+rBin)*iovs.size()]);
+    }
+  };
+
+  std::map<Key,Table> tables_;
+
+  const Table& table(const CalibrationParameterType type, const Detector det) const;
+};
+
+
+void ParameterLookup::add(const ParameterSet& pars) {
+  Table& tab = tables_[Key(pars.type(),pars.detector())];
+  tab.iovs = IOVIndex(pars.IOVsBegin(),pars.IOVsEnd());
+  tab.nZBins = pars.nZBins();
+  tab.nRBins = pars.nRBins();
+  const unsigned int nIOVs = tab.iovs.size();
+  tab.values = std::vector<double>(tab.nZBins*tab.nRBins*nIOVs,std::numeric_limits<double>::quiet_NaN());
+  for(unsigned int z = 0; z < tab.nZBins; ++z) {
+    for(unsigned int r = 0; r < tab.nRBins; ++r) {
+      if( !pars.hasParameter(z,r) ) continue;
+      double* series = &(tab.values[(z*tab.nRBins+r)*nIOVs]);
+      for(unsigned int iov = 0; iov < nIOVs; ++iov) {
+	if( pars.hasValue(z,r,iov) ) series[iov] = pars.value(z,r,iov);
+      }
+    }
+  }
+}
+
+
+void ParameterLookup::add(const std::map<Detector,ParameterSet>& pars) {
+  for(std::map<Detector,ParameterSet>::const_iterator it = pars.begin();
+      it != pars.end(); ++it) {
+    add(it->second);
+  }
+}
+
+
+double ParameterLookup::value(const CalibrationParameterType type, const Detector det,
+			      const unsigned int zBin, const unsigned int rBin,
+			      const unsigned int run) const {
+  const Table& tab = table(type,det);
+  const int iov = tab.iovs.lookup(run);
+  if( iov < 0 ) return std::numeric_limits<double>::quiet_NaN();
+
+  return tab.series(zBin,rBin)[iov];
+}
+
+
+void ParameterLookup::lookup(const CalibrationParameterType type, const Detector det,
+			     const unsigned int zBin, const unsigned int rBin,
+			     const unsigned int* runs, const size_t n, double* values) const {
+  const Table& tab = table(type,det);
+  const double* series = tab.series(zBin,rBin);
+
+  // resolve the IOVs in blocks to keep the buffer small
+  const size_t blockSize = 1024;
+  int iovIdx[blockSize];
+  for(size_t first = 0; first < n; first += blockSize) {
+    const size_t nBlock = std::min(blockSize,n-first);
+    tab.iovs.lookup(runs+first,nBlock,iovIdx);
+    for(size_t i = 0; i < nBlock; ++i) {
+      values[first+i] = iovIdx[i] < 0 ? std::numeric_limits<double>::quiet_NaN() : series[iovIdx[i]];
+    }
+  }
+}
+
+
+const ParameterLookup::Table& ParameterLookup::table(const CalibrationParameterType type, const Detector det) const {
+  std::map<Key,Table>::const_iterator it = tables_.find(Key(type,det));
+  if( it == tables_.end() ) {
+    std::cerr << "\n\nERROR in ParameterLookup: no parameters for " << toStr(det) << " of type " << type << "\n" << std::endl;
+    throw std::exception();
+  }
+
+  return it->second;
+}
+
+#endif
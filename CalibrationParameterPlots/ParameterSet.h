@@ -14,6 +14,21 @@
 
 enum CalibrationParameterType { NONE=-1, PixelLA, StripLADeco, StripLAPeak, StripBPDeco };
 
+TString toStr(CalibrationParameterType type) {
+  if( type == PixelLA     ) return "PixelLA";
+  if( type == StripLADeco ) return "StripLADeco";
+  if( type == StripLAPeak ) return "StripLAPeak";
+  if( type == StripBPDeco ) return "StripBPDeco";
+  return "NONE";
+}
+
+// detectors with parameters of this type, see DetectorMask
+unsigned int detectorMask(CalibrationParameterType type) {
+  if( type == PixelLA ) return BPIXMask | FPIXMask;
+  if( type == NONE    ) return NoDetectorMask;
+  return TIBMask | TOBMask;
+}
+
 
 class GranularityBin {
 public:
@@ -94,7 +109,14 @@ public:
     valuesPerIOV_[theIOV] = pars;
   }
 
+  // [value,delta,error] per IOV, in IOV order
+  typedef std::map< IOV, std::vector<double> >::const_iterator ValueIt;
+
+  int origIndex() const { return origIndex_; }
   unsigned int nIOVs() const { return valuesPerIOV_.size(); }
+  ValueIt valuesBegin() const { return valuesPerIOV_.begin(); }
+  ValueIt valuesEnd() const { return valuesPerIOV_.end(); }
+  bool hasValue(const IOV& theIOV) const { return valuesPerIOV_.find(theIOV) != valuesPerIOV_.end(); }
   double value(const IOV& theIOV) const;
   double delta(const IOV& theIOV) const;
   double error(const IOV& theIOV) const;
@@ -141,6 +163,9 @@ double Parameter::error(const IOV& iov) const {
 
 class ParameterSet {
 public:
+  // parameters ordered by granularity element
+  typedef std::map<GranularityElement,Parameter>::const_iterator ParameterIt;
+
   ParameterSet()
     : type_(NONE), det_(UNKNOWN) {}
   ParameterSet(const CalibrationParameterType theType, const Detector theDetector)
@@ -160,11 +185,18 @@ public:
   unsigned int nIOVs() const { return iovs_.size(); }
   IOVIt IOVsBegin() const { return iovs_.begin(); }
   IOVIt IOVsEnd() const { return iovs_.end(); }
+  bool hasParameter(const unsigned int zBin, const unsigned int rBin) const;
+  bool hasValue(const unsigned int zBin, const unsigned int rBin, const unsigned int iov) const;
   double value(const unsigned int zBin, const unsigned int rBin, const unsigned int iov) const;
   double delta(const unsigned int zBin, const unsigned int rBin, const unsigned int iov) const;
   double error(const unsigned int zBin, const unsigned int rBin, const unsigned int iov) const;
   double zBinMin(const unsigned int zBin) const { return getBin(zBin,zBins_).firstUnit(); }
   double zBinMax(const unsigned int zBin) const { return getBin(zBin,zBins_).lastUnit(); }
+  double rBinMin(const unsigned int rBin) const { return getBin(rBin,rBins_).firstUnit(); }
+  double rBinMax(const unsigned int rBin) const { return getBin(rBin,rBins_).lastUnit(); }
+  int origIndex(const unsigned int zBin, const unsigned int rBin) const;
+  ParameterIt parametersBegin() const { return pars_.begin(); }
+  ParameterIt parametersEnd() const { return pars_.end(); }
   void print() const;
 
 
@@ -229,6 +261,27 @@ double ParameterSet::error(const unsigned int zBin, const unsigned int rBin, con
 }
 
 
+int ParameterSet::origIndex(const unsigned int zBin, const unsigned int rBin) const {
+  ParMapConstIt it = pars_.find(getGranularityElement(zBin,rBin));
+
+  return it == pars_.end() ? -1 : it->second.origIndex();
+}
+
+
+bool ParameterSet::hasParameter(const unsigned int zBin, const unsigned int rBin) const {
+  if( zBin >= nZBins() || rBin >= nRBins() ) return false;
+
+  return pars_.find(getGranularityElement(zBin,rBin)) != pars_.end();
+}
+
+
+bool ParameterSet::hasValue(const unsigned int zBin, const unsigned int rBin, const unsigned int iov) const {
+  if( !hasParameter(zBin,rBin) || iov >= nIOVs() ) return false;
+
+  return pars_.find(getGranularityElement(zBin,rBin))->second.hasValue(getIOV(iov,iovs_));
+}
+
+
 GranularityElement ParameterSet::getGranularityElement(const unsigned int zBin, const unsigned int rBin) const {
   GranularityBin granularityZBin = getBin(zBin,zBins_);
   GranularityBin granularityRBin = getBin(rBin,rBins_);
@@ -0,0 +1,461 @@
+#ifndef PARAMETER_STORE_H
+#define PARAMETER_STORE_H
+
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TString.h"
+
+#include "Detector.h"
+#include "IOV.h"
+#include "ParameterSet.h"
+
+
+// Compact on-disk store of ParameterSets of all types and detectors.
+//
+// The file is memory-mapped when opened, and the ParameterSets are
+// decoded on access, so opening a store costs only the mmap call.
+// Layout (native byte order, all integers 32 bit):
+//
+//   file header : magic "CPSTORE1", version, nSets
+//   set headers : type, det, nZBins, nRBins, nIOVs, offset, size   [nSets]
+//   per set     : zBins [nZBins][first,last]
+//                 rBins [nRBins][first,last]
+//                 IOVs  [nIOVs][minRun,maxRun]
+//                 origIdx    [nZBins*nRBins]
+//                 parOffset  [nZBins*nRBins]   (into blob, NOPAR if no parameter)
+//                 blob       per parameter: presence bitmap [(nIOVs+7)/8 bytes]
+//                            and value, delta and error series
+//
+// Each series is stored as float, i.e. with the precision of the treeFile,
+// and XOR-encoded across IOVs: every value is XOR'ed with the previous one
+// and only the non-zero bytes are written after a header byte
+// (high nibble: number of trailing zero bytes, low nibble: number of
+// remaining bytes). Unchanged values therefore cost one byte. IOVs in
+// which a parameter has no value have their bit in the presence bitmap
+// cleared and repeat the previous value, so that NaN results are kept.
+//
+// All offsets and sizes read from the file are checked against the
+// file size; a truncated or corrupt store throws.
+class ParameterStore {
+public:
+  ParameterStore(const TString& fileName);
+  ~ParameterStore();
+
+  static void write(const TString& fileName, const std::vector<ParameterSet>& sets);
+
+  unsigned int nSets() const { return setHeaders_.size(); }
+  bool contains(const CalibrationParameterType type, const Detector det) const { return findSet(type,det) > -1; }
+
+  // The complete ParameterSet
+  ParameterSet parameterSet(const CalibrationParameterType type, const Detector det) const;
+
+  // All ParameterSets of this type, as returned by CalibrationParameterReader::read()
+  std::map<Detector,ParameterSet> read(const CalibrationParameterType type) const;
+
+  // Random access to one parameter in IOVs [firstIOV,lastIOV]. The arrays
+  // must hold lastIOV-firstIOV+1 entries; missing values are NaN. If given,
+  // present tells the missing values from NaN results.
+  void series(const CalibrationParameterType type, const Detector det,
+	      const unsigned int zBin, const unsigned int rBin,
+	      const unsigned int firstIOV, const unsigned int lastIOV,
+	      double* values, double* deltas, double* errors, bool* present = 0) const;
+
+
+private:
+  struct SetHeader {
+    int type;
+    int det;
+    unsigned int nZBins;
+    unsigned int nRBins;
+    unsigned int nIOVs;
+    unsigned int offset;
+    unsigned int size;
+  };
+
+  enum { VERSION = 2 };
+  enum { NOPAR = 0xFFFFFFFF };	// parOffset of bins without parameter
+
+  // not copyable: owns the mapping
+  ParameterStore(const ParameterStore&);
+  ParameterStore& operator=(const ParameterStore&);
+
+  TString fileName_;
+  const char* data_;
+  size_t size_;
+  std::vector<SetHeader> setHeaders_;
+
+  int findSet(const CalibrationParameterType type, const Detector det) const;
+  const SetHeader& setHeader(const CalibrationParameterType type, const Detector det) const;
+  unsigned int readUInt(const size_t pos) const;
+  const char* parameterData(const SetHeader& sh, const unsigned int zBin, const unsigned int rBin) const;
+  const char* setEnd(const SetHeader& sh) const { return data_+sh.offset+sh.size; }
+  void checkSetHeader(const SetHeader& sh) const;
+  void corrupt(const TString& what) const;
+
+  static void appendUInt(std::vector<char>& buf, const unsigned int val);
+  static void encodeSeries(std::vector<char>& buf, const std::vector<float>& vals);
+  const char* decodeSeries(const char* pos, const char* end, const unsigned int nVals, const unsigned int first, const unsigned int last, double* vals) const;
+};
+
+
+ParameterStore::ParameterStore(const TString& fileName)
+  : fileName_(fileName), data_(0), size_(0) {
+  const int fd = open(fileName.Data(),O_RDONLY);
+  if( fd < 0 ) {
+    std::cerr << "\n\nERROR opening file '" << fileName << "'\n" << std::endl;
+    throw std::exception();
+  }
+  struct stat st;
+  if( fstat(fd,&st) != 0 || st.st_size < 16 ) {
+    close(fd);
+    std::cerr << "\n\nERROR file '" << fileName << "' is not a ParameterStore\n" << std::endl;
+    throw std::exception();
+  }
+  size_ = st.st_size;
+  void* addr = mmap(0,size_,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if( addr == MAP_FAILED ) {
+    std::cerr << "\n\nERROR mapping file '" << fileName << "'\n" << std::endl;
+    throw std::exception();
+  }
+  data_ = static_cast<const char*>(addr);
+
+  if( std::memcmp(data_,"CPSTORE1",8) != 0 || readUInt(8) != VERSION ) {
+    munmap(const_cast<char*>(data_),size_);
+    std::cerr << "\n\nERROR file '" << fileName << "' is not a ParameterStore of version " << VERSION << "\n" << std::endl;
+    throw std::exception();
+  }
+  const unsigned int nSets = readUInt(12);
+  for(unsigned int i = 0; i < nSets; ++i) {
+    const size_t pos = 16+i*sizeof(SetHeader);
+    SetHeader sh;
+    if( pos+sizeof(SetHeader) > size_ ) {
+      munmap(const_cast<char*>(data_),size_);
+      std::cerr << "\n\nERROR file '" << fileName << "' is truncated\n" << std::endl;
+      throw std::exception();
+    }
+    std::memcpy(&sh,data_+pos,sizeof(SetHeader));
+    setHeaders_.push_back(sh);
+  }
+  try {
+    for(unsigned int i = 0; i < nSets; ++i) {
+      checkSetHeader(setHeaders_[i]);
+    }
+  } catch(...) {
+    munmap(const_cast<char*>(data_),size_);
+    data_ = 0;
+    throw;
+  }
+}
+
+
+// The fixed-size part of the set, up to the blob, has to be inside the
+// set, and the set inside the file
+void ParameterStore::checkSetHeader(const SetHeader& sh) const {
+  const unsigned long long nPars = static_cast<unsigned long long>(sh.nZBins)*sh.nRBins;
+  const unsigned long long fixedSize = 8ULL*(sh.nZBins+static_cast<unsigned long long>(sh.nRBins)+sh.nIOVs) + 8ULL*nPars;
+  if( static_cast<unsigned long long>(sh.offset)+sh.size > size_ || fixedSize > sh.size ) {
+    corrupt(TString::Format("set of type %d and detector %d exceeds %s",sh.type,sh.det,
+			    fixedSize > sh.size ? "its size" : "the file"));
+  }
+}
+
+
+void ParameterStore::corrupt(const TString& what) const {
+  std::cerr << "\n\nERROR file '" << fileName_ << "' is truncated or corrupt: " << what << "\n" << std::endl;
+  throw std::exception();
+}
+
+
+ParameterStore::~ParameterStore() {
+  if( data_ ) munmap(const_cast<char*>(data_),size_);
+}
+
+
+void ParameterStore::write(const TString& fileName, const std::vector<ParameterSet>& sets) {
+  std::vector<SetHeader> headers;
+  std::vector<char> body;
+  const size_t bodyOffset = 16+sets.size()*sizeof(SetHeader);
+
+  for(std::vector<ParameterSet>::const_iterator it = sets.begin();
+      it != sets.end(); ++it) {
+    const ParameterSet& ps = *it;
+    SetHeader sh;
+    sh.type = ps.type();
+    sh.det = ps.detector();
+    sh.nZBins = ps.nZBins();
+    sh.nRBins = ps.nRBins();
+    sh.nIOVs = ps.nIOVs();
+    sh.offset = bodyOffset+body.size();
+
+    for(unsigned int z = 0; z < sh.nZBins; ++z) {
+      appendUInt(body,static_cast<int>(ps.zBinMin(z)));
+      appendUInt(body,static_cast<int>(ps.zBinMax(z)));
+    }
+    for(unsigned int r = 0; r < sh.nRBins; ++r) {
+      appendUInt(body,static_cast<int>(ps.rBinMin(r)));
+      appendUInt(body,static_cast<int>(ps.rBinMax(r)));
+    }
+    for(IOVIt iovIt = ps.IOVsBegin(); iovIt != ps.IOVsEnd(); ++iovIt) {
+      appendUInt(body,iovIt->minRun());
+      appendUInt(body,iovIt->maxRun());
+    }
+
+    // encode parameters into a separate blob, collecting the offsets
+    const unsigned int nPars = sh.nZBins*sh.nRBins;
+    std::vector<unsigned int> parOffsets(nPars,static_cast<unsigned int>(NOPAR));
+    std::vector<char> blob;
+    std::vector<float> values(sh.nIOVs);
+    std::vector<float> deltas(sh.nIOVs);
+    std::vector<float> errors(sh.nIOVs);
+    for(unsigned int z = 0; z < sh.nZBins; ++z) {
+      for(unsigned int r = 0; r < sh.nRBins; ++r) {
+	appendUInt(body,ps.origIndex(z,r));
+	if( !ps.hasParameter(z,r) ) continue;
+	parOffsets.at(z*sh.nRBins+r) = blob.size();
+	std::vector<char> present((sh.nIOVs+7)/8,0);
+	for(unsigned int iov = 0; iov < sh.nIOVs; ++iov) {
+	  if( ps.hasValue(z,r,iov) ) {
+	    present.at(iov/8) |= static_cast<char>(1 << (iov%8));
+	    values.at(iov) = ps.value(z,r,iov);
+	    deltas.at(iov) = ps.delta(z,r,iov);
+	    errors.at(iov) = ps.error(z,r,iov);
+	  } else {		// costs one byte per series
+	    values.at(iov) = iov > 0 ? values.at(iov-1) : 0.f;
+	    deltas.at(iov) = iov > 0 ? deltas.at(iov-1) : 0.f;
+	    errors.at(iov) = iov > 0 ? errors.at(iov-1) : 0.f;
+	  }
+	}
+	blob.insert(blob.end(),present.begin(),present.end());
+	encodeSeries(blob,values);
+	encodeSeries(blob,deltas);
+	encodeSeries(blob,errors);
+      }
+    }
+    for(unsigned int i = 0; i < nPars; ++i) {
+      appendUInt(body,parOffsets.at(i));
+    }
+    body.insert(body.end(),blob.begin(),blob.end());
+    while( body.size()%4 != 0 ) body.push_back(0); // keep next set aligned
+
+    sh.size = bodyOffset+body.size()-sh.offset;
+    headers.push_back(sh);
+  }
+
+  std::ofstream file(fileName.Data(),std::ios::binary);
+  if( !file.is_open() ) {
+    std::cerr << "\n\nERROR opening file '" << fileName << "'\n" << std::endl;
+    throw std::exception();
+  }
+  const unsigned int version = VERSION;
+  const unsigned int nSets = headers.size();
+  file.write("CPSTORE1",8);
+  file.write(reinterpret_cast<const char*>(&version),4);
+  file.write(reinterpret_cast<const char*>(&nSets),4);
+  for(unsigned int i = 0; i < nSets; ++i) {
+    file.write(reinterpret_cast<const char*>(&headers.at(i)),sizeof(SetHeader));
+  }
+  if( body.size() > 0 ) file.write(&(body.front()),body.size());
+  file.close();
+}
+
+
+ParameterSet ParameterStore::parameterSet(const CalibrationParameterType type, const Detector det) const {
+  const SetHeader& sh = setHeader(type,det);
+  ParameterSet ps(type,det);
+
+  size_t pos = sh.offset;
+  std::vector<int> zBins(2*sh.nZBins);
+  std::vector<int> rBins(2*sh.nRBins);
+  std::vector<IOV> iovs;
+  for(unsigned int i = 0; i < zBins.size(); ++i, pos += 4) zBins[i] = static_cast<int>(readUInt(pos));
+  for(unsigned int i = 0; i < rBins.size(); ++i, pos += 4) rBins[i] = static_cast<int>(readUInt(pos));
+  for(unsigned int i = 0; i < sh.nIOVs; ++i, pos += 8) iovs.push_back(IOV(readUInt(pos),readUInt(pos+4)));
+  const size_t origIdxPos = pos;
+
+  std::vector<double> values(sh.nIOVs);
+  std::vector<double> deltas(sh.nIOVs);
+  std::vector<double> errors(sh.nIOVs);
+  for(unsigned int z = 0; z < sh.nZBins; ++z) {
+    for(unsigned int r = 0; r < sh.nRBins; ++r) {
+      const char* parData = parameterData(sh,z,r);
+      if( parData == 0 || sh.nIOVs == 0 ) continue;
+      const int origIdx = static_cast<int>(readUInt(origIdxPos+4*(z*sh.nRBins+r)));
+      const unsigned char* present = reinterpret_cast<const unsigned char*>(parData);
+      parData += (sh.nIOVs+7)/8;
+      parData = decodeSeries(parData,setEnd(sh),sh.nIOVs,0,sh.nIOVs-1,&(values.front()));
+      parData = decodeSeries(parData,setEnd(sh),sh.nIOVs,0,sh.nIOVs-1,&(deltas.front()));
+      decodeSeries(parData,setEnd(sh),sh.nIOVs,0,sh.nIOVs-1,&(errors.front()));
+      for(unsigned int iov = 0; iov < sh.nIOVs; ++iov) {
+	if( !( present[iov/8] & (1 << (iov%8)) ) ) continue;
+	ps.add(zBins[2*z],zBins[2*z+1],rBins[2*r],rBins[2*r+1],iovs[iov],
+	       values[iov],deltas[iov],errors[iov],origIdx);
+      }
+    }
+  }
+
+  return ps;
+}
+
+
+std::map<Detector,ParameterSet> ParameterStore::read(const CalibrationParameterType type) const {
+  std::map<Detector,ParameterSet> result;
+  for(std::vector<SetHeader>::const_iterator it = setHeaders_.begin();
+      it != setHeaders_.end(); ++it) {
+    if( it->type != type ) continue;
+    const Detector det = static_cast<Detector>(it->det);
+    result[det] = parameterSet(type,det);
+  }
+
+  return result;
+}
+
+
+void ParameterStore::series(const CalibrationParameterType type, const Detector det,
+			    const unsigned int zBin, const unsigned int rBin,
+			    const unsigned int firstIOV, const unsigned int lastIOV,
+			    double* values, double* deltas, double* errors, bool* present) const {
+  const SetHeader& sh = setHeader(type,det);
+  if( zBin >= sh.nZBins || rBin >= sh.nRBins || firstIOV > lastIOV || lastIOV >= sh.nIOVs ) {
+    std::cerr << "\n\nERROR in ParameterStore: trying to access bin or IOV outside range\n" << std::endl;
+    throw std::exception();
+  }
+  const char* parData = parameterData(sh,zBin,rBin);
+  const double missing = std::numeric_limits<double>::quiet_NaN();
+  if( parData == 0 ) {
+    for(unsigned int i = 0; i <= lastIOV-firstIOV; ++i) {
+      values[i] = deltas[i] = errors[i] = missing;
+      if( present != 0 ) present[i] = false;
+    }
+    return;
+  }
+  const unsigned char* bitmap = reinterpret_cast<const unsigned char*>(parData);
+  parData += (sh.nIOVs+7)/8;
+  parData = decodeSeries(parData,setEnd(sh),sh.nIOVs,firstIOV,lastIOV,values);
+  parData = decodeSeries(parData,setEnd(sh),sh.nIOVs,firstIOV,lastIOV,deltas);
+  decodeSeries(parData,setEnd(sh),sh.nIOVs,firstIOV,lastIOV,errors);
+  for(unsigned int iov = firstIOV; iov <= lastIOV; ++iov) {
+    const bool has = bitmap[iov/8] & (1 << (iov%8));
+    if( present != 0 ) present[iov-firstIOV] = has;
+    if( !has ) values[iov-firstIOV] = deltas[iov-firstIOV] = errors[iov-firstIOV] = missing;
+  }
+}
+
+
+int ParameterStore::findSet(const CalibrationParameterType type, const Detector det) const {
+  for(unsigned int i = 0; i < setHeaders_.size(); ++i) {
+    if( setHeaders_[i].type == type && setHeaders_[i].det == det ) return i;
+  }
+
+  return -1;
+}
+
+
+const ParameterStore::SetHeader& ParameterStore::setHeader(const CalibrationParameterType type, const Detector det) const {
+  const int idx = findSet(type,det);
+  if( idx < 0 ) {
+    std::cerr << "\n\nERROR no " << toStr(det) << " parameters of type " << type << " in '" << fileName_ << "'\n" << std::endl;
+    throw std::exception();
+  }
+
+  return setHeaders_[idx];
+}
+
+
+unsigned int ParameterStore::readUInt(const size_t pos) const {
+  if( pos+4 > size_ ) {
+    std::cerr << "\n\nERROR file '" << fileName_ << "' is truncated\n" << std::endl;
+    throw std::exception();
+  }
+  unsigned int val = 0;
+  std::memcpy(&val,data_+pos,4);
+
+  return val;
+}
+
+
+// start of the presence bitmap of this parameter, 0 if there is no
+// parameter; the bitmap is inside the set (see checkSetHeader())
+const char* ParameterStore::parameterData(const SetHeader& sh, const unsigned int zBin, const unsigned int rBin) const {
+  const size_t nPars = static_cast<size_t>(sh.nZBins)*sh.nRBins;
+  const size_t origIdxPos = sh.offset + 8*(static_cast<size_t>(sh.nZBins)+sh.nRBins+sh.nIOVs);
+  const size_t parOffsetPos = origIdxPos + 4*nPars;
+  const size_t blobPos = parOffsetPos + 4*nPars;
+  const unsigned int parOffset = readUInt(parOffsetPos+4*(static_cast<size_t>(zBin)*sh.nRBins+rBin));
+  if( parOffset == NOPAR ) return 0;
+  if( blobPos+parOffset+(sh.nIOVs+7)/8 > static_cast<size_t>(sh.offset)+sh.size ) {
+    corrupt(TString::Format("parameter offset %u outside its set",parOffset));
+  }
+
+  return data_+blobPos+parOffset;
+}
+
+
+void ParameterStore::appendUInt(std::vector<char>& buf, const unsigned int val) {
+  const char* bytes = reinterpret_cast<const char*>(&val);
+  buf.insert(buf.end(),bytes,bytes+4);
+}
+
+
+void ParameterStore::encodeSeries(std::vector<char>& buf, const std::vector<float>& vals) {
+  unsigned int prev = 0;
+  for(size_t i = 0; i < vals.size(); ++i) {
+    unsigned int bits = 0;
+    std::memcpy(&bits,&(vals[i]),4);
+    unsigned int x = bits^prev;
+    prev = bits;
+    unsigned int nTrailing = 0;
+    unsigned int nBytes = 0;
+    if( x != 0 ) {
+      while( (x & 0xFF) == 0 ) {
+	x >>= 8;
+	++nTrailing;
+      }
+      for(unsigned int y = x; y != 0; y >>= 8) ++nBytes;
+    }
+    buf.push_back(static_cast<char>((nTrailing << 4) | nBytes));
+    for(unsigned int b = 0; b < nBytes; ++b) {
+      buf.push_back(static_cast<char>((x >> (8*b)) & 0xFF));
+    }
+  }
+}
+
+
+// Decodes the series from pos and writes entries [first,last] to vals.
+// Returns the position after the series, which has to end before end.
+const char* ParameterStore::decodeSeries(const char* pos, const char* end, const unsigned int nVals, const unsigned int first, const unsigned int last, double* vals) const {
+  unsigned int prev = 0;
+  for(unsigned int i = 0; i < nVals; ++i) {
+    if( pos >= end ) corrupt("series exceeds its set");
+    const unsigned char head = static_cast<unsigned char>(*pos++);
+    const unsigned int nTrailing = head >> 4;
+    const unsigned int nBytes = head & 0x0F;
+    if( nTrailing > 3 || nTrailing+nBytes > 4 || pos+nBytes > end ) corrupt("invalid series encoding");
+    unsigned int x = 0;
+    for(unsigned int b = 0; b < nBytes; ++b) {
+      x |= static_cast<unsigned int>(static_cast<unsigned char>(*pos++)) << (8*b);
+    }
+    prev ^= (x << (8*nTrailing));
+    if( i >= first && i <= last ) {
+      float val = 0.;
+      std::memcpy(&val,&prev,4);
+      vals[i-first] = val;
+    }
+  }
+
+  return pos;
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef TREE_FILE_SET_H
+#define TREE_FILE_SET_H
+
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include <glob.h>
+
+#include "TFile.h"
+#include "TString.h"
+
+
+// The treeFiles of one campaign, e.g. of an alignment job that was
+// split into several run periods. Given as one string of file names
+// and glob patterns separated by commas or blanks, e.g.
+//   "treeFile_part*.root"
+//   "jobA/treeFile_merge.root,jobB/treeFile_merge.root"
+// The matches of a pattern are sorted by name; the order of the files
+// is the order of the list.
+//
+// Each file is opened on first access and then kept open until the
+// set is closed or destroyed.
+class TreeFileSet {
+public:
+  TreeFileSet(const TString& fileNames);
+  TreeFileSet(const std::vector<TString>& fileNames)
+    : fileNames_(fileNames), files_(fileNames.size(),0) {}
+  ~TreeFileSet() { close(); }
+
+  size_t nFiles() const { return fileNames_.size(); }
+  const TString& fileName(const size_t fileIdx) const { return fileNames_.at(fileIdx); }
+  const std::vector<TString>& fileNames() const { return fileNames_; }
+
+  TFile& file(const size_t fileIdx);
+  void close();
+
+
+private:
+  std::vector<TString> fileNames_;
+  std::vector<TFile*> files_;
+
+  // not copyable: owns the open files
+  TreeFileSet(const TreeFileSet&);
+  TreeFileSet& operator=(const TreeFileSet&);
+};
+
+
+TreeFileSet::TreeFileSet(const TString& fileNames) {
+  TString list(fileNames);
+  list.ReplaceAll(","," ");
+  list.ReplaceAll("\t"," ");
+  int pos = 0;
+  TString token("");
+  while( list.Tokenize(token,pos," ") ) {
+    if( token.First('*') < 0 && token.First('?') < 0 && token.First('[') < 0 ) {
+      fileNames_.push_back(token);
+      continue;
+    }
+    glob_t matches;
+    const int status = glob(token.Data(),0,NULL,&matches);
+    if( status != 0 ) {
+      globfree(&matches);
+      std::cerr << "\n\nERROR no file matching '" << token << "'\n" << std::endl;
+      throw std::exception();
+    }
+    for(size_t i = 0; i < matches.gl_pathc; ++i) {
+      fileNames_.push_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+  }
+  if( fileNames_.empty() ) {
+    std::cerr << "\n\nERROR no file in '" << fileNames << "'\n" << std::endl;
+    throw std::exception();
+  }
+  files_.assign(fileNames_.size(),0);
+}
+
+
+TFile& TreeFileSet::file(const size_t fileIdx) {
+  TFile*& file = files_.at(fileIdx);
+  if( file == 0 ) {
+    file = new TFile(fileNames_[fileIdx],"READ");
+    if( !file->IsOpen() ) {
+      std::cerr << "\n\nERROR opening file '" << fileNames_[fileIdx] << "'\n" << std::endl;
+      throw std::exception();
+    }
+  }
+
+  return *file;
+}
+
+
+void TreeFileSet::close() {
+  for(size_t i = 0; i < files_.size(); ++i) {
+    if( files_[i] == 0 ) continue;
+    files_[i]->Close();
+    delete files_[i];
+    files_[i] = 0;
+  }
+}
+
+#endif
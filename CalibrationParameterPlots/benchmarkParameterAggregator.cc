@@ -0,0 +1,132 @@
+// Allocation-count benchmark of CalibrationParameterReader::read()
+//
+// Writes treeFiles of generated StripLADeco results of a TOB-like
+// detector and counts the heap allocations while reading them with
+// the reader. ROOT's own allocations per tree (reading the keys and
+// the baskets, the TTree object) do not depend on the number of
+// module entries, since each branch of a tree is stored in a single
+// basket. The reader's hot loop over the module entries -- filling
+// the columns and adding them to the ParameterAggregator -- must not
+// allocate in steady state, hence:
+//   - the allocations per IOV, measured as the difference between
+//     reading nIOVs and 11*nIOVs IOVs, must not depend on the number
+//     of modules per IOV.
+//
+// Standalone program, since it replaces the global operator new:
+//   g++ -O2 benchmarkParameterAggregator.cc $(root-config --cflags --libs) -o benchmarkParameterAggregator
+//   ./benchmarkParameterAggregator
+
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <new>
+
+#include "TFile.h"
+#include "TString.h"
+#include "TTree.h"
+
+#include "CalibrationParameterReader.h"
+#include "Detector.h"
+
+
+static unsigned long nAllocations = 0;
+
+void* operator new(size_t size) {
+  ++nAllocations;
+  void* p = std::malloc(size);
+  if( p == 0 ) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+
+// TOB DetId in the Phase0 (and Phase1) layout, the rod is encoded
+// in the bits not used by the Tracker
+unsigned int tobDetId(const unsigned int layer, const unsigned int side, const unsigned int rod, const unsigned int module) {
+  return (1u<<28) | (5u<<25) | (layer<<14) | (side<<12) | (rod<<5) | (module<<2);
+}
+
+
+// nIOVs trees of nModules entries each, and the tree marking the end
+// of the last IOV; one parameter per layer and ring
+void writeTreeFile(const TString& fileName, const int nIOVs, const unsigned int nModules) {
+  TFile file(fileName,"RECREATE");
+  unsigned int id = 0;
+  float value = 0.;
+  struct treeStruct {
+    float delta;
+    float error;
+    int parIdx;
+  } results;
+  for(int iov = 0; iov <= nIOVs; ++iov) {
+    const TString name = "SiStripLorentzAngleCalibration_deconvolution_result_"+TString::Format("%d",1000+10*iov);
+    TTree* tree = new TTree(name,name);
+    tree->Branch("detId",&id,"detId/i");
+    tree->Branch("value",&value,"value/F");
+    tree->Branch("treeStruct",&results,"delta/F:error/F:parIdx/I");
+    tree->SetBasketSize("*",64*nModules);
+    for(unsigned int m = 0; m < nModules; ++m) {
+      const unsigned int layer = m%6;
+      const unsigned int side = (m/6)%2;
+      const unsigned int module = (m/12)%6;
+      const unsigned int rod = (m/72)%74;
+      id = tobDetId(layer+1,side+1,rod+1,module+1);
+      const unsigned int ring = side == 0 ? 5-module : 6+module;
+      results.parIdx = 12*layer + ring;
+      results.delta = 0.0001;
+      results.error = 0.00005;
+      value = 0.01*results.parIdx+0.001*iov;
+      tree->Fill();
+    }
+    tree->Write();
+    delete tree;
+  }
+  file.Close();
+}
+
+
+// allocations when reading all IOVs of the file
+unsigned long countAllocations(const CalibrationParameterReader& reader, const TString& fileName, double& time) {
+  const unsigned long nAllocBefore = nAllocations;
+  const std::clock_t start = std::clock();
+  const std::map<Detector,ParameterSet> result = reader.read(StripLADeco,fileName);
+  time = static_cast<double>(std::clock()-start)/CLOCKS_PER_SEC;
+
+  return nAllocations - nAllocBefore;
+}
+
+
+int main() {
+  const int nIOVs = 20;
+  const unsigned int nModules[2] = { 5208, 4*5208 };
+
+  const Tracker tracker(Phase0Topology);
+  const CalibrationParameterReader reader(&tracker);
+
+  unsigned long nAllocPerIOV[2] = { 0, 0 };
+  for(int i = 0; i < 2; ++i) {
+    const TString fileShort = TString::Format("benchmarkParameterAggregator_%d_short.root",i);
+    const TString fileLong  = TString::Format("benchmarkParameterAggregator_%d_long.root",i);
+    writeTreeFile(fileShort,nIOVs,nModules[i]);
+    writeTreeFile(fileLong,11*nIOVs,nModules[i]);
+
+    double timeShort = 0.;
+    double timeLong = 0.;
+    const unsigned long nAllocShort = countAllocations(reader,fileShort,timeShort);
+    const unsigned long nAllocLong = countAllocations(reader,fileLong,timeLong);
+    nAllocPerIOV[i] = (nAllocLong-nAllocShort)/(10*nIOVs);
+
+    std::cout << nModules[i] << " modules per IOV" << std::endl;
+    std::cout << "  Allocations reading " << nIOVs << " IOVs      : " << nAllocShort << std::endl;
+    std::cout << "  Allocations reading " << 11*nIOVs << " IOVs     : " << nAllocLong << std::endl;
+    std::cout << "  Allocations per further IOV    : " << nAllocPerIOV[i] << std::endl;
+    std::cout << "  Time per further IOV           : " << 1E6*(timeLong-timeShort)/(10*nIOVs) << " mus" << std::endl;
+  }
+
+  const bool ok = nAllocPerIOV[1] <= nAllocPerIOV[0];
+  std::cout << (ok ? "OK" : "FAILED") << ": allocations per IOV "
+	    << (ok ? "do not depend" : "depend") << " on the number of modules" << std::endl;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+// Client for calibrationDaemon.C
+//
+// Sends one query to the daemon and prints the answer. Needs no ROOT:
+//   g++ -O2 -o calibrationQuery calibrationQuery.cc
+//   ./calibrationQuery /tmp/calib.sock series StripLADeco TOB 0 2
+//   ./calibrationQuery /tmp/calib.sock unchanged 7
+// Exits with status 1 if the daemon answered with an error.
+
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "../Common/UnixSocket.h"
+
+
+int main(int argc, char* argv[]) {
+  if( argc < 3 ) {
+    std::cerr << "Usage: " << argv[0] << " <socket> <query...>" << std::endl;
+    return 2;
+  }
+  std::string request(argv[2]);
+  for(int i = 3; i < argc; ++i) {
+    request += " ";
+    request += argv[i];
+  }
+
+  try {
+    const std::string response = unixSocketQuery(argv[1],request);
+    if( response.compare(0,2,"OK") == 0 ) {
+      const size_t payload = response.find('\n');
+      if( payload != std::string::npos ) std::fwrite(response.data()+payload+1,1,response.size()-payload-1,stdout);
+      return 0;
+    }
+    std::cerr << response;
+  } catch(std::exception&) {
+    // error already printed
+  }
+
+  return 1;
+}
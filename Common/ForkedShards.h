@@ -0,0 +1,289 @@
+#ifndef FORKED_SHARDS_H
+#define FORKED_SHARDS_H
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "TString.h"
+
+
+// Appends records to the shared-memory arena of one worker.
+// close() writes the buffered records and throws if this fails; the
+// destructor only reports such an error, since it must not throw.
+template<class Record>
+class ShardWriter {
+public:
+  ShardWriter(const int fd)
+    : fd_(fd), closed_(false) { buffer_.reserve(bufferSize_); }
+  ~ShardWriter();
+
+  void add(const Record& rec) {
+    buffer_.push_back(rec);
+    if( buffer_.size() == bufferSize_ ) flush();
+  }
+  void flush();
+  void close();
+
+
+private:
+  static const size_t bufferSize_ = 4096;
+
+  const int fd_;
+  bool closed_;
+  std::vector<Record> buffer_;
+};
+
+
+template<class Record>
+ShardWriter<Record>::~ShardWriter() {
+  if( closed_ ) return;
+  try {
+    flush();
+  } catch(...) {
+    std::cerr << "\n\nERROR in ShardWriter: " << buffer_.size() << " records lost when closing\n" << std::endl;
+  }
+}
+
+
+template<class Record>
+void ShardWriter<Record>::flush() {
+  const char* data = reinterpret_cast<const char*>(buffer_.data());
+  size_t nBytes = buffer_.size()*sizeof(Record);
+  while( nBytes > 0 ) {
+    const ssize_t n = write(fd_,data,nBytes);
+    if( n < 0 ) {
+      if( errno == EINTR ) continue;
+      std::cerr << "\n\nERROR in ShardWriter: " << std::strerror(errno) << "\n" << std::endl;
+      throw std::exception();
+    }
+    data += n;
+    nBytes -= n;
+  }
+  buffer_.clear();
+}
+
+
+template<class Record>
+void ShardWriter<Record>::close() {
+  flush();
+  closed_ = true;
+}
+
+
+
+// Process-level parallelism for readers where ROOT must not be used
+// from several threads.
+//
+// run() forks nWorkers child processes and calls work(shard,writer) in
+// each of them, with shard in [0,nWorkers). A worker opens its own
+// files, i.e. no ROOT state is shared, and writes its results as
+// fixed-size records (plain structs) into its own anonymous shared-
+// memory file. After all workers finished, the parent maps the records
+// of each shard, which stay valid until the ForkedShards is destroyed.
+//
+// Workers that produce two kinds of results in one pass write the
+// second kind into the shards of another ForkedShards, see
+// run(work,aux).
+template<class Record>
+class ForkedShards {
+public:
+  ForkedShards(const unsigned int nWorkers)
+    : nWorkers_(nWorkers > 0 ? nWorkers : 1) {}
+  ~ForkedShards() { unmap(); }
+
+  template<class Work> void run(Work& work);
+
+  // Calls work(shard,writer,auxWriter) in each worker, where auxWriter
+  // writes into the shard of aux. Both need the same number of workers.
+  template<class AuxRecord, class Work> void run(Work& work, ForkedShards<AuxRecord>& aux);
+
+  unsigned int nShards() const { return nWorkers_; }
+  size_t nRecords(const unsigned int shard) const { return arenas_.at(shard).nRecords; }
+  const Record* records(const unsigned int shard) const { return arenas_.at(shard).records; }
+
+
+private:
+  template<class> friend class ForkedShards;
+
+  struct Arena {
+    Arena()
+      : records(0), nRecords(0) {}
+
+    const Record* records;
+    size_t nRecords;
+  };
+
+  const unsigned int nWorkers_;
+  std::vector<Arena> arenas_;
+
+  // not copyable: owns the mappings
+  ForkedShards(const ForkedShards&);
+  ForkedShards& operator=(const ForkedShards&);
+
+  std::vector<int> createFiles() const;
+  template<class Child> bool forkWorkers(Child& child) const;
+  bool mapFiles(const std::vector<int>& fds, bool ok);
+  void unmap();
+};
+
+
+template<class Record>
+template<class Work>
+void ForkedShards<Record>::run(Work& work) {
+  unmap();
+  const std::vector<int> fds = createFiles();
+  auto child = [&](const unsigned int shard) {
+    ShardWriter<Record> writer(fds.at(shard));
+    work(shard,writer);
+    writer.close();
+  };
+  const bool ok = mapFiles(fds,forkWorkers(child));
+  if( !ok ) {
+    unmap();
+    throw std::exception();
+  }
+}
+
+
+template<class Record>
+template<class AuxRecord, class Work>
+void ForkedShards<Record>::run(Work& work, ForkedShards<AuxRecord>& aux) {
+  if( aux.nWorkers_ != nWorkers_ ) {
+    std::cerr << "\n\nERROR in ForkedShards: " << nWorkers_ << " and " << aux.nWorkers_ << " workers\n" << std::endl;
+    throw std::exception();
+  }
+  unmap();
+  aux.unmap();
+  const std::vector<int> fds = createFiles();
+  std::vector<int> auxFds;
+  try {
+    auxFds = aux.createFiles();
+  } catch(...) {
+    for(size_t i = 0; i < fds.size(); ++i) close(fds[i]);
+    throw;
+  }
+  auto child = [&](const unsigned int shard) {
+    ShardWriter<Record> writer(fds.at(shard));
+    ShardWriter<AuxRecord> auxWriter(auxFds.at(shard));
+    work(shard,writer,auxWriter);
+    writer.close();
+    auxWriter.close();
+  };
+  const bool workersOk = forkWorkers(child);
+  const bool ok = mapFiles(fds,workersOk);
+  const bool auxOk = aux.mapFiles(auxFds,workersOk);
+  if( !ok || !auxOk ) {
+    unmap();
+    aux.unmap();
+    throw std::exception();
+  }
+}
+
+
+// One anonymous shared-memory file per worker
+template<class Record>
+std::vector<int> ForkedShards<Record>::createFiles() const {
+  std::vector<int> fds(nWorkers_,-1);
+  for(unsigned int shard = 0; shard < nWorkers_; ++shard) {
+    TString name("shard");
+    name += shard;
+    fds.at(shard) = memfd_create(name.Data(),0);
+    if( fds.at(shard) < 0 ) {
+      std::cerr << "\n\nERROR in ForkedShards: cannot create shared memory: " << std::strerror(errno) << "\n" << std::endl;
+      for(unsigned int i = 0; i < shard; ++i) close(fds.at(i));
+      throw std::exception();
+    }
+  }
+
+  return fds;
+}
+
+
+// Runs child(shard) in nWorkers forked processes and waits for all of
+// them; returns whether all succeeded. If a fork fails, no further
+// workers are started, and the started ones are still waited for, so
+// that the caller can close the files.
+template<class Record>
+template<class Child>
+bool ForkedShards<Record>::forkWorkers(Child& child) const {
+  std::vector<pid_t> pids(nWorkers_,-1);
+  bool ok = true;
+  std::cout.flush();
+  std::cerr.flush();
+  for(unsigned int shard = 0; shard < nWorkers_; ++shard) {
+    const pid_t pid = fork();
+    if( pid == 0 ) {		// worker
+      int status = 0;
+      try {
+	child(shard);
+      } catch(...) {
+	status = 1;
+      }
+      std::cout.flush();
+      std::cerr.flush();
+      _exit(status);		// skip the parent's atexit handlers, e.g. ROOT's cleanup
+    } else if( pid < 0 ) {
+      std::cerr << "\n\nERROR in ForkedShards: cannot fork: " << std::strerror(errno) << "\n" << std::endl;
+      ok = false;
+      break;
+    }
+    pids.at(shard) = pid;
+  }
+
+  // wait for all workers before mapping their results
+  for(unsigned int shard = 0; shard < nWorkers_; ++shard) {
+    if( pids.at(shard) < 0 ) continue;
+    int status = 0;
+    while( waitpid(pids.at(shard),&status,0) < 0 && errno == EINTR ) {}
+    if( !WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+      std::cerr << "\n\nERROR in ForkedShards: worker " << shard << " failed\n" << std::endl;
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+
+// Maps the records of the workers if ok, and closes the files
+template<class Record>
+bool ForkedShards<Record>::mapFiles(const std::vector<int>& fds, bool ok) {
+  arenas_.resize(nWorkers_);
+  for(unsigned int shard = 0; shard < nWorkers_; ++shard) {
+    struct stat st;
+    if( ok && fstat(fds.at(shard),&st) == 0 && st.st_size > 0 ) {
+      void* addr = mmap(0,st.st_size,PROT_READ,MAP_SHARED,fds.at(shard),0);
+      if( addr != MAP_FAILED ) {
+	arenas_.at(shard).records = static_cast<const Record*>(addr);
+	arenas_.at(shard).nRecords = st.st_size/sizeof(Record);
+      } else {
+	ok = false;
+      }
+    }
+    close(fds.at(shard));
+  }
+
+  return ok;
+}
+
+
+template<class Record>
+void ForkedShards<Record>::unmap() {
+  for(size_t i = 0; i < arenas_.size(); ++i) {
+    if( arenas_[i].records != 0 ) {
+      munmap(const_cast<Record*>(arenas_[i].records),arenas_[i].nRecords*sizeof(Record));
+    }
+  }
+  arenas_.clear();
+}
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef MILLE_PEDE_RES_H
+#define MILLE_PEDE_RES_H
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TFile.h"
+#include "TString.h"
+#include "TTree.h"
+
+
+// The parameters of one alignable, as in the MillePedeUser trees
+struct MillePedeAlignable {
+  static const UInt_t numParMax = 20;
+
+  UInt_t Label;			// label of the first parameter
+  UInt_t Id;
+  Int_t ObjId;
+  UInt_t NumPar;
+  Float_t Par[numParMax];	// -999999 if not in millepede.res
+  Float_t Sigma[numParMax];
+  Float_t PreSigma[numParMax];	// -1 for fixed parameters
+};
+
+
+// Reads the fitted parameters from millepede.res, e.g. when there is no
+// treeFile. Each line of the file is
+//   <label> <value> <presigma> [<difference> [<error or nrcds>]]
+// and gives one parameter. As in the MillePedeUser trees, Sigma is the
+// fifth column, which is the error only in inversion mode.
+//
+// The Id and ObjId of the alignables are not in millepede.res; they are
+// taken from a label file with one line
+//   <label> <Id> <ObjId>
+// per alignable, which can be written once per geometry from the 'Label'
+// branch of a MillePedeUser tree with writeMillePedeLabels().
+//
+// The labels follow the PedeLabeler convention: alignable i has the
+// parameter labels 1 + stride*i + iPar. The stride is the smallest
+// distance of the labels in the label file, or labelStride without
+// label file (20 in PedeLabeler).
+//
+// The file is mapped into memory and split into nThreads chunks at line
+// boundaries, which are parsed in parallel without streams.
+class MillePedeRes {
+public:
+  MillePedeRes(const TString& resFileName, const TString& labelFileName = "", const unsigned int nThreads = 1, const UInt_t labelStride = MillePedeAlignable::numParMax);
+
+  size_t nAlignables() const { return alignables_.size(); }
+  const MillePedeAlignable& alignable(const size_t i) const { return alignables_.at(i); }
+  size_t nParameters() const { return nParameters_; }
+
+
+private:
+  static const UInt_t minLabel_ = 1;
+
+  // one line of millepede.res
+  struct ParLine {
+    UInt_t label;
+    Float_t value;
+    Float_t presigma;
+    Float_t sigma;
+  };
+
+  // one line of the label file
+  struct LabelLine {
+    UInt_t label;
+    UInt_t id;
+    Int_t objId;
+  };
+
+  std::vector<MillePedeAlignable> alignables_; // ordered by label
+  size_t nParameters_;
+
+  static void parse(const char* begin, const char* end, std::vector<ParLine>& lines, bool& ok);
+  static const char* skipBlanks(const char* p, const char* end);
+  static std::vector<LabelLine> readLabels(const TString& labelFileName);
+};
+
+
+// Writes the label file for MillePedeRes from a MillePedeUser tree
+void writeMillePedeLabels(const TString& treeFileName, const unsigned int iov, const TString& labelFileName) {
+  TFile file(treeFileName,"READ");
+  TString treeName("MillePedeUser_");
+  treeName += iov;
+  TTree* tree = NULL;
+  file.GetObject(treeName,tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading TTree '" << treeName << "' from file '" << treeFileName << "'\n\n" << std::endl;
+    throw std::exception();
+  }
+  std::ofstream out( labelFileName.Data() );
+  if( !out.is_open() ) {
+    std::cerr << "\n\nERROR error opening file '" << labelFileName << "'\n";
+    throw std::exception();
+  }
+
+  UInt_t Label = 0;
+  UInt_t Id = 0;
+  Int_t ObjId = 0;
+  tree->SetBranchStatus("*",false);
+  tree->SetBranchStatus("Label",true);
+  tree->SetBranchStatus("Id",true);
+  tree->SetBranchStatus("ObjId",true);
+  tree->SetBranchAddress("Label",&Label);
+  tree->SetBranchAddress("Id",&Id);
+  tree->SetBranchAddress("ObjId",&ObjId);
+  out << "# label Id ObjId\n";
+  for(Long64_t i = 0; i < tree->GetEntries(); ++i) {
+    tree->GetEntry(i);
+    out << Label << " " << Id << " " << ObjId << "\n";
+  }
+  file.Close();
+}
+
+
+MillePedeRes::MillePedeRes(const TString& resFileName, const TString& labelFileName, const unsigned int nThreads, const UInt_t labelStride)
+  : nParameters_(0) {
+  if( labelStride == 0 || labelStride > MillePedeAlignable::numParMax ) {
+    std::cerr << "\n\nERROR label stride " << labelStride << " not in [1," << MillePedeAlignable::numParMax << "]\n" << std::endl;
+    throw std::exception();
+  }
+  const std::vector<LabelLine> labels = labelFileName != "" ? readLabels(labelFileName) : std::vector<LabelLine>();
+  UInt_t stride = labelStride;
+  if( labels.size() > 1 ) {
+    stride = MillePedeAlignable::numParMax;
+    for(size_t i = 1; i < labels.size(); ++i) {
+      if( labels[i].label == labels[i-1].label ) {
+	std::cerr << "\n\nERROR label " << labels[i].label << " twice in file '" << labelFileName << "'\n" << std::endl;
+	throw std::exception();
+      }
+      stride = std::min(stride,labels[i].label-labels[i-1].label);
+    }
+  }
+
+  const int fd = open(resFileName.Data(),O_RDONLY);
+  struct stat st;
+  if( fd < 0 || fstat(fd,&st) < 0 ) {
+    std::cerr << "\n\nERROR opening file '" << resFileName << "': " << std::strerror(errno) << "\n" << std::endl;
+    if( fd >= 0 ) close(fd);
+    throw std::exception();
+  }
+  const size_t size = st.st_size;
+  const char* data = 0;
+  if( size > 0 ) {
+    void* addr = mmap(0,size,PROT_READ,MAP_PRIVATE,fd,0);
+    if( addr == MAP_FAILED ) {
+      std::cerr << "\n\nERROR mapping file '" << resFileName << "': " << std::strerror(errno) << "\n" << std::endl;
+      close(fd);
+      throw std::exception();
+    }
+    madvise(addr,size,MADV_SEQUENTIAL);
+    data = static_cast<const char*>(addr);
+  }
+  close(fd);
+
+  // chunks start after a line break
+  const unsigned int nChunks = std::max(1u,nThreads);
+  std::vector<const char*> bounds(nChunks+1,data+size);
+  bounds[0] = data;
+  for(unsigned int c = 1; c < nChunks; ++c) {
+    const char* p = std::max(bounds[c-1],data+c*size/nChunks);
+    while( p < data+size && p > data && *(p-1) != '\n' ) ++p;
+    bounds[c] = p;
+  }
+
+  std::vector< std::vector<ParLine> > lines(nChunks);
+  std::vector<char> ok(nChunks,true);
+  if( nChunks == 1 ) {
+    bool chunkOk = true;
+    parse(bounds[0],bounds[1],lines[0],chunkOk);
+    ok[0] = chunkOk;
+  } else {
+    std::vector<std::thread> threads;
+    for(unsigned int c = 0; c < nChunks; ++c) {
+      threads.push_back(std::thread([&,c]() {
+	bool chunkOk = true;
+	parse(bounds[c],bounds[c+1],lines[c],chunkOk);
+	ok[c] = chunkOk;
+      }));
+    }
+    for(unsigned int c = 0; c < nChunks; ++c) {
+      threads[c].join();
+    }
+  }
+  if( data != 0 ) munmap(const_cast<char*>(data),size);
+  for(unsigned int c = 0; c < nChunks; ++c) {
+    if( !ok[c] ) {
+      std::cerr << "\n\nERROR malformed line in file '" << resFileName << "'\n" << std::endl;
+      throw std::exception();
+    }
+  }
+
+  // table of alignables
+  std::unordered_map<UInt_t,size_t> index; // alignable label -> position
+  for(unsigned int c = 0; c < nChunks; ++c) {
+    for(size_t i = 0; i < lines[c].size(); ++i) {
+      const ParLine& line = lines[c][i];
+      if( line.label < minLabel_ ) continue;
+      const UInt_t iPar = (line.label-minLabel_) % stride;
+      const UInt_t aliLabel = line.label - iPar;
+      std::unordered_map<UInt_t,size_t>::const_iterator it = index.find(aliLabel);
+      if( it == index.end() ) {
+	MillePedeAlignable ali;
+	ali.Label = aliLabel;
+	ali.Id = 0;
+	ali.ObjId = 0;
+	ali.NumPar = 0;
+	std::fill(ali.Par,ali.Par+MillePedeAlignable::numParMax,-999999.);
+	std::fill(ali.Sigma,ali.Sigma+MillePedeAlignable::numParMax,-999999.);
+	std::fill(ali.PreSigma,ali.PreSigma+MillePedeAlignable::numParMax,-1.);
+	it = index.insert(std::make_pair(aliLabel,alignables_.size())).first;
+	alignables_.push_back(ali);
+      }
+      MillePedeAlignable& ali = alignables_[it->second];
+      ali.Par[iPar] = line.value;
+      ali.Sigma[iPar] = line.sigma;
+      ali.PreSigma[iPar] = line.presigma;
+      ali.NumPar = std::max(ali.NumPar,iPar+1);
+      ++nParameters_;
+    }
+  }
+  std::sort(alignables_.begin(),alignables_.end(),
+	    [](const MillePedeAlignable& a, const MillePedeAlignable& b) { return a.Label < b.Label; });
+
+  if( labelFileName == "" ) return;
+  size_t nMissing = 0;
+  for(size_t i = 0; i < alignables_.size(); ++i) {
+    MillePedeAlignable& ali = alignables_[i];
+    std::vector<LabelLine>::const_iterator itL = std::lower_bound(labels.begin(),labels.end(),ali.Label,
+								  [](const LabelLine& l, const UInt_t label) { return l.label < label; });
+    if( itL != labels.end() && itL->label == ali.Label ) {
+      ali.Id = itL->id;
+      ali.ObjId = itL->objId;
+    } else {
+      if( nMissing < 10 ) std::cout << "  alignable with label " << ali.Label << " not in label file" << std::endl;
+      ++nMissing;
+    }
+  }
+  if( nMissing > 0 ) {
+    std::cout << "WARNING: " << nMissing << " alignables of '" << resFileName << "' not in label file '" << labelFileName << "', their Id and ObjId are 0" << std::endl;
+  }
+}
+
+
+const char* MillePedeRes::skipBlanks(const char* p, const char* end) {
+  while( p < end && ( *p == ' ' || *p == '\t' || *p == '\r' ) ) ++p;
+  return p;
+}
+
+
+// Lines not starting with a label, e.g. the header, are skipped
+void MillePedeRes::parse(const char* begin, const char* end, std::vector<ParLine>& lines, bool& ok) {
+  const char* p = begin;
+  while( p < end ) {
+    const char* eol = static_cast<const char*>(std::memchr(p,'\n',end-p));
+    if( eol == 0 ) eol = end;
+
+    ParLine line;
+    p = skipBlanks(p,eol);
+    const std::from_chars_result res = std::from_chars(p,eol,line.label);
+    if( res.ec == std::errc() ) {
+      // value, presigma, difference, sigma
+      double cols[4] = { 0., 0., 0., 0. };
+      int nCols = 0;
+      p = res.ptr;
+      while( nCols < 4 ) {
+	p = skipBlanks(p,eol);
+	const std::from_chars_result r = std::from_chars(p,eol,cols[nCols]);
+	if( r.ec != std::errc() ) break;
+	p = r.ptr;
+	++nCols;
+      }
+      if( nCols < 2 ) {
+	ok = false;
+	return;
+      }
+      line.value = cols[0];
+      line.presigma = cols[1];
+      line.sigma = nCols > 3 ? cols[3] : 0.;
+      lines.push_back(line);
+    }
+    p = eol+1;
+  }
+}
+
+
+// The lines ordered by label
+std::vector<MillePedeRes::LabelLine> MillePedeRes::readLabels(const TString& labelFileName) {
+  std::ifstream file( labelFileName.Data() );
+  if( !file.is_open() ) {
+    std::cerr << "\n\nERROR error opening file '" << labelFileName << "'\n";
+    throw std::exception();
+  }
+
+  std::vector<LabelLine> labels;
+  std::string line("");
+  while( std::getline(file,line) ) {
+    if( line.empty() || line[0] == '#' ) continue;
+    LabelLine l;
+    if( sscanf(line.c_str(),"%u %u %d",&l.label,&l.id,&l.objId) != 3 ) {
+      std::cerr << "\n\nERROR unrecognised line '" << line << "' in file '" << labelFileName << "'\n" << std::endl;
+      throw std::exception();
+    }
+    labels.push_back(l);
+  }
+  std::sort(labels.begin(),labels.end(),
+	    [](const LabelLine& a, const LabelLine& b) { return a.label < b.label; });
+
+  return labels;
+}
+
+#endif
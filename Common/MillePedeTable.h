@@ -0,0 +1,304 @@
+#ifndef MILLE_PEDE_TABLE_H
+#define MILLE_PEDE_TABLE_H
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "TFile.h"
+#include "TString.h"
+#include "TTree.h"
+
+#include "ForkedShards.h"
+#include "MillePedeRes.h"
+#include "PrefetchPipeline.h"
+
+
+// The alignables of one MillePedeUser_<iov> tree in columns: Id, ObjId
+// and NumPar per alignable, and Par, Sigma and PreSigma with a fixed
+// stride of numParMax parameters per alignable.
+//
+// The tree is decoded once, reading only these branches; the tools,
+// e.g. the list of unchanged DetUnits and the high-level structure
+// parameters, are queries on the table. The table can also be filled
+// from millepede.res (see MillePedeRes).
+class MillePedeTable {
+public:
+  static const UInt_t numParMax = MillePedeAlignable::numParMax;
+
+  MillePedeTable() {}
+
+  // With nProcesses > 1, ranges of entries are read in as many forked
+  // processes; with readahead > 0, the next chunks of entries are read in
+  // a background thread while the current one is stored.
+  MillePedeTable(const TString& treeFileName, const unsigned int iov, const unsigned int nProcesses = 1, const unsigned int readahead = 0);
+  MillePedeTable(const MillePedeRes& res);
+
+  size_t nAlignables() const { return id_.size(); }
+  UInt_t id(const size_t i) const { return id_[i]; }
+  Int_t objId(const size_t i) const { return objId_[i]; }
+  UInt_t numPar(const size_t i) const { return numPar_[i]; }
+  const Float_t* par(const size_t i) const { return &par_[i*numParMax]; }
+  const Float_t* sigma(const size_t i) const { return &sigma_[i*numParMax]; }
+  const Float_t* presigma(const size_t i) const { return &presigma_[i*numParMax]; }
+
+  MillePedeAlignable alignable(const size_t i) const;
+  void add(const MillePedeAlignable& ali);
+  void add(const MillePedeTable& other);
+  void clear();
+
+  // whether mille-pede returned zero or no value for all parameters
+  bool isUnchanged(const size_t i) const;
+
+  // ids of the DetUnits (ObjId 1) with unchanged parameters
+  std::vector<UInt_t> unchangedDetUnits() const;
+
+
+private:
+  std::vector<UInt_t> id_;
+  std::vector<Int_t> objId_;
+  std::vector<UInt_t> numPar_;
+  std::vector<Float_t> par_;	 // [alignable*numParMax+iPar]
+  std::vector<Float_t> sigma_;
+  std::vector<Float_t> presigma_;
+
+  void read(const TString& treeFileName, const unsigned int iov, const Long64_t firstEntry, Long64_t lastEntry, const unsigned int readahead);
+  static TTree* getTree(TFile& file, const unsigned int iov);
+};
+
+
+// Ids of the unchanged DetUnits (see MillePedeTable::unchangedDetUnits)
+// of several IOVs. With nProcesses > 1, the IOV trees are split among as
+// many forked processes, which share no ROOT state.
+std::map< unsigned int, std::vector<UInt_t> > unchangedDetUnits(const TString& treeFileName, const std::vector<unsigned int>& iovs, const unsigned int nProcesses = 1);
+
+
+TTree* MillePedeTable::getTree(TFile& file, const unsigned int iov) {
+  if( iov == 0 ) {
+    std::cerr << "\n\nERROR: IOV numbering starts with 1\n\n" << std::endl;
+    throw std::exception();
+  }
+  TString treeName("MillePedeUser_");
+  treeName += iov;
+  TTree* tree = NULL;
+  file.GetObject(treeName,tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading TTree '" << treeName << "' from file '" << file.GetName() << "'\n\n" << std::endl;
+    throw std::exception();
+  }
+
+  return tree;
+}
+
+
+// Each worker reads a contiguous range of entries, so the rows of
+// the shards in order are in the same order as in the tree
+MillePedeTable::MillePedeTable(const TString& treeFileName, const unsigned int iov, const unsigned int nProcesses, const unsigned int readahead) {
+  if( nProcesses <= 1 ) {
+    read(treeFileName,iov,0,-1,readahead);
+    return;
+  }
+
+  Long64_t nEntries = 0;
+  {
+    TFile file(treeFileName,"READ");
+    nEntries = getTree(file,iov)->GetEntries();
+    file.Close();
+  }
+  auto work = [&](const unsigned int shard, ShardWriter<MillePedeAlignable>& out) {
+    MillePedeTable part;
+    part.read(treeFileName,iov,shard*nEntries/nProcesses,(shard+1)*nEntries/nProcesses,readahead);
+    for(size_t i = 0; i < part.nAlignables(); ++i) {
+      out.add(part.alignable(i));
+    }
+  };
+  ForkedShards<MillePedeAlignable> shards(nProcesses);
+  shards.run(work);
+  for(unsigned int shard = 0; shard < shards.nShards(); ++shard) {
+    for(size_t i = 0; i < shards.nRecords(shard); ++i) {
+      add(shards.records(shard)[i]);
+    }
+  }
+}
+
+
+MillePedeTable::MillePedeTable(const MillePedeRes& res) {
+  for(size_t i = 0; i < res.nAlignables(); ++i) {
+    add(res.alignable(i));
+  }
+}
+
+
+// Reads the entries [firstEntry,lastEntry), lastEntry < 0 means all
+void MillePedeTable::read(const TString& treeFileName, const unsigned int iov, const Long64_t firstEntry, Long64_t lastEntry, const unsigned int readahead) {
+  TFile file(treeFileName,"READ");
+  TTree* tree = getTree(file,iov);
+  if( lastEntry < 0 ) lastEntry = tree->GetEntries();
+
+  UInt_t Id = 0;
+  Int_t ObjId = 0;
+  UInt_t NumPar = 0;
+  Float_t Par[numParMax];
+  Float_t Sigma[numParMax];
+  Float_t PreSigma[numParMax];
+  tree->SetBranchStatus("*",false);
+  const char* branches[6] = { "Id", "ObjId", "NumPar", "Par", "Sigma", "PreSigma" };
+  for(int i = 0; i < 6; ++i) {
+    tree->SetBranchStatus(branches[i],true);
+  }
+  tree->SetBranchAddress("Id",&Id);
+  tree->SetBranchAddress("ObjId",&ObjId);
+  tree->SetBranchAddress("NumPar",&NumPar);
+  tree->SetBranchAddress("Par",Par);
+  tree->SetBranchAddress("Sigma",Sigma);
+  tree->SetBranchAddress("PreSigma",PreSigma);
+
+  // reading: fill the next chunk of entries into a table
+  const Long64_t chunkSize = 10000;
+  Long64_t nextEntry = firstEntry;
+  auto readChunk = [&](MillePedeTable& chunk) -> bool {
+    if( nextEntry >= lastEntry ) return false;
+    const Long64_t last = std::min(lastEntry,nextEntry+chunkSize);
+    chunk.clear();
+    for(Long64_t entry = nextEntry; entry < last; ++entry) {
+      tree->GetEntry(entry);
+      if( NumPar > numParMax ) {
+	std::cerr << "\n\nERROR NumPar = " << NumPar << " > " << numParMax << "\n\n" << std::endl;
+	throw std::exception();
+      }
+      chunk.id_.push_back(Id);
+      chunk.objId_.push_back(ObjId);
+      chunk.numPar_.push_back(NumPar);
+      chunk.par_.insert(chunk.par_.end(),Par,Par+numParMax);
+      chunk.sigma_.insert(chunk.sigma_.end(),Sigma,Sigma+numParMax);
+      chunk.presigma_.insert(chunk.presigma_.end(),PreSigma,PreSigma+numParMax);
+    }
+    nextEntry = last;
+
+    return true;
+  };
+
+  // processing: append to this table
+  auto storeChunk = [&](const MillePedeTable& chunk) {
+    add(chunk);
+  };
+
+  PrefetchPipeline<MillePedeTable> pipeline(readahead);
+  pipeline.run(readChunk,storeChunk);
+  if( readahead > 0 ) pipeline.printStats("Reading MillePedeUser tree");
+
+  file.Close();
+}
+
+
+MillePedeAlignable MillePedeTable::alignable(const size_t i) const {
+  MillePedeAlignable ali;
+  ali.Label = 0;
+  ali.Id = id_[i];
+  ali.ObjId = objId_[i];
+  ali.NumPar = numPar_[i];
+  std::copy(par(i),par(i)+numParMax,ali.Par);
+  std::copy(sigma(i),sigma(i)+numParMax,ali.Sigma);
+  std::copy(presigma(i),presigma(i)+numParMax,ali.PreSigma);
+
+  return ali;
+}
+
+
+void MillePedeTable::add(const MillePedeAlignable& ali) {
+  id_.push_back(ali.Id);
+  objId_.push_back(ali.ObjId);
+  numPar_.push_back(ali.NumPar);
+  par_.insert(par_.end(),ali.Par,ali.Par+numParMax);
+  sigma_.insert(sigma_.end(),ali.Sigma,ali.Sigma+numParMax);
+  presigma_.insert(presigma_.end(),ali.PreSigma,ali.PreSigma+numParMax);
+}
+
+
+void MillePedeTable::add(const MillePedeTable& other) {
+  id_.insert(id_.end(),other.id_.begin(),other.id_.end());
+  objId_.insert(objId_.end(),other.objId_.begin(),other.objId_.end());
+  numPar_.insert(numPar_.end(),other.numPar_.begin(),other.numPar_.end());
+  par_.insert(par_.end(),other.par_.begin(),other.par_.end());
+  sigma_.insert(sigma_.end(),other.sigma_.begin(),other.sigma_.end());
+  presigma_.insert(presigma_.end(),other.presigma_.begin(),other.presigma_.end());
+}
+
+
+void MillePedeTable::clear() {
+  id_.clear();
+  objId_.clear();
+  numPar_.clear();
+  par_.clear();
+  sigma_.clear();
+  presigma_.clear();
+}
+
+
+bool MillePedeTable::isUnchanged(const size_t i) const {
+  const Float_t* p = par(i);
+  for(UInt_t iPar = 0; iPar < numPar_[i]; ++iPar) {
+    if( !( std::abs(p[iPar]) < 1E-12 || p[iPar] < -999990 ) ) return false;
+  }
+
+  return true;
+}
+
+
+std::vector<UInt_t> MillePedeTable::unchangedDetUnits() const {
+  std::vector<UInt_t> list;
+  for(size_t i = 0; i < nAlignables(); ++i) {
+    if( objId_[i] == 1 && isUnchanged(i) ) list.push_back(id_[i]);
+  }
+
+  return list;
+}
+
+
+
+std::map< unsigned int, std::vector<UInt_t> > unchangedDetUnits(const TString& treeFileName, const std::vector<unsigned int>& iovs, const unsigned int nProcesses) {
+  std::map< unsigned int, std::vector<UInt_t> > lists;
+  if( nProcesses <= 1 ) {
+    for(size_t i = 0; i < iovs.size(); ++i) {
+      lists[iovs.at(i)] = MillePedeTable(treeFileName,iovs.at(i)).unchangedDetUnits();
+    }
+    return lists;
+  }
+
+  struct IdRecord {
+    unsigned int iov;
+    UInt_t id;
+  };
+  const size_t nIOVs = iovs.size();
+  auto work = [&](const unsigned int shard, ShardWriter<IdRecord>& out) {
+    for(size_t i = shard*nIOVs/nProcesses; i < (shard+1)*nIOVs/nProcesses; ++i) {
+      const std::vector<UInt_t> list = MillePedeTable(treeFileName,iovs.at(i)).unchangedDetUnits();
+      for(size_t j = 0; j < list.size(); ++j) {
+	IdRecord rec;
+	rec.iov = iovs.at(i);
+	rec.id = list[j];
+	out.add(rec);
+      }
+    }
+  };
+  ForkedShards<IdRecord> shards(nProcesses);
+  shards.run(work);
+
+  // IOVs without unchanged alignables have an empty list
+  for(size_t i = 0; i < nIOVs; ++i) {
+    lists[iovs.at(i)];
+  }
+  for(unsigned int shard = 0; shard < shards.nShards(); ++shard) {
+    for(size_t i = 0; i < shards.nRecords(shard); ++i) {
+      const IdRecord& rec = shards.records(shard)[i];
+      lists[rec.iov].push_back(rec.id);
+    }
+  }
+
+  return lists;
+}
+
+#endif
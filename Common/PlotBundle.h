@@ -0,0 +1,168 @@
+#ifndef PLOT_BUNDLE_H
+#define PLOT_BUNDLE_H
+
+#include <exception>
+#include <iostream>
+#include <set>
+#include <vector>
+
+#include "TCanvas.h"
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TPaveText.h"
+#include "TString.h"
+
+
+// Collects the canvases of a run into one multi-page PDF
+//   <baseName>.pdf
+// instead of one file per plot, and the plotted objects, e.g. the
+// graphs, into
+//   <baseName>.root
+// with one directory per page, named as the single file would have
+// been and titled with the page title. Since ROOT directory names
+// cannot contain '/', it is replaced by '_', and a repeated name gets
+// the suffix _2, _3, ... Each page gets a PDF bookmark
+// with its title; the last pages are a table of contents.
+//
+// The PDF is written with the "file.pdf(" ... "file.pdf)" protocol of
+// TPad::Print, i.e. it is opened and closed once for the whole run.
+// The bundle is completed when close() is called or the bundle is
+// destroyed.
+class PlotBundle {
+public:
+  PlotBundle(const TString& baseName);
+  ~PlotBundle();
+
+  // prints the current content of the canvas as the next page
+  void add(TCanvas* can, const TString& name, const TString& title);
+
+  // writes the object into the directory of the last page
+  void write(const TObject* obj, const TString& name);
+
+  void close();
+
+  unsigned int nPages() const { return titles_.size(); }
+
+
+private:
+  static const unsigned int nTocLines_ = 40;
+
+  TString pdfName_;
+  TFile* file_;
+  TDirectory* page_;
+  std::vector<TString> titles_;
+  std::set<TString> pageNames_;
+  bool closed_;
+
+  TString pageName(const TString& name);
+  void printToc();
+};
+
+
+PlotBundle::PlotBundle(const TString& baseName)
+  : pdfName_(baseName+".pdf"), file_(0), page_(0), closed_(false) {
+  // don't make the file the current directory: objects created
+  // afterwards, e.g. histograms, must not end up in it
+  TDirectory* current = gDirectory;
+  file_ = new TFile(baseName+".root","RECREATE");
+  if( current != 0 ) current->cd();
+  if( file_->IsZombie() ) {
+    std::cerr << "\n\nERROR opening file '" << baseName << ".root'\n" << std::endl;
+    throw std::exception();
+  }
+}
+
+
+PlotBundle::~PlotBundle() {
+  close();
+}
+
+
+void PlotBundle::add(TCanvas* can, const TString& name, const TString& title) {
+  if( closed_ ) {
+    std::cerr << "\n\nERROR in PlotBundle: '" << pdfName_ << "' is already closed\n" << std::endl;
+    throw std::exception();
+  }
+  const TString option = "Title:"+title;
+  if( titles_.empty() ) can->Print(pdfName_+"(",option);
+  else                  can->Print(pdfName_,option);
+  titles_.push_back(title);
+  const TString dirName = pageName(name);
+  page_ = file_->mkdir(dirName,title);
+  if( page_ == 0 ) {
+    std::cerr << "\n\nERROR in PlotBundle: cannot create directory '" << dirName << "' in '" << file_->GetName() << "'\n" << std::endl;
+    throw std::exception();
+  }
+}
+
+
+// A valid directory name not used by an earlier page
+TString PlotBundle::pageName(const TString& name) {
+  TString base(name);
+  base.ReplaceAll("/","_");
+  if( base == "" ) base = "page";
+  TString dirName(base);
+  for(unsigned int n = 2; pageNames_.find(dirName) != pageNames_.end(); ++n) {
+    dirName = base+"_";
+    dirName += n;
+  }
+  pageNames_.insert(dirName);
+
+  return dirName;
+}
+
+
+void PlotBundle::write(const TObject* obj, const TString& name) {
+  if( page_ == 0 ) {
+    std::cerr << "\n\nERROR in PlotBundle: no page to write '" << name << "' to\n" << std::endl;
+    throw std::exception();
+  }
+  page_->WriteTObject(obj,name);
+}
+
+
+void PlotBundle::close() {
+  if( closed_ ) return;
+  closed_ = true;
+  if( !titles_.empty() ) printToc();
+  file_->Close();
+  delete file_;
+  file_ = 0;
+  page_ = 0;
+  std::cout << "Wrote " << titles_.size() << " pages to '" << pdfName_ << "'" << std::endl;
+}
+
+
+// The table of contents pages close the PDF
+void PlotBundle::printToc() {
+  TCanvas* can = new TCanvas("can_"+pdfName_+"_toc","contents",500,500);
+  const unsigned int nTocPages = (titles_.size()+nTocLines_-1)/nTocLines_;
+  for(unsigned int tocPage = 0; tocPage < nTocPages; ++tocPage) {
+    can->Clear();
+    can->cd();
+    TPaveText* toc = new TPaveText(0.05,0.03,0.95,0.97,"NDC");
+    toc->SetBorderSize(0);
+    toc->SetFillColor(0);
+    toc->SetTextFont(42);
+    toc->SetTextAlign(12);
+    toc->SetTextSize(0.018);
+    toc->AddText("Contents");
+    for(unsigned int i = tocPage*nTocLines_; i < titles_.size() && i < (tocPage+1)*nTocLines_; ++i) {
+      TString line("");
+      line += i+1;
+      line += "    "+titles_[i];
+      toc->AddText(line);
+    }
+    toc->Draw();
+    TString option("Title:Contents");
+    if( nTocPages > 1 ) {
+      option += " ";
+      option += tocPage+1;
+    }
+    can->Print(tocPage+1 == nTocPages ? pdfName_+")" : pdfName_,option);
+    delete toc;
+  }
+  delete can;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef PREFETCH_PIPELINE_H
+#define PREFETCH_PIPELINE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TROOT.h"
+#include "TString.h"
+
+
+// Producer/consumer pipeline to overlap reading with processing.
+//
+// The producer fills blocks of data, e.g. column buffers with the
+// next entries or the next tree of a file, and the consumer processes
+// them. With depth > 0, the producer runs in a background thread and
+// may read up to 'depth' blocks ahead while the consumer works on the
+// current one. The blocks are recycled, so their buffers are allocated
+// only once. With depth = 0, producer and consumer simply alternate in
+// the calling thread.
+//
+// The producer is called as bool produce(Block&) and returns false
+// when there is no more data; the consumer as void consume(const Block&).
+// Exceptions thrown by the producer are re-thrown by run().
+template<class Block>
+class PrefetchPipeline {
+public:
+  PrefetchPipeline(const unsigned int depth = 2)
+    : depth_(depth), nBlocks_(0), producerStall_(0.), consumerStall_(0.), abort_(false) {}
+
+  template<class Producer, class Consumer>
+  void run(Producer& produce, Consumer& consume);
+
+  unsigned int depth() const { return depth_; }
+  unsigned int nBlocks() const { return nBlocks_; }
+
+  // time in s the producer waited for a free block
+  double producerStallTime() const { return producerStall_; }
+  // time in s the consumer waited for data
+  double consumerStallTime() const { return consumerStall_; }
+
+  void printStats(const TString& label) const;
+
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  const unsigned int depth_;
+  unsigned int nBlocks_;
+  double producerStall_;
+  double consumerStall_;
+
+  std::vector<Block> blocks_;
+  std::deque<int> free_;	// indices of blocks that can be filled
+  std::deque<int> full_;	// indices of filled blocks, -1 marks the end
+  bool abort_;
+  std::mutex mutex_;
+  std::condition_variable freeCond_;
+  std::condition_variable fullCond_;
+
+  template<class Producer> void producerLoop(Producer& produce, std::exception_ptr& error);
+  int pop(std::deque<int>& queue, std::condition_variable& cond, double& stallTime);
+  void push(std::deque<int>& queue, std::condition_variable& cond, const int idx);
+};
+
+
+template<class Block>
+template<class Producer, class Consumer>
+void PrefetchPipeline<Block>::run(Producer& produce, Consumer& consume) {
+  nBlocks_ = 0;
+  producerStall_ = 0.;
+  consumerStall_ = 0.;
+
+  if( depth_ == 0 ) {
+    Block block;
+    while( produce(block) ) {
+      consume(block);
+      ++nBlocks_;
+    }
+    return;
+  }
+
+  ROOT::EnableThreadSafety();
+  blocks_.resize(depth_+1);	// one being consumed, depth_ read ahead
+  free_.clear();
+  full_.clear();
+  abort_ = false;
+  for(unsigned int i = 0; i < blocks_.size(); ++i) {
+    free_.push_back(i);
+  }
+
+  std::exception_ptr producerError;
+  std::thread producer(&PrefetchPipeline<Block>::template producerLoop<Producer>,this,std::ref(produce),std::ref(producerError));
+  try {
+    while( true ) {
+      const int idx = pop(full_,fullCond_,consumerStall_);
+      if( idx < 0 ) break;
+      consume(blocks_[idx]);
+      ++nBlocks_;
+      push(free_,freeCond_,idx);
+    }
+  } catch(...) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      abort_ = true;
+    }
+    freeCond_.notify_all();
+    producer.join();
+    throw;
+  }
+  producer.join();
+  if( producerError ) std::rethrow_exception(producerError);
+}
+
+
+template<class Block>
+template<class Producer>
+void PrefetchPipeline<Block>::producerLoop(Producer& produce, std::exception_ptr& error) {
+  try {
+    while( true ) {
+      const int idx = pop(free_,freeCond_,producerStall_);
+      if( idx < 0 ) break;	// consumer aborted
+      if( !produce(blocks_[idx]) ) break;
+      push(full_,fullCond_,idx);
+    }
+  } catch(...) {
+    error = std::current_exception();
+  }
+  push(full_,fullCond_,-1);
+}
+
+
+// Waits until the queue is not empty and returns its first element,
+// or -1 if the pipeline has been aborted
+template<class Block>
+int PrefetchPipeline<Block>::pop(std::deque<int>& queue, std::condition_variable& cond, double& stallTime) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if( queue.empty() && !abort_ ) {
+    const Clock::time_point start = Clock::now();
+    while( queue.empty() && !abort_ ) cond.wait(lock);
+    stallTime += std::chrono::duration<double>(Clock::now()-start).count();
+  }
+  if( abort_ || queue.empty() ) return -1;
+  const int idx = queue.front();
+  queue.pop_front();
+
+  return idx;
+}
+
+
+template<class Block>
+void PrefetchPipeline<Block>::push(std::deque<int>& queue, std::condition_variable& cond, const int idx) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue.push_back(idx);
+  }
+  cond.notify_one();
+}
+
+
+template<class Block>
+void PrefetchPipeline<Block>::printStats(const TString& label) const {
+  std::cout << label << ": " << nBlocks_ << " blocks with readahead " << depth_;
+  if( depth_ > 0 ) {
+    std::cout << ", reading waited " << producerStall_ << " s, processing waited " << consumerStall_ << " s";
+  }
+  std::cout << std::endl;
+}
+
+#endif
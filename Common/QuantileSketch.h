@@ -0,0 +1,183 @@
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+
+// Mergeable streaming quantile sketch (KLL, Karnin, Lang and Liberty 2016)
+//
+// The values are kept in compactors at levels h = 0,1,..., where an
+// item at level h stands for 2^h values. When the sketch is full, the
+// first full level is sorted and every other item is promoted to the
+// next level. With the default k = 200, the rank error of quantile()
+// is about 1%, and the memory is O(k) independent of the number of
+// values. Sketches of different parts of the data, e.g. of parallel
+// chunks or of several files, can be merged.
+//
+// The compaction offset alternates at each level instead of being
+// random, so the results are reproducible.
+class QuantileSketch {
+public:
+  QuantileSketch(const unsigned int k = 200)
+    : k_(k), n_(0), size_(0), maxSize_(0),
+      min_(std::numeric_limits<double>::max()), max_(-std::numeric_limits<double>::max()) {
+    grow();
+  }
+
+  void add(const double x);
+  void merge(const QuantileSketch& other);
+
+  unsigned long long count() const { return n_; }
+  double min() const { return min_; }
+  double max() const { return max_; }
+
+  // value below which a fraction q of the values lie, NaN if empty
+  double quantile(const double q) const;
+
+  // quantile q of |x - center|, e.g. the median absolute deviation
+  // for center = quantile(0.5) and q = 0.5
+  double absDeviationQuantile(const double center, const double q) const;
+
+
+private:
+  typedef std::vector< std::pair<double,double> > WeightedItems; // (value,weight)
+
+  unsigned int k_;
+  unsigned long long n_;
+  size_t size_;
+  size_t maxSize_;
+  double min_;
+  double max_;
+  std::vector< std::vector<double> > levels_;
+  std::vector<unsigned char> offsets_; // next compaction offset per level
+
+  size_t capacity(const size_t level) const;
+  void grow();
+  void compress();
+  double quantile(WeightedItems& items, const double q) const;
+  void weightedItems(WeightedItems& items) const;
+};
+
+
+void QuantileSketch::add(const double x) {
+  if( x != x ) return;		// NaN
+  levels_.front().push_back(x);
+  ++size_;
+  ++n_;
+  if( x < min_ ) min_ = x;
+  if( x > max_ ) max_ = x;
+  if( size_ >= maxSize_ ) compress();
+}
+
+
+void QuantileSketch::merge(const QuantileSketch& other) {
+  while( levels_.size() < other.levels_.size() ) grow();
+  for(size_t h = 0; h < other.levels_.size(); ++h) {
+    levels_[h].insert(levels_[h].end(),other.levels_[h].begin(),other.levels_[h].end());
+    size_ += other.levels_[h].size();
+  }
+  n_ += other.n_;
+  min_ = std::min(min_,other.min_);
+  max_ = std::max(max_,other.max_);
+  while( size_ >= maxSize_ ) compress();
+}
+
+
+// The capacity decreases geometrically from the top level down
+size_t QuantileSketch::capacity(const size_t level) const {
+  const double depth = levels_.size()-level-1;
+  const size_t cap = static_cast<size_t>(std::ceil(k_*std::pow(2./3.,depth)));
+
+  return std::max(cap,static_cast<size_t>(2));
+}
+
+
+void QuantileSketch::grow() {
+  levels_.push_back(std::vector<double>());
+  offsets_.push_back(0);
+  maxSize_ = 0;
+  for(size_t h = 0; h < levels_.size(); ++h) {
+    maxSize_ += capacity(h);
+  }
+}
+
+
+void QuantileSketch::compress() {
+  for(size_t h = 0; h < levels_.size(); ++h) {
+    if( levels_[h].size() < capacity(h) ) continue;
+    if( h+1 == levels_.size() ) grow();
+
+    // promote one item of each pair; of an odd number of items, the
+    // smallest one stays in this level
+    std::vector<double>& level = levels_[h];
+    std::sort(level.begin(),level.end());
+    const size_t offset = offsets_[h];
+    offsets_[h] = 1-offset;
+    const size_t nPairs = level.size()/2;
+    const bool odd = level.size()%2 == 1;
+    const size_t first = odd ? 1 : 0;
+    for(size_t i = 0; i < nPairs; ++i) {
+      levels_[h+1].push_back(level[first+2*i+offset]);
+    }
+    const double leftover = level.front();
+    size_ -= nPairs;
+    level.clear();
+    if( odd ) level.push_back(leftover);
+    if( size_ < maxSize_ ) break;
+  }
+}
+
+
+void QuantileSketch::weightedItems(WeightedItems& items) const {
+  items.clear();
+  double weight = 1.;
+  for(size_t h = 0; h < levels_.size(); ++h, weight *= 2.) {
+    for(size_t i = 0; i < levels_[h].size(); ++i) {
+      items.push_back(std::make_pair(levels_[h][i],weight));
+    }
+  }
+}
+
+
+double QuantileSketch::quantile(WeightedItems& items, const double q) const {
+  if( items.empty() ) return std::numeric_limits<double>::quiet_NaN();
+  std::sort(items.begin(),items.end());
+  double total = 0.;
+  for(size_t i = 0; i < items.size(); ++i) {
+    total += items[i].second;
+  }
+  double sum = 0.;
+  for(size_t i = 0; i < items.size(); ++i) {
+    sum += items[i].second;
+    if( sum >= q*total ) return items[i].first;
+  }
+
+  return items.back().first;
+}
+
+
+double QuantileSketch::quantile(const double q) const {
+  if( q <= 0. && n_ > 0 ) return min_;
+  if( q >= 1. && n_ > 0 ) return max_;
+  WeightedItems items;
+  weightedItems(items);
+
+  return quantile(items,q);
+}
+
+
+double QuantileSketch::absDeviationQuantile(const double center, const double q) const {
+  WeightedItems items;
+  weightedItems(items);
+  for(size_t i = 0; i < items.size(); ++i) {
+    items[i].first = std::abs(items[i].first-center);
+  }
+
+  return quantile(items,q);
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef RENDER_MANIFEST_H
+#define RENDER_MANIFEST_H
+
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "TString.h"
+#include "TSystem.h"
+
+
+// 64-bit FNV-1a hash of the data, axis ranges and style settings
+// that go into one plot
+class ContentHash {
+public:
+  ContentHash()
+    : hash_(14695981039346656037ULL) {}
+
+  ContentHash& add(const void* data, const size_t nBytes) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < nBytes; ++i) {
+      hash_ ^= bytes[i];
+      hash_ *= 1099511628211ULL;
+    }
+    return *this;
+  }
+  ContentHash& add(const double val) { return add(&val,sizeof(val)); }
+  ContentHash& add(const float val) { return add(&val,sizeof(val)); }
+  ContentHash& add(const int val) { return add(&val,sizeof(val)); }
+  ContentHash& add(const unsigned int val) { return add(&val,sizeof(val)); }
+  ContentHash& add(const TString& str) { return add(str.Data(),str.Length()+1); }
+  ContentHash& add(const char* str) { return add(TString(str)); }
+
+  unsigned long long value() const { return hash_; }
+
+
+private:
+  unsigned long long hash_;
+};
+
+
+// Remembers for each output file the ContentHash of what went into it.
+// Plots whose hash is unchanged and whose output file still exists
+// don't need to be rendered again.
+//
+// The manifest is a text file with one line per output file,
+//   <hash> <output file name>
+// and is written when save() is called or the manifest is destroyed.
+class RenderManifest {
+public:
+  RenderManifest(const TString& fileName);
+  ~RenderManifest();
+
+  bool isUpToDate(const TString& outFileName, const ContentHash& hash) const;
+  void update(const TString& outFileName, const ContentHash& hash);
+  void save();
+
+  unsigned int nSkipped() const { return nSkipped_; }
+  unsigned int nRendered() const { return nRendered_; }
+
+
+private:
+  TString fileName_;
+  std::map<std::string,unsigned long long> hashes_;
+  bool modified_;
+  mutable unsigned int nSkipped_;
+  unsigned int nRendered_;
+};
+
+
+RenderManifest::RenderManifest(const TString& fileName)
+  : fileName_(fileName), modified_(false), nSkipped_(0), nRendered_(0) {
+  std::ifstream file( fileName.Data() );
+  if( !file.is_open() ) return; // first run
+
+  std::string line("");
+  while( std::getline(file,line) ) {
+    const size_t pos = line.find(' ');
+    if( pos == std::string::npos ) continue;
+    hashes_[line.substr(pos+1)] = std::strtoull(line.substr(0,pos).c_str(),0,16);
+  }
+}
+
+
+RenderManifest::~RenderManifest() {
+  try {
+    save();
+  } catch(...) {
+    // error already printed, must not throw from destructor
+  }
+}
+
+
+bool RenderManifest::isUpToDate(const TString& outFileName, const ContentHash& hash) const {
+  std::map<std::string,unsigned long long>::const_iterator it = hashes_.find(outFileName.Data());
+  if( it == hashes_.end() || it->second != hash.value() ) return false;
+  if( gSystem->AccessPathName(outFileName) ) return false; // file does not exist (sic!)
+  ++nSkipped_;
+
+  return true;
+}
+
+
+void RenderManifest::update(const TString& outFileName, const ContentHash& hash) {
+  hashes_[outFileName.Data()] = hash.value();
+  modified_ = true;
+  ++nRendered_;
+}
+
+
+void RenderManifest::save() {
+  if( !modified_ ) return;
+
+  std::ofstream file( fileName_.Data() );
+  if( !file.is_open() ) {
+    std::cerr << "\n\nERROR error opening file '" << fileName_ << "'\n";
+    throw std::exception();
+  }
+  for(std::map<std::string,unsigned long long>::const_iterator it = hashes_.begin();
+      it != hashes_.end(); ++it) {
+    file << std::hex << it->second << std::dec << " " << it->first << "\n";
+  }
+  modified_ = false;
+}
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef STRUCTURE_PARAMETER_PLOT_H
+#define STRUCTURE_PARAMETER_PLOT_H
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#include "TCanvas.h"
+#include "TGraphErrors.h"
+#include "TH1.h"
+#include "TH1D.h"
+#include "TLegend.h"
+#include "TPaveText.h"
+#include "TString.h"
+#include "TStyle.h"
+
+
+// the plot layout: one pad per parameter (x, y, z, alpha, beta, gamma),
+// one bin per structure; values in cm and rad as in millepede.res
+void plotStructureParameters(const std::vector< std::vector<TString> >& detLabels,
+			     const std::vector< std::vector<double> >& vals,
+			     const std::vector< std::vector<double> >& errs,
+			     const TString& label, const bool plotErrors);
+
+// overlay: values [campaign][parameter][structure], NaN if the structure
+// has no such parameter in the campaign
+void plotStructureParameters(const std::vector< std::vector<TString> >& detLabels,
+			     const std::vector< std::vector< std::vector<double> > >& vals,
+			     const std::vector< std::vector< std::vector<double> > >& errs,
+			     const std::vector<TString>& campaignLabels,
+			     const TString& label, const bool plotErrors);
+
+
+void plotStructureParameters(const std::vector< std::vector<TString> >& detLabels,
+			     const std::vector< std::vector<double> >& vals,
+			     const std::vector< std::vector<double> >& errs,
+			     const TString& label, const bool plotErrors) {
+  plotStructureParameters(detLabels,
+			  std::vector< std::vector< std::vector<double> > >(1,vals),
+			  std::vector< std::vector< std::vector<double> > >(1,errs),
+			  std::vector<TString>(),label,plotErrors);
+}
+
+
+void plotStructureParameters(const std::vector< std::vector<TString> >& detLabels,
+			     const std::vector< std::vector< std::vector<double> > >& vals,
+			     const std::vector< std::vector< std::vector<double> > >& errs,
+			     const std::vector<TString>& campaignLabels,
+			     const TString& label, const bool plotErrors) {
+  gStyle->SetErrorX(0);
+
+  //  For the canvas
+  gStyle->SetCanvasBorderMode(0);
+  gStyle->SetCanvasColor(kWhite);
+  gStyle->SetCanvasDefH(800); //Height of canvas
+  gStyle->SetCanvasDefW(800); //Width of canvas
+  gStyle->SetCanvasDefX(0);   //Position on screen
+  gStyle->SetCanvasDefY(0);
+  
+  //  For the frame
+  gStyle->SetFrameBorderMode(0);
+  gStyle->SetFrameBorderSize(1);
+  gStyle->SetFrameFillColor(kBlack);
+  gStyle->SetFrameFillStyle(0);
+  gStyle->SetFrameLineColor(kBlack);
+  gStyle->SetFrameLineStyle(0);
+  gStyle->SetFrameLineWidth(1);
+  
+  //  For the Pad
+  gStyle->SetPadBorderMode(0);
+  gStyle->SetPadColor(kWhite);
+  gStyle->SetPadGridX(false);
+  gStyle->SetPadGridY(false);
+  gStyle->SetGridColor(0);
+  gStyle->SetGridStyle(3);
+  gStyle->SetGridWidth(1);
+  
+  //  Margins
+  gStyle->SetPadTopMargin(0.05);
+  gStyle->SetPadBottomMargin(0.18);
+  gStyle->SetPadLeftMargin(0.19);
+  gStyle->SetPadRightMargin(0.04);
+  
+  //  For the histo:
+  gStyle->SetHistLineColor(kBlack);
+  gStyle->SetHistLineStyle(0);
+  gStyle->SetHistLineWidth(2);
+  gStyle->SetMarkerSize(1.4);
+  gStyle->SetEndErrorSize(4);
+  
+  //  For the Global title:
+  gStyle->SetOptTitle(1);
+  gStyle->SetTitleFont(42,"");
+  gStyle->SetTitleColor(1);
+  gStyle->SetTitleTextColor(1);
+  gStyle->SetTitleFillColor(0);
+  gStyle->SetTitleFontSize(0.1);
+  gStyle->SetTitleAlign(13);
+  gStyle->SetTitleX(0.00);
+  gStyle->SetTitleH(0.05);
+  gStyle->SetTitleBorderSize(0);
+
+  //  For the axis
+  gStyle->SetAxisColor(1,"XYZ");
+  gStyle->SetTickLength(0.03,"XYZ");
+  gStyle->SetNdivisions(510,"XYZ");
+  gStyle->SetPadTickX(1);
+  gStyle->SetPadTickY(1);
+  gStyle->SetStripDecimals(kFALSE);
+    
+  //  For the axis labels and titles
+  gStyle->SetTitleColor(1,"XYZ");
+  gStyle->SetLabelColor(1,"XYZ");
+
+  // For the axis labels:
+  gStyle->SetLabelFont(42,"XYZ");
+  gStyle->SetLabelOffset(0.007,"XYZ");
+  gStyle->SetLabelSize(0.045,"XYZ");
+  
+  // For the axis titles:
+  gStyle->SetTitleFont(42,"XYZ");
+  gStyle->SetTitleSize(0.06,"XYZ");
+  gStyle->SetTitleXOffset(1.2);
+  gStyle->SetTitleYOffset(1.5);
+
+  //  For the legend
+  gStyle->SetLegendBorderSize(0);
+
+  //  For the statistics box
+  gStyle->SetOptStat("");
+
+
+  std::cout << "Creating plots" << std::endl;
+  TCanvas* can = new TCanvas("can","high-level structure alignment",900,600);
+  can->Divide(3,2);
+  const size_t nCampaigns = vals.size();
+  const int markers[8] = { 20, 21, 22, 23, 24, 25, 26, 32 };
+  const int colors[8] = { kBlack, kRed, kBlue, kGreen+2, kMagenta, kOrange+7, kCyan+2, kViolet };
+  TLegend* leg = 0;
+  if( nCampaigns > 1 ) {
+    leg = new TLegend(0.55,0.89-0.05*(nCampaigns+(label != "" ? 1 : 0)),0.93,0.89);
+    leg->SetFillStyle(0);
+    leg->SetTextFont(42);
+    if( label != "" ) leg->SetHeader(label);
+  }
+  for(size_t iPar = 0; iPar < detLabels.size(); ++iPar) {
+    const size_t nAli = detLabels.at(iPar).size();
+    TString name = "hFrame";
+    name += iPar;
+    TString parLabel = "#Deltax [#mum]";
+    if(      iPar == 1 ) parLabel = "#Deltay [#mum]";
+    else if( iPar == 2 ) parLabel = "#Deltaz [#mum]";
+    else if( iPar == 3 ) parLabel = "#Delta#alpha [#murad]";
+    else if( iPar == 4 ) parLabel = "#Delta#beta [#murad]";
+    else if( iPar == 5 ) parLabel = "#Delta#gamma [#murad]";
+
+    TH1* hFrame = new TH1D(name,";detector structure;"+parLabel,nAli,0,nAli);
+    for(int bin = 1; bin <= hFrame->GetNbinsX(); ++bin) {
+      hFrame->GetXaxis()->SetBinLabel(bin,detLabels.at(iPar).at(bin-1));
+      hFrame->SetBinContent(bin,0.);
+    }
+    hFrame->SetLineStyle(2);
+    hFrame->SetLineColor(kBlack);
+    hFrame->SetLineWidth(1);
+    hFrame->GetXaxis()->LabelsOption("v");
+
+    // one graph per campaign, side by side within the bins
+    std::vector<TGraphErrors*> gPars(nCampaigns);
+    double max = 0.;
+    const double scale = iPar<3 ? 1E4 : 1E6;	// millepede.res stores in [cm] and [rad]. Convert here to [mum] and [murad]
+    std::cout << "\nFitted " << parLabel << std::endl;
+    for(size_t c = 0; c < nCampaigns; ++c) {
+      if( nCampaigns > 1 ) std::cout << "  " << campaignLabels.at(c) << std::endl;
+      const double offset = nCampaigns > 1 ? 0.6*(c+0.5)/nCampaigns-0.3 : 0.;
+      gPars[c] = new TGraphErrors();
+      gPars[c]->SetMarkerStyle(markers[c%8]);
+      gPars[c]->SetMarkerColor(colors[c%8]);
+      gPars[c]->SetLineColor(colors[c%8]);
+      gPars[c]->SetMarkerSize(0.8);
+      for(size_t iAli = 0; iAli < nAli; ++iAli) {
+	if( std::isnan(vals.at(c).at(iPar).at(iAli)) ) continue; // structure not in this campaign
+	const double val = scale*vals.at(c).at(iPar).at(iAli);
+	const double err = scale*errs.at(c).at(iPar).at(iAli);
+	printf("%5s: % 10.5f",hFrame->GetXaxis()->GetBinLabel(1+iAli),val);
+	if( plotErrors ) printf(" +/- %8.5f",err);
+	printf("\n");
+	const int point = gPars[c]->GetN();
+	gPars[c]->SetPoint(point,iAli+0.5+offset,val);
+	gPars[c]->SetPointError(point,0.,plotErrors ? err : 0.);
+	if( std::abs(val)+err > max ) max = std::abs(val)+err;
+      }
+      if( iPar == 0 && leg != 0 ) leg->AddEntry(gPars[c],campaignLabels.at(c),"P");
+    }
+    double maxCustom = iPar<3 ? 195. : 1.;
+    if( 1.2*max > maxCustom ) maxCustom = 1.2*max;
+    hFrame->GetYaxis()->SetRangeUser(-maxCustom,maxCustom);
+
+    can->cd(1+iPar);
+    hFrame->Draw("HIST");
+    for(size_t c = 0; c < nCampaigns; ++c) {
+      if( gPars[c]->GetN() > 0 ) gPars[c]->Draw(plotErrors ? "P" : "PX"); // no "A": on the frame's axes
+    }
+
+    if( iPar == 2 && leg != 0 ) {		// draw legend in top-right corner
+      leg->Draw("same");
+    } else if( iPar == 2 && label != "" ) {	// draw label in top-right corner
+      TPaveText* info = new TPaveText(0.55,0.77,0.93,0.89,"NDC");
+      info->SetBorderSize(0);
+      info->SetFillColor(0);
+      info->SetFillStyle(0);
+      info->SetTextFont(42);
+      info->SetTextAlign(22);	// horizontally and vertically centered
+      info->SetMargin(0.);
+      info->AddText(label);
+      info->Draw("same");
+    }
+  }
+
+  TString outFileName = "params.pdf";
+  if( label != "") {
+    outFileName = "params_"+label+".pdf";
+    outFileName.ReplaceAll(" ","");
+  }
+  can->SaveAs(outFileName);
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef UNIX_SOCKET_H
+#define UNIX_SOCKET_H
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// Minimal request/response protocol over a Unix domain socket, for
+// local services that keep data resident in memory.
+//
+// A client connects, sends one request line terminated by '\n' and
+// reads the response until the server closes the connection. The first
+// line of the response is "OK" or "ERROR <message>", followed by the
+// payload. The socket is only accessible by the user who started the
+// server.
+//
+// Requests are answered one at a time, so a client that connects but
+// does not send its request, or does not read the response, would
+// block all others. Receiving and sending hence time out after
+// timeout seconds, and the connection is closed.
+class UnixSocketServer {
+public:
+  UnixSocketServer(const std::string& path, const double timeout = 5.);
+  ~UnixSocketServer();
+
+  // Answers requests one at a time until the handler, called as
+  // bool handle(const std::string& request, std::ostream& response),
+  // returns false. A handler that throws produces an ERROR response.
+  template<class Handler> void serve(Handler& handle);
+
+
+private:
+  const std::string path_;
+  const double timeout_;
+  int fd_;
+
+  // not copyable: owns the socket
+  UnixSocketServer(const UnixSocketServer&);
+  UnixSocketServer& operator=(const UnixSocketServer&);
+};
+
+
+// Sends one request to the server at path and returns its response
+std::string unixSocketQuery(const std::string& path, const std::string& request);
+
+
+namespace unixsocket {
+  sockaddr_un address(const std::string& path) {
+    sockaddr_un addr;
+    std::memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if( path.size() >= sizeof(addr.sun_path) ) {
+      std::cerr << "\n\nERROR socket path '" << path << "' too long\n" << std::endl;
+      throw std::exception();
+    }
+    std::strncpy(addr.sun_path,path.c_str(),sizeof(addr.sun_path)-1);
+
+    return addr;
+  }
+
+  bool sendAll(const int fd, const std::string& data) {
+    size_t pos = 0;
+    while( pos < data.size() ) {
+      const ssize_t n = send(fd,data.data()+pos,data.size()-pos,MSG_NOSIGNAL);
+      if( n < 0 ) {
+	if( errno == EINTR ) continue;
+	return false;
+      }
+      pos += n;
+    }
+    return true;
+  }
+
+  // reads until '\n' (request) or until the peer closes (response)
+  bool receive(const int fd, std::string& data, const bool untilNewline, const size_t maxSize) {
+    data.clear();
+    char buffer[4096];
+    while( data.size() < maxSize ) {
+      const ssize_t n = recv(fd,buffer,sizeof(buffer),0);
+      if( n < 0 ) {
+	if( errno == EINTR ) continue;
+	return false;
+      }
+      if( n == 0 ) break;
+      data.append(buffer,n);
+      if( untilNewline && data.find('\n') != std::string::npos ) break;
+    }
+    if( untilNewline ) {
+      const size_t end = data.find('\n');
+      if( end == std::string::npos ) return false;
+      data.erase(end);
+    }
+    return true;
+  }
+}
+
+
+UnixSocketServer::UnixSocketServer(const std::string& path, const double timeout)
+  : path_(path), timeout_(timeout), fd_(-1) {
+  const sockaddr_un addr = unixsocket::address(path);
+
+  // remove a socket left over by a previous server, but nothing else
+  struct stat st;
+  if( lstat(path.c_str(),&st) == 0 ) {
+    if( !S_ISSOCK(st.st_mode) ) {
+      std::cerr << "\n\nERROR '" << path << "' exists and is not a socket\n" << std::endl;
+      throw std::exception();
+    }
+    unlink(path.c_str());
+  }
+
+  fd_ = socket(AF_UNIX,SOCK_STREAM,0);
+  if( fd_ < 0 ) {
+    std::cerr << "\n\nERROR creating socket: " << std::strerror(errno) << "\n" << std::endl;
+    throw std::exception();
+  }
+  const mode_t oldMask = umask(0077);
+  const int status = bind(fd_,reinterpret_cast<const sockaddr*>(&addr),sizeof(addr));
+  umask(oldMask);
+  if( status < 0 || listen(fd_,16) < 0 ) {
+    std::cerr << "\n\nERROR listening on socket '" << path << "': " << std::strerror(errno) << "\n" << std::endl;
+    close(fd_);
+    throw std::exception();
+  }
+}
+
+
+UnixSocketServer::~UnixSocketServer() {
+  close(fd_);
+  unlink(path_.c_str());
+}
+
+
+template<class Handler>
+void UnixSocketServer::serve(Handler& handle) {
+  bool running = true;
+  while( running ) {
+    const int client = accept(fd_,0,0);
+    if( client < 0 ) {
+      if( errno == EINTR ) continue;
+      std::cerr << "\n\nERROR accepting connection: " << std::strerror(errno) << "\n" << std::endl;
+      throw std::exception();
+    }
+    timeval tv;
+    tv.tv_sec = static_cast<time_t>(timeout_);
+    tv.tv_usec = static_cast<suseconds_t>(1E6*(timeout_-tv.tv_sec));
+    setsockopt(client,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+    setsockopt(client,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+
+    std::string request;
+    std::ostringstream response;
+    errno = 0;
+    if( !unixsocket::receive(client,request,true,65536) ) {
+      if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+	std::cerr << "\n\nERROR no request within " << timeout_ << " s, closing connection\n" << std::endl;
+	close(client);
+	continue;
+      }
+      response << "ERROR malformed request\n";
+    } else {
+      try {
+	running = handle(request,response);
+      } catch(...) {
+	response.str("");
+	response << "ERROR request '" << request << "' failed\n";
+      }
+    }
+    unixsocket::sendAll(client,response.str());
+    close(client);
+  }
+}
+
+
+std::string unixSocketQuery(const std::string& path, const std::string& request) {
+  const sockaddr_un addr = unixsocket::address(path);
+  const int fd = socket(AF_UNIX,SOCK_STREAM,0);
+  if( fd < 0 || connect(fd,reinterpret_cast<const sockaddr*>(&addr),sizeof(addr)) < 0 ) {
+    std::cerr << "\n\nERROR connecting to '" << path << "': " << std::strerror(errno) << "\n" << std::endl;
+    if( fd >= 0 ) close(fd);
+    throw std::exception();
+  }
+
+  std::string response;
+  const bool ok = unixsocket::sendAll(fd,request+"\n") && unixsocket::receive(fd,response,false,1u << 30);
+  close(fd);
+  if( !ok ) {
+    std::cerr << "\n\nERROR communicating with '" << path << "'\n" << std::endl;
+    throw std::exception();
+  }
+
+  return response;
+}
+
+#endif
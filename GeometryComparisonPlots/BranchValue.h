@@ -0,0 +1,89 @@
+#ifndef BRANCH_VALUE_H
+#define BRANCH_VALUE_H
+
+#include <exception>
+#include <iostream>
+
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TString.h"
+#include "TTree.h"
+
+
+// Value of one branch of the alignTree, read into a buffer of the type
+// of its leaf -- e.g. int for id, level, useDetId or detDim, float for
+// the positions -- and converted to double, which holds all of them
+// exactly, e.g. the DetIds.
+//
+// The branch address points into the object, so it must not be moved
+// or copied once bound, e.g. a std::vector<BranchValue> must be sized
+// before binding its elements.
+class BranchValue {
+public:
+  BranchValue()
+    : type_(FloatLeaf) { buffer_.d = 0.; }
+
+  // Sets the branch address; also enables the branch
+  void bind(TTree* tree, const TString& name);
+  void bind(TBranch* branch);
+
+  double value() const;
+
+
+private:
+  enum LeafType { FloatLeaf, DoubleLeaf, IntLeaf, UIntLeaf, ShortLeaf, UShortLeaf, BoolLeaf };
+
+  LeafType type_;
+  union {
+    Float_t f;
+    Double_t d;
+    Int_t i;
+    UInt_t u;
+    Short_t s;
+    UShort_t us;
+    Bool_t b;
+  } buffer_;
+};
+
+
+void BranchValue::bind(TTree* tree, const TString& name) {
+  TBranch* branch = tree->GetBranch(name);
+  if( branch == NULL ) {
+    std::cerr << "\n\nERROR no variable '" << name << "' in tree" << std::endl;
+    throw std::exception();
+  }
+  tree->SetBranchStatus(name,true);
+  bind(branch);
+}
+
+
+void BranchValue::bind(TBranch* branch) {
+  TLeaf* leaf = branch->GetLeaf(branch->GetName());
+  const TString typeName = leaf != NULL ? leaf->GetTypeName() : "";
+  if(      typeName == "Float_t"  ) type_ = FloatLeaf;
+  else if( typeName == "Double_t" ) type_ = DoubleLeaf;
+  else if( typeName == "Int_t"    ) type_ = IntLeaf;
+  else if( typeName == "UInt_t"   ) type_ = UIntLeaf;
+  else if( typeName == "Short_t"  ) type_ = ShortLeaf;
+  else if( typeName == "UShort_t" ) type_ = UShortLeaf;
+  else if( typeName == "Bool_t"   ) type_ = BoolLeaf;
+  else {
+    std::cerr << "\n\nERROR variable '" << branch->GetName() << "' has unsupported type '" << typeName << "'" << std::endl;
+    throw std::exception();
+  }
+  buffer_.d = 0.;
+  branch->SetAddress(&buffer_);
+}
+
+
+double BranchValue::value() const {
+  if( type_ == FloatLeaf  ) return buffer_.f;
+  if( type_ == DoubleLeaf ) return buffer_.d;
+  if( type_ == IntLeaf    ) return buffer_.i;
+  if( type_ == UIntLeaf   ) return buffer_.u;
+  if( type_ == ShortLeaf  ) return buffer_.s;
+  if( type_ == UShortLeaf ) return buffer_.us;
+  return buffer_.b;
+}
+
+#endif
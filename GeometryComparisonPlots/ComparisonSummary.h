@@ -0,0 +1,145 @@
+#ifndef COMPARISON_SUMMARY_H
+#define COMPARISON_SUMMARY_H
+
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "TString.h"
+
+#include "../Common/QuantileSketch.h"
+
+
+// Robust statistics of the module displacements per sub-detector and
+// per layer, as needed for the validation tables: median, MAD and the
+// 1%, 5%, 95% and 99% quantiles of dr, dz, r*dphi, dx and dy in mum.
+//
+// The distributions are kept in QuantileSketches, hence summaries
+// filled from different chunks of the alignTree or from different
+// files can be merged.
+class ComparisonSummary {
+public:
+  enum Quantity { DR=0, DZ, RDPHI, DX, DY, NQuantities };
+
+  ComparisonSummary() {}
+
+  // subDet as sublevel in alignTree (1-6), layer < 0 for the whole sub-detector
+  void add(const int subDet, const int layer,
+	   const double r, const double dr, const double dz, const double dphi, const double dx, const double dy);
+  void merge(const ComparisonSummary& other);
+
+  void print(std::ostream& out, const TString& id, const bool printHeader = true) const;
+  void write(const TString& fileName, const TString& id) const;
+
+  static TString toStr(const Quantity q);
+  static TString subDetLabel(const int subDet);
+
+
+private:
+  typedef std::pair<int,int> Group; // (subDet,layer)
+
+  struct GroupStats {
+    GroupStats()
+      : sketches(NQuantities) {}
+
+    std::vector<QuantileSketch> sketches;
+  };
+
+  std::map<Group,GroupStats> groups_;
+
+  void fill(GroupStats& stats, const double r, const double dr, const double dz, const double dphi, const double dx, const double dy);
+};
+
+
+void ComparisonSummary::add(const int subDet, const int layer,
+			    const double r, const double dr, const double dz, const double dphi, const double dx, const double dy) {
+  fill(groups_[Group(subDet,-1)],r,dr,dz,dphi,dx,dy);
+  if( layer >= 0 ) fill(groups_[Group(subDet,layer)],r,dr,dz,dphi,dx,dy);
+}
+
+
+// tree values in cm and rad
+void ComparisonSummary::fill(GroupStats& stats, const double r, const double dr, const double dz, const double dphi, const double dx, const double dy) {
+  const double scale = 1E4;	// in mum
+  stats.sketches[DR].add(scale*dr);
+  stats.sketches[DZ].add(scale*dz);
+  stats.sketches[RDPHI].add(scale*r*dphi);
+  stats.sketches[DX].add(scale*dx);
+  stats.sketches[DY].add(scale*dy);
+}
+
+
+void ComparisonSummary::merge(const ComparisonSummary& other) {
+  for(std::map<Group,GroupStats>::const_iterator it = other.groups_.begin();
+      it != other.groups_.end(); ++it) {
+    GroupStats& stats = groups_[it->first];
+    for(int q = 0; q < NQuantities; ++q) {
+      stats.sketches[q].merge(it->second.sketches[q]);
+    }
+  }
+}
+
+
+// One line per sub-detector or layer and quantity
+void ComparisonSummary::print(std::ostream& out, const TString& id, const bool printHeader) const {
+  char txt[200];
+  if( printHeader ) {
+    snprintf(txt,200,"# %-12s %-4s %5s %-6s %8s %10s %10s %10s %10s %10s %10s",
+	     "id","det","layer","var","modules","median","MAD","q01","q05","q95","q99");
+    out << txt << std::endl;
+  }
+  for(std::map<Group,GroupStats>::const_iterator it = groups_.begin();
+      it != groups_.end(); ++it) {
+    TString layer("all");
+    if( it->first.second >= 0 ) {
+      layer = "";
+      layer += it->first.second;
+    }
+    for(int q = 0; q < NQuantities; ++q) {
+      const QuantileSketch& sketch = it->second.sketches[q];
+      const double median = sketch.quantile(0.5);
+      snprintf(txt,200,"  %-12s %-4s %5s %-6s %8llu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f",
+	       id.Data(),subDetLabel(it->first.first).Data(),layer.Data(),toStr(static_cast<Quantity>(q)).Data(),
+	       sketch.count(),median,sketch.absDeviationQuantile(median,0.5),
+	       sketch.quantile(0.01),sketch.quantile(0.05),sketch.quantile(0.95),sketch.quantile(0.99));
+      out << txt << std::endl;
+    }
+  }
+}
+
+
+void ComparisonSummary::write(const TString& fileName, const TString& id) const {
+  std::ofstream file( fileName.Data() );
+  if( !file.is_open() ) {
+    std::cerr << "\n\nERROR error opening file '" << fileName << "'\n";
+    throw std::exception();
+  }
+  print(file,id);
+}
+
+
+TString ComparisonSummary::toStr(const Quantity q) {
+  if( q == DR    ) return "dr";
+  if( q == DZ    ) return "dz";
+  if( q == RDPHI ) return "rdphi";
+  if( q == DX    ) return "dx";
+  if( q == DY    ) return "dy";
+  return "";
+}
+
+
+TString ComparisonSummary::subDetLabel(const int subDet) {
+  if( subDet == 1 ) return "PXB";
+  if( subDet == 2 ) return "PXF";
+  if( subDet == 3 ) return "TIB";
+  if( subDet == 4 ) return "TID";
+  if( subDet == 5 ) return "TOB";
+  if( subDet == 6 ) return "TEC";
+  return "UNKNOWN";
+}
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef CUT_H
+#define CUT_H
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include "TString.h"
+
+
+// Selection cut on alignTree variables, e.g. "r < 20 && abs(z) < 30"
+//
+// Recognises comparisons
+//   <var> <op> <number>  or  <func>(<var>) <op> <number>
+// with op one of <, <=, >, >=, ==, != and func one of abs, cos, sin,
+// combined with && and || and grouped with parentheses. As usual, &&
+// binds stronger than ||. The values are compared in the units of the
+// alignTree, i.e. cm and rad, not in the units of the plots. The
+// values are compared as double, so that cuts on the DetIds, e.g.
+// "id == 302055684", are exact.
+//
+// The cut is evaluated column-wise, for all entries at once.
+class Cut {
+public:
+  Cut(const TString &expr);
+
+  TString expression() const { return expr_; }
+  TString screenLabel() const;
+
+  size_t nTreeVariables() const { return treeVariables_.size(); }
+  TString treeVariable(unsigned int i) const { return treeVariables_.at(i); }
+
+  // columns[i] holds the values of treeVariable(i); the mask is
+  // set to 1 for the entries passing the cut and to 0 otherwise
+  void eval(const std::vector<const std::vector<double>*> &columns, std::vector<unsigned char> &mask) const;
+
+
+private:
+  enum NodeType { And, Or, Comparison };
+  enum Operator { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+
+  struct Node {
+    NodeType type;
+    int left;			// And, Or
+    int right;
+    unsigned int var;		// Comparison
+    TString func;
+    Operator op;
+    double value;
+  };
+
+  TString expr_;
+  std::vector<TString> treeVariables_;
+  std::vector<Node> nodes_;
+  int root_;
+
+  int parseOr(const TString &str, int &pos);
+  int parseAnd(const TString &str, int &pos);
+  int parsePrimary(const TString &str, int &pos);
+  int parseComparison(const TString &str, int &pos);
+  TString parseName(const TString &str, int &pos) const;
+  unsigned int variableIndex(const TString &name);
+  void error(const TString &str, const int pos) const;
+
+  void eval(const int node, const std::vector<const std::vector<double>*> &columns, std::vector<unsigned char> &mask) const;
+};
+
+
+Cut::Cut(const TString &expr)
+  : expr_(expr) {
+  TString str(expr);
+  str.ReplaceAll(" ","");
+  int pos = 0;
+  root_ = parseOr(str,pos);
+  if( pos != str.Length() ) error(str,pos);
+}
+
+
+// usable in file names
+TString Cut::screenLabel() const {
+  TString label(expr_);
+  label.ReplaceAll(" ","");
+  label.ReplaceAll("&&","_and_");
+  label.ReplaceAll("||","_or_");
+  label.ReplaceAll("<=","le");
+  label.ReplaceAll(">=","ge");
+  label.ReplaceAll("==","eq");
+  label.ReplaceAll("!=","ne");
+  label.ReplaceAll("<","lt");
+  label.ReplaceAll(">","gt");
+  label.ReplaceAll("(","");
+  label.ReplaceAll(")","");
+  label.ReplaceAll("-","m");
+  label.ReplaceAll(".","p");
+
+  return label;
+}
+
+
+void Cut::error(const TString &str, const int pos) const {
+  std::cerr << "\n\nERROR in Cut: unrecognised expression '" << expr_ << "' at '" << str(pos,str.Length()-pos) << "'" << std::endl;
+  throw std::exception();
+}
+
+
+int Cut::parseOr(const TString &str, int &pos) {
+  int left = parseAnd(str,pos);
+  while( pos+1 < str.Length() && str[pos] == '|' && str[pos+1] == '|' ) {
+    pos += 2;
+    Node node;
+    node.type = Or;
+    node.left = left;
+    node.right = parseAnd(str,pos);
+    nodes_.push_back(node);
+    left = nodes_.size()-1;
+  }
+
+  return left;
+}
+
+
+int Cut::parseAnd(const TString &str, int &pos) {
+  int left = parsePrimary(str,pos);
+  while( pos+1 < str.Length() && str[pos] == '&' && str[pos+1] == '&' ) {
+    pos += 2;
+    Node node;
+    node.type = And;
+    node.left = left;
+    node.right = parsePrimary(str,pos);
+    nodes_.push_back(node);
+    left = nodes_.size()-1;
+  }
+
+  return left;
+}
+
+
+int Cut::parsePrimary(const TString &str, int &pos) {
+  if( pos < str.Length() && str[pos] == '(' ) {
+    ++pos;
+    const int node = parseOr(str,pos);
+    if( pos >= str.Length() || str[pos] != ')' ) error(str,pos);
+    ++pos;
+    return node;
+  }
+
+  return parseComparison(str,pos);
+}
+
+
+TString Cut::parseName(const TString &str, int &pos) const {
+  const int start = pos;
+  while( pos < str.Length() && ( isalnum(str[pos]) || str[pos] == '_' ) ) ++pos;
+  if( pos == start ) error(str,start);
+
+  return str(start,pos-start);
+}
+
+
+int Cut::parseComparison(const TString &str, int &pos) {
+  Node node;
+  node.type = Comparison;
+  node.left = -1;
+  node.right = -1;
+  node.func = "";
+
+  // operand
+  TString name = parseName(str,pos);
+  if( pos < str.Length() && str[pos] == '(' ) {
+    if( name != "abs" && name != "cos" && name != "sin" ) error(str,pos-name.Length());
+    node.func = name;
+    ++pos;
+    name = parseName(str,pos);
+    if( pos >= str.Length() || str[pos] != ')' ) error(str,pos);
+    ++pos;
+  }
+  node.var = variableIndex(name);
+
+  // operator
+  const TString op2 = pos+1 < str.Length() ? TString(str(pos,2)) : TString("");
+  if(      op2 == "<=" ) node.op = LessEqual;
+  else if( op2 == ">=" ) node.op = GreaterEqual;
+  else if( op2 == "==" ) node.op = Equal;
+  else if( op2 == "!=" ) node.op = NotEqual;
+  else if( pos < str.Length() && str[pos] == '<' ) node.op = Less;
+  else if( pos < str.Length() && str[pos] == '>' ) node.op = Greater;
+  else error(str,pos);
+  pos += ( node.op == Less || node.op == Greater ) ? 1 : 2;
+
+  // number
+  const char* begin = str.Data()+pos;
+  char* end = 0;
+  node.value = std::strtod(begin,&end);
+  if( end == begin ) error(str,pos);
+  pos += end-begin;
+
+  nodes_.push_back(node);
+
+  return nodes_.size()-1;
+}
+
+
+unsigned int Cut::variableIndex(const TString &name) {
+  for(unsigned int i = 0; i < treeVariables_.size(); ++i) {
+    if( treeVariables_[i] == name ) return i;
+  }
+  treeVariables_.push_back(name);
+
+  return treeVariables_.size()-1;
+}
+
+
+void Cut::eval(const std::vector<const std::vector<double>*> &columns, std::vector<unsigned char> &mask) const {
+  if( columns.size() != treeVariables_.size() ) {
+    std::cerr << "\n\nERROR in Cut::eval(): wrong number of columns given" << std::endl;
+    throw std::exception();
+  }
+  eval(root_,columns,mask);
+}
+
+
+// Each comparison is one loop over the entries without branches
+void Cut::eval(const int n, const std::vector<const std::vector<double>*> &columns, std::vector<unsigned char> &mask) const {
+  const Node& node = nodes_.at(n);
+  if( node.type == And || node.type == Or ) {
+    std::vector<unsigned char> right;
+    eval(node.left,columns,mask);
+    eval(node.right,columns,right);
+    if( node.type == And ) {
+      for(size_t i = 0; i < mask.size(); ++i) mask[i] &= right[i];
+    } else {
+      for(size_t i = 0; i < mask.size(); ++i) mask[i] |= right[i];
+    }
+    return;
+  }
+
+  const std::vector<double>& col = *(columns.at(node.var));
+  std::vector<double> x(col);
+  if(      node.func == "abs" ) for(size_t i = 0; i < x.size(); ++i) x[i] = std::abs(x[i]);
+  else if( node.func == "cos" ) for(size_t i = 0; i < x.size(); ++i) x[i] = std::cos(x[i]);
+  else if( node.func == "sin" ) for(size_t i = 0; i < x.size(); ++i) x[i] = std::sin(x[i]);
+
+  mask.resize(x.size());
+  const double v = node.value;
+  if(      node.op == Less         ) for(size_t i = 0; i < x.size(); ++i) mask[i] = x[i] <  v;
+  else if( node.op == LessEqual    ) for(size_t i = 0; i < x.size(); ++i) mask[i] = x[i] <= v;
+  else if( node.op == Greater      ) for(size_t i = 0; i < x.size(); ++i) mask[i] = x[i] >  v;
+  else if( node.op == GreaterEqual ) for(size_t i = 0; i < x.size(); ++i) mask[i] = x[i] >= v;
+  else if( node.op == Equal        ) for(size_t i = 0; i < x.size(); ++i) mask[i] = x[i] == v;
+  else if( node.op == NotEqual     ) for(size_t i = 0; i < x.size(); ++i) mask[i] = x[i] != v;
+}
+
+#endif
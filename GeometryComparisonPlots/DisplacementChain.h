@@ -0,0 +1,329 @@
+#ifndef DISPLACEMENT_CHAIN_H
+#define DISPLACEMENT_CHAIN_H
+
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "TFile.h"
+#include "TString.h"
+#include "TTree.h"
+
+#include "InputLists.h"
+
+
+// Cumulative module displacements along a chain of geometry
+// comparisons, e.g. mp1509 vs start -> mp1510 vs mp1509 -> ...
+//
+// Each comparison (step) is read in one scan of its alignTree. The
+// DetUnits of all steps share one dense id -> slot map, and for each
+// step and quantity one column with one value per slot is kept, so the
+// memory is modules x columns. Modules missing in a step have NaN
+// there, and hence also in the cumulative displacement.
+//
+// The steps have to be added in chronological order. A module does not
+// converge if its last step is larger than the tolerance and not smaller
+// than ratio times the step before, where the step size is the length
+// of (dx,dy,dz). E.g. for the 2012 legacy alignment:
+//   DisplacementChain chain;
+//   chain.addStep(path+"mp1509_vs_start.root","mp1509_vs_start");
+//   chain.addStep(path+"mp1510_vs_mp1509.root","mp1510_vs_mp1509");
+//   chain.addStep(path+"mp1511_vs_mp1510.root","mp1511_vs_mp1510");
+//   chain.addStep(path+"mp1535_vs_mp1511.root","mp1535_vs_mp1511");
+//   chain.write("chain.txt");
+//   std::cout << chain.nModules(DisplacementChain::NotConverging) << " of "
+//             << chain.nModules() << " modules not converging" << std::endl;
+class DisplacementChain {
+public:
+  enum Quantity { DR=0, DZ, RDPHI, DX, DY, NQuantities };
+  enum Status { Converged=0, NotConverging, Incomplete };
+
+  DisplacementChain()
+    : tolerance_(1E-4), ratio_(1.), computed_(false) {}
+
+  void excludeModules(const TString& fileName);
+
+  // tolerance in cm
+  void setConvergence(const double tolerance, const double ratio) {
+    tolerance_ = tolerance;
+    ratio_ = ratio;
+    computed_ = false;
+  }
+
+  void addStep(const TString& fileName, const TString& id);
+
+  unsigned int nSteps() const { return stepIds_.size(); }
+  size_t nModules() const { return ids_.size(); }
+  const TString& stepId(const unsigned int step) const { return stepIds_.at(step); }
+  int id(const size_t slot) const { return ids_.at(slot); }
+  int sublevel(const size_t slot) const { return sublevels_.at(slot); }
+
+  // in cm, as in the alignTree
+  float step(const unsigned int step, const Quantity q, const size_t slot) const { return column(step,q).at(slot); }
+  float cumulative(const Quantity q, const size_t slot) const;
+  Status status(const size_t slot) const;
+  size_t nModules(const Status status) const;
+
+  // One line per module with the cumulative displacement and the
+  // step sizes, in mum
+  void print(std::ostream& out, const bool onlyNotConverging = false) const;
+  void write(const TString& fileName, const bool onlyNotConverging = false) const;
+
+  static TString toStr(const Quantity q);
+  static TString toStr(const Status status);
+
+
+private:
+  typedef std::vector<float> Column; // [slot]
+
+  double tolerance_;
+  double ratio_;
+  std::set<int> exclAlignables_;
+
+  std::vector<TString> stepIds_;
+  std::unordered_map<int,size_t> slots_; // id -> slot
+  std::vector<int> ids_;		    // [slot]
+  std::vector<int> sublevels_;	    // [slot]
+  std::vector<Column> columns_;	    // [step*NQuantities+q]
+
+  // derived
+  mutable bool computed_;
+  mutable std::vector<Column> cumulative_; // [q]
+  mutable std::vector<Column> stepSizes_;  // [step]
+  mutable std::vector<unsigned char> status_;
+
+  Column& column(const unsigned int step, const int q) { return columns_.at(step*NQuantities+q); }
+  const Column& column(const unsigned int step, const int q) const { return columns_.at(step*NQuantities+q); }
+  size_t slot(const int id, const int sublevel);
+  void compute() const;
+};
+
+
+void DisplacementChain::excludeModules(const TString& fileName) {
+  exclAlignables_ = readExcludedModules(fileName);
+}
+
+
+// New modules get the next slot; all columns grow with NaN
+size_t DisplacementChain::slot(const int id, const int sublevel) {
+  std::unordered_map<int,size_t>::const_iterator it = slots_.find(id);
+  if( it != slots_.end() ) return it->second;
+
+  const size_t s = ids_.size();
+  slots_[id] = s;
+  ids_.push_back(id);
+  sublevels_.push_back(sublevel);
+  for(size_t c = 0; c < columns_.size(); ++c) {
+    columns_[c].push_back(std::numeric_limits<float>::quiet_NaN());
+  }
+
+  return s;
+}
+
+
+void DisplacementChain::addStep(const TString& fileName, const TString& id) {
+  int detId = 0;
+  int level = 0;
+  int sublevel = 0;
+  float r = 0.;
+  float vals[NQuantities] = { 0., 0., 0., 0., 0. }; // dphi instead of r*dphi
+
+  TFile file(fileName,"READ");
+  TTree* tree = NULL;
+  file.GetObject("alignTree",tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading tree from file '" << fileName << "'" << std::endl;
+    throw std::exception();
+  }
+
+  // read only the branches needed
+  tree->SetBranchStatus("*",false);
+  const char* branches[9] = { "id", "level", "sublevel", "r", "dr", "dz", "dphi", "dx", "dy" };
+  for(int i = 0; i < 9; ++i) {
+    tree->SetBranchStatus(branches[i],true);
+  }
+  tree->SetBranchAddress("id",&detId);
+  tree->SetBranchAddress("level",&level);
+  tree->SetBranchAddress("sublevel",&sublevel);
+  tree->SetBranchAddress("r",&r);
+  tree->SetBranchAddress("dr",&vals[DR]);
+  tree->SetBranchAddress("dz",&vals[DZ]);
+  tree->SetBranchAddress("dphi",&vals[RDPHI]);
+  tree->SetBranchAddress("dx",&vals[DX]);
+  tree->SetBranchAddress("dy",&vals[DY]);
+
+  const unsigned int step = stepIds_.size();
+  stepIds_.push_back(id);
+  for(int q = 0; q < NQuantities; ++q) {
+    columns_.push_back(Column(ids_.size(),std::numeric_limits<float>::quiet_NaN()));
+  }
+
+  const Long64_t nEntries = tree->GetEntries();
+  for(Long64_t i = 0; i < nEntries; ++i) {
+    tree->GetEntry(i);
+    if( level != 1 ) continue;
+    if( sublevel < 1 || sublevel > 6 ) continue;
+    if( exclAlignables_.find( detId ) != exclAlignables_.end() ) continue;
+
+    const size_t s = slot(detId,sublevel);
+    for(int q = 0; q < NQuantities; ++q) {
+      column(step,q)[s] = vals[q];
+    }
+    column(step,RDPHI)[s] *= r;
+  }
+
+  delete tree;
+  file.Close();
+  computed_ = false;
+}
+
+
+// Sums and step sizes are computed column by column, the
+// loops over the slots have no branches
+void DisplacementChain::compute() const {
+  if( computed_ ) return;
+
+  const size_t n = ids_.size();
+  cumulative_.assign(NQuantities,Column(n,0.));
+  for(unsigned int step = 0; step < nSteps(); ++step) {
+    for(int q = 0; q < NQuantities; ++q) {
+      const float* d = column(step,q).data();
+      float* sum = cumulative_[q].data();
+      for(size_t i = 0; i < n; ++i) {
+	sum[i] += d[i];
+      }
+    }
+  }
+
+  stepSizes_.assign(nSteps(),Column(n,0.));
+  for(unsigned int step = 0; step < nSteps(); ++step) {
+    const float* dx = column(step,DX).data();
+    const float* dy = column(step,DY).data();
+    const float* dz = column(step,DZ).data();
+    float* size = stepSizes_[step].data();
+    for(size_t i = 0; i < n; ++i) {
+      size[i] = std::sqrt(dx[i]*dx[i] + dy[i]*dy[i] + dz[i]*dz[i]);
+    }
+  }
+
+  // NaN compares false, hence missing steps need the explicit check
+  status_.assign(n,Converged);
+  if( nSteps() > 0 ) {
+    const float* last = stepSizes_.back().data();
+    const float* prev = nSteps() > 1 ? stepSizes_[nSteps()-2].data() : 0;
+    const float tolerance = tolerance_;
+    const float ratio = ratio_;
+    for(size_t i = 0; i < n; ++i) {
+      const bool large = last[i] > tolerance && ( prev == 0 || last[i] >= ratio*prev[i] );
+      status_[i] = large ? NotConverging : Converged;
+    }
+    for(size_t i = 0; i < n; ++i) {
+      for(int q = 0; q < NQuantities; ++q) {
+	if( std::isnan(cumulative_[q][i]) ) status_[i] = Incomplete;
+      }
+    }
+  }
+
+  computed_ = true;
+}
+
+
+float DisplacementChain::cumulative(const Quantity q, const size_t slot) const {
+  compute();
+  return cumulative_.at(q).at(slot);
+}
+
+
+DisplacementChain::Status DisplacementChain::status(const size_t slot) const {
+  compute();
+  return static_cast<Status>(status_.at(slot));
+}
+
+
+size_t DisplacementChain::nModules(const Status status) const {
+  compute();
+  size_t n = 0;
+  for(size_t i = 0; i < status_.size(); ++i) {
+    if( status_[i] == status ) ++n;
+  }
+
+  return n;
+}
+
+
+void DisplacementChain::print(std::ostream& out, const bool onlyNotConverging) const {
+  compute();
+  const double scale = 1E4;	// in mum
+
+  out << "# steps:";
+  for(unsigned int step = 0; step < nSteps(); ++step) {
+    out << " " << stepIds_[step];
+  }
+  out << "\n# " << nModules() << " modules, " << nModules(NotConverging) << " not converging, "
+      << nModules(Incomplete) << " incomplete" << std::endl;
+
+  char txt[100];
+  out << "# id         sublevel";
+  for(int q = 0; q < NQuantities; ++q) {
+    snprintf(txt,100," %10s",("sum_"+toStr(static_cast<Quantity>(q))).Data());
+    out << txt;
+  }
+  for(unsigned int step = 0; step < nSteps(); ++step) {
+    snprintf(txt,100," %10s",TString::Format("step%u",step).Data());
+    out << txt;
+  }
+  out << " status" << std::endl;
+
+  for(size_t i = 0; i < nModules(); ++i) {
+    if( onlyNotConverging && status_[i] != NotConverging ) continue;
+    snprintf(txt,100,"  %-10d %8d",ids_[i],sublevels_[i]);
+    out << txt;
+    for(int q = 0; q < NQuantities; ++q) {
+      snprintf(txt,100," %10.2f",scale*cumulative_[q][i]);
+      out << txt;
+    }
+    for(unsigned int step = 0; step < nSteps(); ++step) {
+      snprintf(txt,100," %10.2f",scale*stepSizes_[step][i]);
+      out << txt;
+    }
+    out << " " << toStr(static_cast<Status>(status_[i])) << "\n";
+  }
+  out << std::flush;
+}
+
+
+void DisplacementChain::write(const TString& fileName, const bool onlyNotConverging) const {
+  std::ofstream file( fileName.Data() );
+  if( !file.is_open() ) {
+    std::cerr << "\n\nERROR error opening file '" << fileName << "'\n";
+    throw std::exception();
+  }
+  print(file,onlyNotConverging);
+}
+
+
+TString DisplacementChain::toStr(const Quantity q) {
+  if( q == DR    ) return "dr";
+  if( q == DZ    ) return "dz";
+  if( q == RDPHI ) return "rdphi";
+  if( q == DX    ) return "dx";
+  if( q == DY    ) return "dy";
+  return "";
+}
+
+
+TString DisplacementChain::toStr(const Status status) {
+  if( status == Converged     ) return "converged";
+  if( status == NotConverging ) return "not_converging";
+  if( status == Incomplete    ) return "incomplete";
+  return "UNKNOWN";
+}
+
+#endif
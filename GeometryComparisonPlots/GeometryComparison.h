@@ -2,12 +2,14 @@
 #define GEOMETRY_COMPARISON_H
 
 #include <algorithm>
+#include <cmath>
 #include <exception>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "TCanvas.h"
@@ -16,10 +18,24 @@
 #include "TGraph.h"
 #include "TH1.h"
 #include "TH1D.h"
+#include "TPaveText.h"
+#include "TROOT.h"
+#include "TStopwatch.h"
 #include "TString.h"
 #include "TTree.h"
 
+#include "BranchValue.h"
+#include "ComparisonSummary.h"
+#include "Cut.h"
+#include "InputLists.h"
+#include "ModuleGrid.h"
+#include "RigidBodyFit.h"
 #include "Variable.h"
+#include "WeakModes.h"
+#include "../CalibrationParameterPlots/Detector.h"
+#include "../Common/PlotBundle.h"
+#include "../Common/PrefetchPipeline.h"
+#include "../Common/RenderManifest.h"
 
 
 class GeometryComparison {
@@ -28,20 +44,113 @@ public:
 
   void excludeModules(const TString& fileName);
 
+  // Only plots whose content changed since the manifest was
+  // written are rendered again. The manifest is not owned.
+  void setRenderManifest(RenderManifest* manifest) { manifest_ = manifest; }
+
+  // Print all plots into the bundle instead of one file per plot. The
+  // manifest is then ignored. The bundle is not owned, e.g.
+  //   PlotBundle bundle("Misalign_DetUnits_100mu");
+  //   gc.setPlotBundle(&bundle);
+  //   gc.draw("dr:r",-500.,500.);
+  //   bundle.close();
+  void setPlotBundle(PlotBundle* bundle) { bundle_ = bundle; }
+
+  // number of chunks of entries read ahead while the current one is processed
+  void setReadahead(const unsigned int depth) { readahead_ = depth; }
+
+  // Quick look: draw(vars) reads and plots only a deterministic sample
+  // of the DetUnits, the given fraction of each sub-detector and layer
+  // but at most maxPerLayer of them (0: no maximum). fraction = 1 and
+  // maxPerLayer = 0 switch it off. The layers are decoded from the
+  // DetIds, hence the topology must be Phase0Topology or Phase1Topology.
+  // The plots are marked as sampled. draw(vars,region) and
+  // draw(vars,cut) are not sampled and read all modules.
+  void setQuickLook(const double fraction, const unsigned int maxPerLayer = 0, const TrackerTopologyVersion topology = Phase0Topology);
+
   void draw(const TString &vars, double min = 1., double max = -1.) const;
 
+  // Only the modules inside the region. The module positions are read
+  // once and indexed by a ModuleGrid, the tree variables once per variable.
+  void draw(const TString &vars, const Region &region, double min = 1., double max = -1.) const;
+
+  // Only the modules passing the cut, e.g. "r < 20 && abs(z) < 30" (see
+  // Cut.h). First only the branches of the cut are read, then the plotted
+  // branches only for the selected entries.
+  void draw(const TString &vars, const TString &cut, double min = 1., double max = -1.) const;
+
+  WeakModeFitter fitWeakModes(const unsigned int nThreads = 1) const;
+
+  // Median, MAD and tail quantiles per sub-detector and layer in one
+  // pass over the alignTree; the layers are decoded from the DetIds,
+  // hence the topology must be Phase0Topology or Phase1Topology
+  ComparisonSummary summarize(const TrackerTopologyVersion topology = Phase0Topology, const unsigned int nThreads = 1) const;
+
+  // Rigid-body motion (dx, dy, dz, alpha, beta, gamma) of each structure
+  // from the displacements of its modules. The module columns are read
+  // once and cached; the structures are fitted in parallel.
+  std::vector<StructureFit> fitStructures(const StructureLevel level, const TrackerTopologyVersion topology = Phase0Topology, const unsigned int nThreads = 1) const;
+
 
 private:
   typedef std::map< TString, TGraph* > Plots;
   typedef std::map< TString, TGraph* >::iterator PlotIt;  
 
+  // chunk of alignTree entries
+  struct EntryColumns {
+    std::vector<int> ids;
+    std::vector<int> levels;
+    std::vector<int> sublevels;
+    std::vector< std::vector<float> > vals; // [variable][entry]
+  };
+
+  // modules (DetUnits) of the alignTree, filled on first use of a region
+  struct ModuleCache {
+    ModuleCache()
+      : loaded(false) {}
+
+    bool loaded;
+    std::vector<Long64_t> entries; // [slot]
+    std::vector<int> sublevels;	   // [slot]
+    std::vector<int> ids;	   // [slot]
+    std::vector<int> mothers;	   // [slot], filled on first use
+    std::map< TString, std::vector<float> > columns; // [tree variable][slot]
+    ModuleGrid grid;
+  };
+
   const int nSubDet_;
+  const Long64_t chunkSize_;
 
   TString id_;
   TString fileName_;
   std::set<int> exclAlignables_;
+  RenderManifest* manifest_;
+  PlotBundle* bundle_;
+  unsigned int readahead_;
+  double sampleFraction_;
+  unsigned int sampleMax_;
+  TrackerTopologyVersion sampleTopology_;
+  mutable ModuleCache modules_;
 
+  bool isSampled() const { return sampleFraction_ < 1. || sampleMax_ > 0; }
+  TString sampleLabel() const;
+
+  void draw(const Variable &var1, const Variable &var2, Plots &plots, double min, double max, const TString &tag, const TString &note = "") const;
   Plots createPlots(const Variable &var1, const Variable &var2) const;
+  Plots createPlots(const Variable &var1, const Variable &var2, const Region &region) const;
+  Plots createPlots(const Variable &var1, const Variable &var2, const Cut &cut) const;
+  Plots createSampledPlots(const Variable &var1, const Variable &var2, TString &note) const;
+  Plots createPlots(const Variable &var1, const Variable &var2, TTree* tree, const std::vector<Long64_t> &entries, const std::vector<int> &sublevels) const;
+  Plots createPlots(const std::vector< std::vector<float> > &xs, const std::vector< std::vector<float> > &ys) const;
+  void select(TTree* tree, const Cut &cut, std::vector<Long64_t> &entries, std::vector<int> &sublevels) const;
+  size_t sample(TTree* tree, const std::vector<TString> &names, std::vector<Long64_t> &entries, std::vector<int> &sublevels, size_t &nCells, size_t &nSampledCells) const;
+  void readColumn(TTree* tree, const TString &name, const std::vector<Long64_t> &entries, std::vector<float> &column) const;
+  void loadModules() const;
+  const std::vector<float>& moduleColumn(const TString &name) const;
+  const std::vector<int>& moduleMothers() const;
+  Long64_t nEntries() const;
+  void fillWeakModes(WeakModeFitter* fitter, const Long64_t firstEntry, const Long64_t lastEntry) const;
+  void fillSummary(ComparisonSummary* summary, const Tracker* tracker, const Long64_t firstEntry, const Long64_t lastEntry) const;
   void setStyle(Plots &plots) const;
   void getRange(Plots &plots, double &xMin, double &xMax, double &yMin, double &yMax) const;
   void getRange(const TGraph* g, double &xMin, double &xMax, double &yMin, double &yMax) const;
@@ -49,7 +158,8 @@ private:
 
 
 GeometryComparison::GeometryComparison(const TString &fileName, const TString &id)
-  : nSubDet_(6) {
+  : nSubDet_(6), chunkSize_(10000), manifest_(0), bundle_(0), readahead_(0),
+    sampleFraction_(1.), sampleMax_(0), sampleTopology_(Phase0Topology) {
   TH1::AddDirectory(true);
   id_ = id;
   id_.ReplaceAll(".root","");
@@ -68,9 +178,83 @@ void GeometryComparison::draw(const TString &expr, double min, double max) const
   const TString expr2 = str(posColon+1,str.Length()-posColon-1);
   Variable var1(expr1);
   Variable var2(expr2);
-  TCanvas* can = new TCanvas("can_"+id_+"_"+var1()+":"+var2(),var1()+":"+var2(),500,500);
-  can->cd();
-  Plots plots = createPlots(var1,var2);
+  if( isSampled() ) {
+    TString note("");
+    Plots plots = createSampledPlots(var1,var2,note);
+    draw(var1,var2,plots,min,max,id_+"_"+sampleLabel(),note);
+  } else {
+    Plots plots = createPlots(var1,var2);
+    draw(var1,var2,plots,min,max,id_);
+  }
+}
+
+
+void GeometryComparison::setQuickLook(const double fraction, const unsigned int maxPerLayer, const TrackerTopologyVersion topology) {
+  if( !( fraction > 0. && fraction <= 1. ) ) {
+    std::cerr << "\n\nERROR in GeometryComparison: sample fraction " << fraction << " not in (0,1]\n" << std::endl;
+    throw std::exception();
+  }
+  if( topology != Phase0Topology && topology != Phase1Topology ) {
+    std::cerr << "\n\nERROR: the layers are decoded from the DetIds, which needs Phase0Topology or Phase1Topology\n" << std::endl;
+    throw std::exception();
+  }
+  sampleFraction_ = fraction;
+  sampleMax_ = maxPerLayer;
+  sampleTopology_ = topology;
+}
+
+
+// e.g. "sample5pct" or "sample5pct_max100", for the output names
+TString GeometryComparison::sampleLabel() const {
+  TString label("sample");
+  label += TString::Format("%gpct",100.*sampleFraction_);
+  if( sampleMax_ > 0 ) {
+    label += "_max";
+    label += sampleMax_;
+  }
+  label.ReplaceAll(".","p");
+
+  return label;
+}
+
+
+// The output file and canvas names contain the region name
+void GeometryComparison::draw(const TString &expr, const Region &region, double min, double max) const {
+  TString str(expr);
+  str.ReplaceAll(" ","");
+  const int posColon = str.First(":");
+  const TString expr1 = str(0,posColon);
+  const TString expr2 = str(posColon+1,str.Length()-posColon-1);
+  Variable var1(expr1);
+  Variable var2(expr2);
+  if( isSampled() ) {
+    std::cout << "WARNING: quick look is not applied to draw with a region, reading all modules" << std::endl;
+  }
+  Plots plots = createPlots(var1,var2,region);
+  draw(var1,var2,plots,min,max,region.name() == "" ? id_ : id_+"_"+region.name());
+}
+
+
+// The output file and canvas names contain the cut
+void GeometryComparison::draw(const TString &expr, const TString &cut, double min, double max) const {
+  TString str(expr);
+  str.ReplaceAll(" ","");
+  const int posColon = str.First(":");
+  const TString expr1 = str(0,posColon);
+  const TString expr2 = str(posColon+1,str.Length()-posColon-1);
+  Variable var1(expr1);
+  Variable var2(expr2);
+  const Cut selection(cut);
+  if( isSampled() ) {
+    std::cout << "WARNING: quick look is not applied to draw with a cut, reading all modules" << std::endl;
+  }
+  Plots plots = createPlots(var1,var2,selection);
+  draw(var1,var2,plots,min,max,id_+"_"+selection.screenLabel());
+}
+
+
+// Renders and deletes the plots; the note, if any, is printed on top
+void GeometryComparison::draw(const Variable &var1, const Variable &var2, Plots &plots, double min, double max, const TString &tag, const TString &note) const {
   setStyle(plots);
   double yMin = 0.;
   double yMax = 0.;
@@ -81,7 +265,26 @@ void GeometryComparison::draw(const TString &expr, double min, double max) const
     yMin = min;
     yMax = max;
   }
-  TH1* hFrame = new TH1D("hFrame_"+id_+"_"+var1()+":"+var2(),"",1000,xMin,xMax);
+
+  // skip the plot if exactly the same plot has been rendered before
+  const TString outName = tag+"_"+var1.screenLabel()+"_vs_"+var2.screenLabel()+".pdf";
+  ContentHash hash;
+  hash.add(var1()).add(var2()).add(xMin).add(xMax).add(yMin).add(yMax).add(note);
+  for(PlotIt it = plots.begin(); it != plots.end(); ++it) {
+    hash.add(it->first).add(it->second->GetMarkerColor()).add(it->second->GetN());
+    hash.add(it->second->GetX(),it->second->GetN()*sizeof(double));
+    hash.add(it->second->GetY(),it->second->GetN()*sizeof(double));
+  }
+  if( bundle_ == 0 && manifest_ != 0 && manifest_->isUpToDate(outName,hash) ) {
+    for(PlotIt it = plots.begin(); it != plots.end(); ++it) {
+      delete it->second;
+    }
+    return;
+  }
+
+  TCanvas* can = new TCanvas("can_"+tag+"_"+var1()+":"+var2(),var1()+":"+var2(),500,500);
+  can->cd();
+  TH1* hFrame = new TH1D("hFrame_"+tag+"_"+var1()+":"+var2(),"",1000,xMin,xMax);
   hFrame->GetXaxis()->SetTitle(var2());
   hFrame->GetYaxis()->SetTitle(var1());
   hFrame->GetYaxis()->SetRangeUser(yMin,yMax);
@@ -94,12 +297,32 @@ void GeometryComparison::draw(const TString &expr, double min, double max) const
   for(PlotIt it = plots.begin(); it != plots.end(); ++it) {
     it->second->Draw("Psame");
   }
-  can->SaveAs(id_+"_"+var1.screenLabel()+"_vs_"+var2.screenLabel()+".pdf");
+  TPaveText* info = 0;
+  if( note != "" ) {
+    info = new TPaveText(0.20,0.93,0.93,0.99,"NDC");
+    info->SetBorderSize(0);
+    info->SetFillStyle(0);
+    info->SetTextFont(62);
+    info->SetTextColor(kRed);
+    info->SetTextAlign(12);
+    info->AddText(note);
+    info->Draw();
+  }
+  if( bundle_ != 0 ) {
+    bundle_->add(can,outName(0,outName.Length()-4),tag+": "+var1()+" vs "+var2());
+    for(PlotIt it = plots.begin(); it != plots.end(); ++it) {
+      bundle_->write(it->second,it->first);
+    }
+  } else {
+    can->SaveAs(outName);
+    if( manifest_ != 0 ) manifest_->update(outName,hash);
+  }
 
   for(PlotIt it = plots.begin(); it != plots.end(); ++it) {
     delete it->second;
   }
   plots.clear();
+  delete info;
   delete hFrame;
   delete can;
 }
@@ -148,6 +371,7 @@ GeometryComparison::Plots GeometryComparison::createPlots(const Variable &var1,
   int id = 0;
   int level = 0;
   int sublevel = 0;
+  std::vector<BranchValue> treeVals(names.size());
 
   TFile file(fileName_,"READ");
   TTree* tree = NULL;
@@ -162,7 +386,7 @@ GeometryComparison::Plots GeometryComparison::createPlots(const Variable &var1,
   tree->SetBranchAddress("level",&level);
   tree->SetBranchAddress("sublevel",&sublevel);
   for(size_t i = 0; i < names.size(); ++i) {
-    tree->SetBranchAddress(names.at(i),&vals.at(i));
+    treeVals.at(i).bind(tree,names.at(i));
   }
 
 
@@ -188,19 +412,101 @@ GeometryComparison::Plots GeometryComparison::createPlots(const Variable &var1,
     }    
   }
 
-  // loop over tree
-  for(int i = 0; i < tree->GetEntries(); ++i) {
-    tree->GetEntry(i);
+  // reading: fill the next chunk of entries into the column buffers
+  const Long64_t nEntries = tree->GetEntries();
+  Long64_t nextEntry = 0;
+  auto readChunk = [&](EntryColumns& cols) -> bool {
+    if( nextEntry >= nEntries ) return false;
+    const Long64_t last = std::min(nEntries,nextEntry+chunkSize_);
+    cols.ids.clear();
+    cols.levels.clear();
+    cols.sublevels.clear();
+    cols.vals.resize(names.size());
+    for(size_t j = 0; j < names.size(); ++j) {
+      cols.vals[j].clear();
+    }
+    for(Long64_t i = nextEntry; i < last; ++i) {
+      tree->GetEntry(i);
+      cols.ids.push_back(id);
+      cols.levels.push_back(level);
+      cols.sublevels.push_back(sublevel);
+      for(size_t j = 0; j < names.size(); ++j) {
+	cols.vals[j].push_back(treeVals[j].value());
+      }
+    }
+    nextEntry = last;
 
-    if( exclAlignables_.find( id ) != exclAlignables_.end() ) continue;
-    if( level != 1 ) continue;	// Detector (DetId==1 is Tracker: DataFormats/DetId/interface/DetId.h)
-    if( sublevel > 0 && sublevel < nSubDet_+1 ) { // Sub-Detector Id
-      // std::cout << "\nyVals[0] = " << yVals.at(0) << std::endl;
-      // std::cout << "yVals[1] = " << yVals.at(1) << std::endl;
-      ys.at(sublevel-1).push_back( var1.eval(yVals) );
-      xs.at(sublevel-1).push_back( var2.eval(xVals) );
+    return true;
+  };
+
+  // processing: evaluate the variables
+  auto processChunk = [&](const EntryColumns& cols) {
+    for(size_t i = 0; i < cols.ids.size(); ++i) {
+      if( exclAlignables_.find( cols.ids[i] ) != exclAlignables_.end() ) continue;
+      if( cols.levels[i] != 1 ) continue;	// Detector (DetId==1 is Tracker: DataFormats/DetId/interface/DetId.h)
+      const int subDet = cols.sublevels[i];
+      if( subDet > 0 && subDet < nSubDet_+1 ) { // Sub-Detector Id
+	for(size_t j = 0; j < names.size(); ++j) {
+	  vals[j] = cols.vals[j][i];
+	}
+	// std::cout << "\nyVals[0] = " << yVals.at(0) << std::endl;
+	// std::cout << "yVals[1] = " << yVals.at(1) << std::endl;
+	ys.at(subDet-1).push_back( var1.eval(yVals) );
+	xs.at(subDet-1).push_back( var2.eval(xVals) );
+      }
     }
+  };
+
+  // loop over tree
+  PrefetchPipeline<EntryColumns> pipeline(readahead_);
+  pipeline.run(readChunk,processChunk);
+  if( readahead_ > 0 ) pipeline.printStats("Reading alignTree");
+
+  delete tree;
+  file.Close();
+
+  return createPlots(xs,ys);
+}
+
+
+GeometryComparison::Plots GeometryComparison::createPlots(const Variable &var1, const Variable &var2, const Region &region) const {
+  loadModules();
+  std::vector<size_t> slots;
+  modules_.grid.query(region,slots);
+
+  // cached columns of the tree variables
+  std::vector<const std::vector<float>*> yCols(var1.nTreeVariables(),0);
+  std::vector<const std::vector<float>*> xCols(var2.nTreeVariables(),0);
+  for(size_t i = 0; i < var1.nTreeVariables(); ++i) {
+    yCols.at(i) = &moduleColumn(var1.treeVariable(i));
   }
+  for(size_t i = 0; i < var2.nTreeVariables(); ++i) {
+    xCols.at(i) = &moduleColumn(var2.treeVariable(i));
+  }
+  std::vector<float> yArgs(yCols.size(),0.);
+  std::vector<float> xArgs(xCols.size(),0.);
+  std::vector<float*> yVals(yCols.size(),0);
+  std::vector<float*> xVals(xCols.size(),0);
+  for(size_t i = 0; i < yArgs.size(); ++i) yVals.at(i) = &yArgs.at(i);
+  for(size_t i = 0; i < xArgs.size(); ++i) xVals.at(i) = &xArgs.at(i);
+
+  std::vector< std::vector<float> > xs(nSubDet_);
+  std::vector< std::vector<float> > ys(nSubDet_);
+  for(size_t s = 0; s < slots.size(); ++s) {
+    const size_t slot = slots[s];
+    for(size_t i = 0; i < yCols.size(); ++i) yArgs[i] = (*yCols[i])[slot];
+    for(size_t i = 0; i < xCols.size(); ++i) xArgs[i] = (*xCols[i])[slot];
+    const int subDet = modules_.sublevels[slot];
+    ys.at(subDet-1).push_back( var1.eval(yVals) );
+    xs.at(subDet-1).push_back( var2.eval(xVals) );
+  }
+
+  return createPlots(xs,ys);
+}
+
+
+GeometryComparison::Plots GeometryComparison::createPlots(const std::vector< std::vector<float> > &xs, const std::vector< std::vector<float> > &ys) const {
+  Plots plots;
   for(unsigned int l = 0; l < xs.size(); ++l) {
     TString det("PXB");		// sublevel 1
     if(      l == 1 ) det = "PXF"; // sublevel 2
@@ -208,16 +514,778 @@ GeometryComparison::Plots GeometryComparison::createPlots(const Variable &var1,
     else if( l == 3 ) det = "TID"; // sublevel 4
     else if( l == 4 ) det = "TOB"; // sublevel 5
     else if( l == 5 ) det = "TEC"; // sublevel 6
-    plots[det] = new TGraph(xs.at(l).size(),&(xs.at(l).front()),&(ys.at(l).front()));
+    plots[det] = new TGraph(xs.at(l).size(),xs.at(l).data(),ys.at(l).data());
+  }
+
+  return plots;
+}
+
+
+// Selection in two phases: the branches of the cut are read for all
+// entries and give the selection mask, the branches of the variables
+// only for the selected entries. Baskets without selected entries are
+// never read.
+GeometryComparison::Plots GeometryComparison::createPlots(const Variable &var1, const Variable &var2, const Cut &cut) const {
+  TFile file(fileName_,"READ");
+  TTree* tree = NULL;
+  file.GetObject("alignTree",tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading tree from file" << std::endl;
+    throw std::exception();
+  }
+
+  std::vector<Long64_t> entries;
+  std::vector<int> sublevels;
+  select(tree,cut,entries,sublevels);
+  Plots plots = createPlots(var1,var2,tree,entries,sublevels);
+  delete tree;
+  file.Close();
+
+  return plots;
+}
+
+
+// Only the plotted modules, stratified by sub-detector and layer. The
+// ids are read for all entries, the branches of the variables only for
+// the sampled entries. Prints the number of read cells and the time.
+GeometryComparison::Plots GeometryComparison::createSampledPlots(const Variable &var1, const Variable &var2, TString &note) const {
+  TStopwatch timer;
+  TFile file(fileName_,"READ");
+  TTree* tree = NULL;
+  file.GetObject("alignTree",tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading tree from file" << std::endl;
+    throw std::exception();
   }
 
+  std::vector<TString> names;
+  for(size_t i = 0; i < var1.nTreeVariables(); ++i) names.push_back(var1.treeVariable(i));
+  for(size_t i = 0; i < var2.nTreeVariables(); ++i) names.push_back(var2.treeVariable(i));
+  std::vector<Long64_t> entries;
+  std::vector<int> sublevels;
+  size_t nCells = 0;
+  size_t nSampledCells = 0;
+  const size_t nModules = sample(tree,names,entries,sublevels,nCells,nSampledCells);
+  Plots plots = createPlots(var1,var2,tree,entries,sublevels);
   delete tree;
   file.Close();
+  timer.Stop();
+
+  note = "QUICK LOOK: ";
+  note += TString::Format("%g",100.*sampleFraction_);
+  note += "% sample";
+  if( sampleMax_ > 0 ) {
+    note += ", max ";
+    note += sampleMax_;
+    note += " per layer";
+  }
+  note += " (";
+  note += entries.size();
+  note += " of ";
+  note += nModules;
+  note += " modules)";
+  std::cout << note << std::endl;
+  std::cout << "  read " << nSampledCells << " of " << nCells << " cells in " << timer.RealTime()*1000. << " ms" << std::endl;
 
   return plots;
 }
 
 
+// The branches of the variables, only for the given entries
+GeometryComparison::Plots GeometryComparison::createPlots(const Variable &var1, const Variable &var2, TTree* tree, const std::vector<Long64_t> &entries, const std::vector<int> &sublevels) const {
+  // columns of the tree variables for the selected entries
+  std::map< TString, std::vector<float> > columns;
+  for(size_t i = 0; i < var1.nTreeVariables(); ++i) {
+    const TString name = var1.treeVariable(i);
+    if( columns.find(name) == columns.end() ) readColumn(tree,name,entries,columns[name]);
+  }
+  for(size_t i = 0; i < var2.nTreeVariables(); ++i) {
+    const TString name = var2.treeVariable(i);
+    if( columns.find(name) == columns.end() ) readColumn(tree,name,entries,columns[name]);
+  }
+
+  std::vector<const std::vector<float>*> yCols(var1.nTreeVariables(),0);
+  std::vector<const std::vector<float>*> xCols(var2.nTreeVariables(),0);
+  for(size_t i = 0; i < yCols.size(); ++i) yCols.at(i) = &columns[var1.treeVariable(i)];
+  for(size_t i = 0; i < xCols.size(); ++i) xCols.at(i) = &columns[var2.treeVariable(i)];
+  std::vector<float> yArgs(yCols.size(),0.);
+  std::vector<float> xArgs(xCols.size(),0.);
+  std::vector<float*> yVals(yArgs.size(),0);
+  std::vector<float*> xVals(xArgs.size(),0);
+  for(size_t i = 0; i < yArgs.size(); ++i) yVals.at(i) = &yArgs.at(i);
+  for(size_t i = 0; i < xArgs.size(); ++i) xVals.at(i) = &xArgs.at(i);
+
+  std::vector< std::vector<float> > xs(nSubDet_);
+  std::vector< std::vector<float> > ys(nSubDet_);
+  for(size_t e = 0; e < entries.size(); ++e) {
+    for(size_t i = 0; i < yArgs.size(); ++i) yArgs[i] = (*yCols[i])[e];
+    for(size_t i = 0; i < xArgs.size(); ++i) xArgs[i] = (*xCols[i])[e];
+    ys.at(sublevels[e]-1).push_back( var1.eval(yVals) );
+    xs.at(sublevels[e]-1).push_back( var2.eval(xVals) );
+  }
+
+  return createPlots(xs,ys);
+}
+
+
+// First phase of the selection: the entries of the DetUnits that are
+// not excluded and pass the cut, and their sublevels
+void GeometryComparison::select(TTree* tree, const Cut &cut, std::vector<Long64_t> &entries, std::vector<int> &sublevels) const {
+  int id = 0;
+  int level = 0;
+  int sublevel = 0;
+  std::vector<BranchValue> cutVals(cut.nTreeVariables());
+  std::vector<const int*> intVals(cut.nTreeVariables(),0); // for id, level, sublevel
+
+  tree->SetBranchStatus("*",false);
+  tree->SetBranchStatus("id",true);
+  tree->SetBranchStatus("level",true);
+  tree->SetBranchStatus("sublevel",true);
+  tree->SetBranchAddress("id",&id);
+  tree->SetBranchAddress("level",&level);
+  tree->SetBranchAddress("sublevel",&sublevel);
+  for(size_t i = 0; i < cut.nTreeVariables(); ++i) {
+    const TString name = cut.treeVariable(i);
+    if( tree->GetBranch(name) == NULL ) {
+      std::cerr << "\n\nERROR no variable '" << name << "' in tree" << std::endl;
+      throw std::exception();
+    }
+    if(      name == "id"       ) intVals[i] = &id;
+    else if( name == "level"    ) intVals[i] = &level;
+    else if( name == "sublevel" ) intVals[i] = &sublevel;
+    else cutVals[i].bind(tree,name);
+  }
+
+  std::vector<Long64_t> candidates;
+  std::vector<int> candidateSublevels;
+  std::vector< std::vector<double> > cutColumns(cut.nTreeVariables());
+  const Long64_t nEntries = tree->GetEntries();
+  for(Long64_t i = 0; i < nEntries; ++i) {
+    tree->GetEntry(i);
+    if( exclAlignables_.find( id ) != exclAlignables_.end() ) continue;
+    if( level != 1 ) continue;
+    if( sublevel < 1 || sublevel > nSubDet_ ) continue;
+    candidates.push_back(i);
+    candidateSublevels.push_back(sublevel);
+    for(size_t j = 0; j < cutColumns.size(); ++j) {
+      cutColumns[j].push_back( intVals[j] != 0 ? *(intVals[j]) : cutVals[j].value() );
+    }
+  }
+
+  // disabled branches are not read by TBranch::GetEntry() either
+  tree->ResetBranchAddresses();
+  tree->SetBranchStatus("*",true);
+
+  std::vector<const std::vector<double>*> cols(cutColumns.size(),0);
+  for(size_t j = 0; j < cutColumns.size(); ++j) {
+    cols[j] = &cutColumns[j];
+  }
+  std::vector<unsigned char> mask(candidates.size(),1);
+  if( !cols.empty() ) cut.eval(cols,mask);
+
+  entries.clear();
+  sublevels.clear();
+  for(size_t i = 0; i < candidates.size(); ++i) {
+    if( mask[i] ) {
+      entries.push_back(candidates[i]);
+      sublevels.push_back(candidateSublevels[i]);
+    }
+  }
+}
+
+
+// Stratified sample of the DetUnits that are not excluded; returns
+// their number. Per sub-detector and layer, the entries are grouped
+// into cells by the baskets of the given branches. The entries of a
+// layer follow the order of their DetIds, i.e. of the rods or ladders,
+// hence a cell is a patch in phi and z. To cover the whole layer, the
+// sample is taken from evenly spaced cells, as few as the sample size
+// needs but at least 8 (if the layer has as many), and
+// from these in turn the entries with the smallest hashes of their ids.
+// Thus only the baskets of the taken cells are read -- nCells and
+// nSampledCells count all and the taken cells -- and the sample depends
+// only on the ids and the file. If a layer is within one basket, its
+// sample is spread over the whole layer by the hash.
+size_t GeometryComparison::sample(TTree* tree, const std::vector<TString> &names, std::vector<Long64_t> &entries, std::vector<int> &sublevels, size_t &nCells, size_t &nSampledCells) const {
+  // first entries of the baskets of all branches
+  std::vector<Long64_t> basketStarts;
+  for(size_t i = 0; i < names.size(); ++i) {
+    TBranch* branch = tree->GetBranch(names[i]);
+    if( branch == NULL ) {
+      std::cerr << "\n\nERROR no variable '" << names[i] << "' in tree" << std::endl;
+      throw std::exception();
+    }
+    const Long64_t* basketEntry = branch->GetBasketEntry();
+    for(Int_t b = 0; basketEntry != 0 && b <= branch->GetWriteBasket(); ++b) {
+      basketStarts.push_back(basketEntry[b]);
+    }
+  }
+  std::sort(basketStarts.begin(),basketStarts.end());
+  basketStarts.erase(std::unique(basketStarts.begin(),basketStarts.end()),basketStarts.end());
+
+  int id = 0;
+  int level = 0;
+  int sublevel = 0;
+  tree->SetBranchStatus("*",false);
+  tree->SetBranchStatus("id",true);
+  tree->SetBranchStatus("level",true);
+  tree->SetBranchStatus("sublevel",true);
+  tree->SetBranchAddress("id",&id);
+  tree->SetBranchAddress("level",&level);
+  tree->SetBranchAddress("sublevel",&sublevel);
+
+  struct Candidate {
+    size_t cell;
+    UInt_t hash;
+    Long64_t entry;
+    int sublevel;
+  };
+  // murmur3 finaliser: well mixed also for consecutive ids
+  auto hashId = [](UInt_t h) -> UInt_t {
+    h ^= h >> 16; h *= 0x85ebca6b;
+    h ^= h >> 13; h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+  };
+
+  const Tracker tracker(sampleTopology_);
+  std::map< std::pair<int,unsigned int>, std::vector<Candidate> > strata; // (sublevel,layer)
+  size_t nModules = 0;
+  const Long64_t nEntries = tree->GetEntries();
+  for(Long64_t i = 0; i < nEntries; ++i) {
+    tree->GetEntry(i);
+    if( exclAlignables_.find( id ) != exclAlignables_.end() ) continue;
+    if( level != 1 ) continue;
+    if( sublevel < 1 || sublevel > nSubDet_ ) continue;
+    const unsigned int layer = tracker.layer(static_cast<unsigned int>(id));
+    const size_t cell = std::upper_bound(basketStarts.begin(),basketStarts.end(),i)-basketStarts.begin();
+    Candidate cand = { cell, hashId(static_cast<UInt_t>(id)), i, sublevel };
+    strata[std::make_pair(sublevel,layer)].push_back(cand);
+    ++nModules;
+  }
+  tree->ResetBranchAddresses();
+  tree->SetBranchStatus("*",true);
+
+  const size_t minSampledCells = 8; // per layer, to cover it also for small samples
+  nCells = 0;
+  nSampledCells = 0;
+  std::vector< std::pair<Long64_t,int> > sampled;
+  for(std::map< std::pair<int,unsigned int>, std::vector<Candidate> >::iterator it = strata.begin(); it != strata.end(); ++it) {
+    std::vector<Candidate>& cands = it->second;
+    size_t n = static_cast<size_t>(std::ceil(sampleFraction_*cands.size()));
+    if( sampleMax_ > 0 && n > sampleMax_ ) n = sampleMax_;
+
+    // the candidates of a stratum are ordered by entry, hence by cell
+    std::vector<size_t> cellStarts;
+    for(size_t c = 0; c < cands.size(); ++c) {
+      if( c == 0 || cands[c].cell != cands[c-1].cell ) cellStarts.push_back(c);
+    }
+    const size_t nCellsOfLayer = cellStarts.size();
+    cellStarts.push_back(cands.size());
+    nCells += nCellsOfLayer;
+
+    // evenly spaced cells, more if they are smaller than average
+    const size_t nNeeded = static_cast<size_t>(std::ceil(static_cast<double>(n)*nCellsOfLayer/cands.size()));
+    size_t nTaken = std::min(nCellsOfLayer,std::max(nNeeded,std::min(n,minSampledCells)));
+    while( nTaken < nCellsOfLayer ) {
+      size_t nInTaken = 0;
+      for(size_t j = 0; j < nTaken; ++j) {
+	const size_t cell = (2*j+1)*nCellsOfLayer/(2*nTaken);
+	nInTaken += cellStarts[cell+1]-cellStarts[cell];
+      }
+      if( nInTaken >= n ) break;
+      ++nTaken;
+    }
+
+    // each with its entries ordered by hash
+    std::vector< std::vector<const Candidate*> > takenCells(nTaken);
+    for(size_t j = 0; j < nTaken; ++j) {
+      const size_t cell = (2*j+1)*nCellsOfLayer/(2*nTaken);
+      for(size_t c = cellStarts[cell]; c < cellStarts[cell+1]; ++c) takenCells[j].push_back(&cands[c]);
+      std::sort(takenCells[j].begin(),takenCells[j].end(),[](const Candidate* a, const Candidate* b) {
+	  return a->hash < b->hash;
+	});
+    }
+
+    // in turn from the taken cells
+    size_t nSampled = 0;
+    for(size_t rank = 0; nSampled < n; ++rank) {
+      for(size_t j = 0; j < nTaken && nSampled < n; ++j) {
+	if( rank >= takenCells[j].size() ) continue;
+	if( rank == 0 ) ++nSampledCells;
+	sampled.push_back(std::make_pair(takenCells[j][rank]->entry,takenCells[j][rank]->sublevel));
+	++nSampled;
+      }
+    }
+  }
+
+  // in the order of the tree
+  std::sort(sampled.begin(),sampled.end());
+  entries.clear();
+  sublevels.clear();
+  for(size_t i = 0; i < sampled.size(); ++i) {
+    entries.push_back(sampled[i].first);
+    sublevels.push_back(sampled[i].second);
+  }
+
+  return nModules;
+}
+
+
+// Second phase: only this branch, only the given entries
+void GeometryComparison::readColumn(TTree* tree, const TString &name, const std::vector<Long64_t> &entries, std::vector<float> &column) const {
+  TBranch* branch = tree->GetBranch(name);
+  if( branch == NULL ) {
+    std::cerr << "\n\nERROR no variable '" << name << "' in tree" << std::endl;
+    throw std::exception();
+  }
+  BranchValue val;
+  val.bind(branch);
+  column.clear();
+  column.reserve(entries.size());
+  for(size_t i = 0; i < entries.size(); ++i) {
+    branch->GetEntry(entries[i]);
+    column.push_back(val.value());
+  }
+  branch->SetAddress(0);
+}
+
+
+// One scan of the alignTree for the ids and positions of the
+// DetUnits that are not excluded
+void GeometryComparison::loadModules() const {
+  if( modules_.loaded ) return;
+
+  int id = 0;
+  int level = 0;
+  int sublevel = 0;
+  float r = 0.;
+  float z = 0.;
+  float phi = 0.;
+
+  TFile file(fileName_,"READ");
+  TTree* tree = NULL;
+  file.GetObject("alignTree",tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading tree from file" << std::endl;
+    throw std::exception();
+  }
+  tree->SetBranchStatus("*",false);
+  const char* branches[6] = { "id", "level", "sublevel", "r", "z", "phi" };
+  for(int i = 0; i < 6; ++i) {
+    tree->SetBranchStatus(branches[i],true);
+  }
+  tree->SetBranchAddress("id",&id);
+  tree->SetBranchAddress("level",&level);
+  tree->SetBranchAddress("sublevel",&sublevel);
+  tree->SetBranchAddress("r",&r);
+  tree->SetBranchAddress("z",&z);
+  tree->SetBranchAddress("phi",&phi);
+
+  std::vector<float>& rs = modules_.columns["r"];
+  std::vector<float>& zs = modules_.columns["z"];
+  std::vector<float>& phis = modules_.columns["phi"];
+  const Long64_t nEntries = tree->GetEntries();
+  for(Long64_t i = 0; i < nEntries; ++i) {
+    tree->GetEntry(i);
+    if( exclAlignables_.find( id ) != exclAlignables_.end() ) continue;
+    if( level != 1 ) continue;
+    if( sublevel > 0 && sublevel < nSubDet_+1 ) {
+      modules_.entries.push_back(i);
+      modules_.sublevels.push_back(sublevel);
+      modules_.ids.push_back(id);
+      rs.push_back(r);
+      zs.push_back(z);
+      phis.push_back(phi);
+    }
+  }
+  delete tree;
+  file.Close();
+
+  modules_.grid.build(modules_.sublevels,rs,zs,phis);
+  modules_.loaded = true;
+}
+
+
+// Reads the tree variable for all modules on first use, with the
+// type of its leaf; only its branch is read
+const std::vector<float>& GeometryComparison::moduleColumn(const TString &name) const {
+  std::map< TString, std::vector<float> >::const_iterator it = modules_.columns.find(name);
+  if( it != modules_.columns.end() ) return it->second;
+
+  TFile file(fileName_,"READ");
+  TTree* tree = NULL;
+  file.GetObject("alignTree",tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading tree from file" << std::endl;
+    throw std::exception();
+  }
+  TBranch* branch = tree->GetBranch(name);
+  if( branch == NULL ) {
+    std::cerr << "\n\nERROR no variable '" << name << "' in tree" << std::endl;
+    throw std::exception();
+  }
+  BranchValue val;
+  val.bind(branch);
+  std::vector<float>& column = modules_.columns[name];
+  column.reserve(modules_.entries.size());
+  for(size_t i = 0; i < modules_.entries.size(); ++i) {
+    branch->GetEntry(modules_.entries[i]);
+    column.push_back(val.value());
+  }
+  delete tree;
+  file.Close();
+
+  return column;
+}
+
+
+const std::vector<int>& GeometryComparison::moduleMothers() const {
+  if( modules_.mothers.size() == modules_.entries.size() ) return modules_.mothers;
+
+  TFile file(fileName_,"READ");
+  TTree* tree = NULL;
+  file.GetObject("alignTree",tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading tree from file" << std::endl;
+    throw std::exception();
+  }
+  TBranch* branch = tree->GetBranch("mid");
+  if( branch == NULL ) {
+    std::cerr << "\n\nERROR no variable 'mid' in tree" << std::endl;
+    throw std::exception();
+  }
+  int mid = 0;
+  branch->SetAddress(&mid);
+  modules_.mothers.clear();
+  modules_.mothers.reserve(modules_.entries.size());
+  for(size_t i = 0; i < modules_.entries.size(); ++i) {
+    branch->GetEntry(modules_.entries[i]);
+    modules_.mothers.push_back(mid);
+  }
+  delete tree;
+  file.Close();
+
+  return modules_.mothers;
+}
+
+
+// The modules are grouped into the structures of the given level, by
+// the sub-detector and the layer and ring decoded from their DetIds or
+// by their mother alignable in the alignTree. The structure names are
+// e.g. "TIB", "TIB -z", "TIB L2", "TIB L2 R3" (layers and rings counted
+// from 1), or "TIB 302056196" for the mothers.
+std::vector<StructureFit> GeometryComparison::fitStructures(const StructureLevel level, const TrackerTopologyVersion topology, const unsigned int nThreads) const {
+  if( topology != Phase0Topology && topology != Phase1Topology ) {
+    std::cerr << "\n\nERROR: the structures are decoded from the DetIds, which needs Phase0Topology or Phase1Topology\n" << std::endl;
+    throw std::exception();
+  }
+  loadModules();
+  const std::vector<float>& xs = moduleColumn("x");
+  const std::vector<float>& ys = moduleColumn("y");
+  const std::vector<float>& zs = moduleColumn("z");
+  const std::vector<float>& dxs = moduleColumn("dx");
+  const std::vector<float>& dys = moduleColumn("dy");
+  const std::vector<float>& dzs = moduleColumn("dz");
+  const std::vector<int>* mothers = level == MotherStructures ? &moduleMothers() : 0;
+  const Tracker tracker(topology);
+
+  // structure of each module; the keys (sublevel, a, b, c) order the
+  // structures by sub-detector, layer and ring in the barrel, and by
+  // sub-detector, side, disk/wheel and ring in the endcaps, where the
+  // layers of Tracker are the rings and not rigid bodies
+  const DetIdLayout& dl = detIdLayouts[topology];
+  typedef std::map< std::vector<long>, size_t > StructureMap;
+  StructureMap keys;
+  std::vector<size_t> structures(modules_.entries.size());
+  std::vector<TString> names;
+  std::vector<int> subDets;
+  for(size_t slot = 0; slot < structures.size(); ++slot) {
+    const int subDet = modules_.sublevels[slot];
+    const unsigned int id = static_cast<unsigned int>(modules_.ids[slot]);
+    const bool endcap = subDet == 2 || subDet == 4 || subDet == 6;
+    std::vector<long> key(4,0);
+    key[0] = subDet;
+    if( level == HalfStructures ) {
+      key[1] = zs[slot] < 0. ? 0 : 1;
+    } else if( ( level == LayerStructures || level == RingStructures ) && endcap ) {
+      if( subDet == 2 ) {
+	key[1] = dl.pxfSide(id);
+	key[2] = dl.pxfDisk(id);
+      } else if( subDet == 4 ) {
+	key[1] = dl.tidSide(id);
+	key[2] = dl.tidWheel(id);
+	key[3] = dl.tidRing(id);
+      } else {
+	key[1] = dl.tecSide(id);
+	key[2] = dl.tecWheel(id);
+	key[3] = dl.tecRing(id);
+      }
+      if( level == LayerStructures ) key[3] = 0;
+    } else if( level == LayerStructures ) {
+      key[1] = tracker.layer(id);
+    } else if( level == RingStructures ) {
+      key[1] = tracker.layer(id);
+      key[2] = tracker.ring(id);
+    } else if( level == MotherStructures ) {
+      key[1] = mothers->at(slot);
+    }
+    std::pair<StructureMap::iterator,bool> it = keys.insert(std::make_pair(key,keys.size()));
+    structures[slot] = it.first->second;
+    if( it.second ) {
+      TString name = toStr(static_cast<Detector>(subDet-1));
+      if( level == HalfStructures ) {
+	name += key[1] == 0 ? " -z" : " +z";
+      } else if( ( level == LayerStructures || level == RingStructures ) && endcap ) {
+	name += key[1] == 1 ? " -z" : " +z";
+	name += subDet == 2 ? " D" : " W";
+	name += key[2];
+	if( level == RingStructures && subDet != 2 ) {
+	  name += " R";
+	  name += key[3];
+	}
+      } else if( level == LayerStructures || level == RingStructures ) {
+	name += " L";
+	name += key[1]+1;
+	if( level == RingStructures ) {
+	  name += " R";
+	  name += key[2]+1;
+	}
+      } else if( level == MotherStructures ) {
+	name += " ";
+	name += key[1];
+      }
+      names.push_back(name);
+      subDets.push_back(subDet);
+    }
+  }
+
+  // renumber in the order of the keys
+  std::vector<size_t> order(keys.size());
+  size_t pos = 0;
+  for(StructureMap::const_iterator it = keys.begin(); it != keys.end(); ++it, ++pos) {
+    order[it->second] = pos;
+  }
+  std::vector<TString> orderedNames(names.size());
+  std::vector<int> orderedSubDets(subDets.size());
+  for(size_t s = 0; s < order.size(); ++s) {
+    orderedNames[order[s]] = names[s];
+    orderedSubDets[order[s]] = subDets[s];
+  }
+  for(size_t slot = 0; slot < structures.size(); ++slot) {
+    structures[slot] = order[structures[slot]];
+  }
+
+  return fitRigidBodies(structures,orderedNames,orderedSubDets,xs,ys,zs,dxs,dys,dzs,nThreads);
+}
+
+
+// Fit the weak-mode amplitudes per sub-detector in one pass over
+// the alignTree. For nThreads > 1, the tree is split into chunks of
+// entries which are processed in parallel, each with its own TFile,
+// and the partial normal equations are merged afterwards.
+WeakModeFitter GeometryComparison::fitWeakModes(const unsigned int nThreads) const {
+  const Long64_t nEntries = this->nEntries();
+
+  WeakModeFitter result(nSubDet_);
+  if( nThreads < 2 ) {
+    fillWeakModes(&result,0,nEntries);
+  } else {
+    ROOT::EnableThreadSafety();
+    std::vector<WeakModeFitter> fitters(nThreads,WeakModeFitter(nSubDet_));
+    std::vector<std::exception_ptr> errors(nThreads);
+    std::vector<std::thread> threads;
+    const Long64_t chunkSize = nEntries/nThreads + 1;
+    for(unsigned int t = 0; t < nThreads; ++t) {
+      const Long64_t first = std::min(nEntries,t*chunkSize);
+      const Long64_t last = std::min(nEntries,first+chunkSize);
+      // an exception must not leave the thread, it is rethrown after join
+      threads.push_back(std::thread([this,&fitters,&errors,t,first,last]() {
+	    try {
+	      fillWeakModes(&fitters.at(t),first,last);
+	    } catch(...) {
+	      errors.at(t) = std::current_exception();
+	    }
+	  }));
+    }
+    for(unsigned int t = 0; t < nThreads; ++t) {
+      threads.at(t).join();
+    }
+    for(unsigned int t = 0; t < nThreads; ++t) {
+      if( errors.at(t) ) std::rethrow_exception(errors.at(t));
+      result.merge(fitters.at(t));
+    }
+  }
+
+  return result;
+}
+
+
+// Add entries [firstEntry,lastEntry) of the alignTree to the fitter
+void GeometryComparison::fillWeakModes(WeakModeFitter* fitter, const Long64_t firstEntry, const Long64_t lastEntry) const {
+  int id = 0;
+  int level = 0;
+  int sublevel = 0;
+  float r = 0.;
+  float z = 0.;
+  float phi = 0.;
+  float dr = 0.;
+  float dz = 0.;
+  float dphi = 0.;
+  float dy = 0.;
+
+  TFile file(fileName_,"READ");
+  TTree* tree = NULL;
+  file.GetObject("alignTree",tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading tree from file" << std::endl;
+    throw std::exception();
+  }
+
+  // read only the branches needed for the fit
+  tree->SetBranchStatus("*",false);
+  const char* branches[10] = { "id", "level", "sublevel", "r", "z", "phi", "dr", "dz", "dphi", "dy" };
+  for(int i = 0; i < 10; ++i) {
+    tree->SetBranchStatus(branches[i],true);
+  }
+  tree->SetBranchAddress("id",&id);
+  tree->SetBranchAddress("level",&level);
+  tree->SetBranchAddress("sublevel",&sublevel);
+  tree->SetBranchAddress("r",&r);
+  tree->SetBranchAddress("z",&z);
+  tree->SetBranchAddress("phi",&phi);
+  tree->SetBranchAddress("dr",&dr);
+  tree->SetBranchAddress("dz",&dz);
+  tree->SetBranchAddress("dphi",&dphi);
+  tree->SetBranchAddress("dy",&dy);
+
+  for(Long64_t i = firstEntry; i < lastEntry; ++i) {
+    tree->GetEntry(i);
+
+    if( exclAlignables_.find( id ) != exclAlignables_.end() ) continue;
+    if( level != 1 ) continue;
+    if( sublevel > 0 && sublevel < nSubDet_+1 ) {
+      fitter->add(sublevel-1,r,z,phi,dr,dz,dphi,dy);
+    }
+  }
+
+  delete tree;
+  file.Close();
+}
+
+
+// As fitWeakModes(), the partial summaries of parallel chunks
+// are merged afterwards
+ComparisonSummary GeometryComparison::summarize(const TrackerTopologyVersion topology, const unsigned int nThreads) const {
+  if( topology != Phase0Topology && topology != Phase1Topology ) {
+    std::cerr << "\n\nERROR: the layers are decoded from the DetIds, which needs Phase0Topology or Phase1Topology\n" << std::endl;
+    throw std::exception();
+  }
+  const Long64_t nEntries = this->nEntries();
+  const Tracker tracker(topology);
+
+  ComparisonSummary result;
+  if( nThreads < 2 ) {
+    fillSummary(&result,&tracker,0,nEntries);
+  } else {
+    ROOT::EnableThreadSafety();
+    std::vector<ComparisonSummary> summaries(nThreads);
+    std::vector<std::exception_ptr> errors(nThreads);
+    std::vector<std::thread> threads;
+    const Long64_t chunkSize = nEntries/nThreads + 1;
+    for(unsigned int t = 0; t < nThreads; ++t) {
+      const Long64_t first = std::min(nEntries,t*chunkSize);
+      const Long64_t last = std::min(nEntries,first+chunkSize);
+      // an exception must not leave the thread, it is rethrown after join
+      threads.push_back(std::thread([this,&summaries,&errors,&tracker,t,first,last]() {
+	    try {
+	      fillSummary(&summaries.at(t),&tracker,first,last);
+	    } catch(...) {
+	      errors.at(t) = std::current_exception();
+	    }
+	  }));
+    }
+    for(unsigned int t = 0; t < nThreads; ++t) {
+      threads.at(t).join();
+    }
+    for(unsigned int t = 0; t < nThreads; ++t) {
+      if( errors.at(t) ) std::rethrow_exception(errors.at(t));
+      result.merge(summaries.at(t));
+    }
+  }
+
+  return result;
+}
+
+
+// Add entries [firstEntry,lastEntry) of the alignTree to the summary
+void GeometryComparison::fillSummary(ComparisonSummary* summary, const Tracker* tracker, const Long64_t firstEntry, const Long64_t lastEntry) const {
+  int id = 0;
+  int level = 0;
+  int sublevel = 0;
+  float r = 0.;
+  float dr = 0.;
+  float dz = 0.;
+  float dphi = 0.;
+  float dx = 0.;
+  float dy = 0.;
+
+  TFile file(fileName_,"READ");
+  TTree* tree = NULL;
+  file.GetObject("alignTree",tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading tree from file" << std::endl;
+    throw std::exception();
+  }
+
+  // read only the branches needed for the summary
+  tree->SetBranchStatus("*",false);
+  const char* branches[9] = { "id", "level", "sublevel", "r", "dr", "dz", "dphi", "dx", "dy" };
+  for(int i = 0; i < 9; ++i) {
+    tree->SetBranchStatus(branches[i],true);
+  }
+  tree->SetBranchAddress("id",&id);
+  tree->SetBranchAddress("level",&level);
+  tree->SetBranchAddress("sublevel",&sublevel);
+  tree->SetBranchAddress("r",&r);
+  tree->SetBranchAddress("dr",&dr);
+  tree->SetBranchAddress("dz",&dz);
+  tree->SetBranchAddress("dphi",&dphi);
+  tree->SetBranchAddress("dx",&dx);
+  tree->SetBranchAddress("dy",&dy);
+
+  for(Long64_t i = firstEntry; i < lastEntry; ++i) {
+    tree->GetEntry(i);
+
+    if( exclAlignables_.find( id ) != exclAlignables_.end() ) continue;
+    if( level != 1 ) continue;
+    if( sublevel > 0 && sublevel < nSubDet_+1 ) {
+      const int layer = static_cast<int>(tracker->layer(static_cast<unsigned int>(id)));
+      summary->add(sublevel,layer,r,dr,dz,dphi,dx,dy);
+    }
+  }
+
+  delete tree;
+  file.Close();
+}
+
+
+Long64_t GeometryComparison::nEntries() const {
+  TFile file(fileName_,"READ");
+  TTree* tree = NULL;
+  file.GetObject("alignTree",tree);
+  if( tree == NULL ) {
+    std::cerr << "\n\nERROR reading tree from file" << std::endl;
+    throw std::exception();
+  }
+  const Long64_t n = tree->GetEntries();
+  delete tree;
+  file.Close();
+
+  return n;
+}
+
+
 void GeometryComparison::setStyle(Plots &plots) const {
   int color = 1;
   for(PlotIt it = plots.begin(); it != plots.end(); ++it, ++color) {
@@ -274,35 +1342,11 @@ void GeometryComparison::getRange(const TGraph* g, double &xMin, double &xMax, d
 }
 
 
-// Expects .txt file with ids of excluded DetUnits
-// One id per line. Empty lines and lines starting
-// with '#' are ignored.
+// Expects .txt file with ids of excluded DetUnits, see
+// readExcludedModules()
 void GeometryComparison::excludeModules(const TString& fileName) {
-  exclAlignables_.clear();
-
-  // Open file for reading
-  std::ifstream file( fileName.Data() );
-  if( !file.is_open() ) {
-    std::cerr << "\n\nERROR error opening file '" << fileName << "'\n";
-    throw std::exception();
-  }
-
-  // Loop over lines and parse
-  std::string line("");
-  while( !file.eof() ) {
-    std::getline(file,line);
-    TString id(line);
-    id.ReplaceAll(" ","");
-    if( id.Length() > 0 ) {
-      if( id[0] != '#' ) {
-	if( !id.IsDigit() ) {
-	  std::cerr << "\n\nERROR: unrecognised DetUnit Id '" << id << "'\n\n" << std::endl;
-	  throw std::exception();
-	}
-	exclAlignables_.insert( id.Atoi() );
-      }
-    }
-  }
+  exclAlignables_ = readExcludedModules(fileName);
+  modules_ = ModuleCache();
 }
 
 #endif
@@ -0,0 +1,84 @@
+#ifndef INPUT_LISTS_H
+#define INPUT_LISTS_H
+
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "TString.h"
+
+
+// One geometry comparison of a list
+struct ComparisonListEntry {
+  TString fileName;
+  TString id;
+};
+
+
+// Expects .txt file with one geometry comparison per line,
+//   <path/to/comparison.root> [id]
+// Empty lines and lines starting with '#' are ignored. If no
+// id is given, the file name is used.
+std::vector<ComparisonListEntry> readComparisonList(const TString& listFileName) {
+  std::ifstream listFile( listFileName.Data() );
+  if( !listFile.is_open() ) {
+    std::cerr << "\n\nERROR error opening file '" << listFileName << "'\n";
+    throw std::exception();
+  }
+
+  std::vector<ComparisonListEntry> comparisons;
+  std::string line("");
+  while( std::getline(listFile,line) ) {
+    TString str(line);
+    str.ReplaceAll("\t"," ");
+    while( str.BeginsWith(" ") ) str.Remove(0,1);
+    if( str.Length() == 0 || str[0] == '#' ) continue;
+
+    ComparisonListEntry entry;
+    entry.fileName = str;
+    const int posSpace = str.First(" ");
+    if( posSpace > 0 ) {
+      entry.fileName = str(0,posSpace);
+      entry.id = str(posSpace+1,str.Length()-posSpace-1);
+      entry.id.ReplaceAll(" ","");
+    } else {
+      entry.id = entry.fileName(entry.fileName.Last('/')+1,entry.fileName.Length());
+    }
+    comparisons.push_back(entry);
+  }
+
+  return comparisons;
+}
+
+
+// Expects .txt file with ids of excluded DetUnits
+// One id per line. Empty lines and lines starting
+// with '#' are ignored.
+std::set<int> readExcludedModules(const TString& fileName) {
+  std::ifstream file( fileName.Data() );
+  if( !file.is_open() ) {
+    std::cerr << "\n\nERROR error opening file '" << fileName << "'\n";
+    throw std::exception();
+  }
+
+  std::set<int> ids;
+  std::string line("");
+  while( std::getline(file,line) ) {
+    TString id(line);
+    id.ReplaceAll(" ","");
+    if( id.Length() > 0 && id[0] != '#' ) {
+      if( !id.IsDigit() ) {
+	std::cerr << "\n\nERROR: unrecognised DetUnit Id '" << id << "'\n\n" << std::endl;
+	throw std::exception();
+      }
+      ids.insert( id.Atoi() );
+    }
+  }
+
+  return ids;
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef MODULE_GRID_H
+#define MODULE_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include "TString.h"
+
+
+// Region of the tracker in (r,z,phi) and sub-detectors, e.g.
+//   Region("PXBCentral").subDet("PXB").z(-10.,10.)
+//   Region("TOBWedge").subDet("TOB").phi(0.,0.5)
+// Coordinates in cm and rad, as in the alignTree. Without restrictions,
+// the region is the whole tracker. A phi wedge with min > max wraps
+// around phi = +-pi.
+class Region {
+public:
+  explicit Region(const TString& name = "")
+    : name_(name), subDetMask_(0),
+      rMin_(-1E10), rMax_(1E10), zMin_(-1E10), zMax_(1E10), phiMin_(-1E10), phiMax_(1E10) {}
+
+  // sub-detector labels as in the plots: PXB, PXF, TIB, TID, TOB, TEC;
+  // several can be added
+  Region& subDet(const TString& label);
+  Region& r(const double min, const double max) { rMin_ = min; rMax_ = max; return *this; }
+  Region& z(const double min, const double max) { zMin_ = min; zMax_ = max; return *this; }
+  Region& phi(const double min, const double max) { phiMin_ = min; phiMax_ = max; return *this; }
+
+  TString name() const { return name_; }
+
+  // subDet as sublevel in alignTree (1-6)
+  bool containsSubDet(const int subDet) const { return subDetMask_ == 0 || ( subDetMask_ & (1u << (subDet-1)) ); }
+  bool contains(const float r, const float z, const float phi) const {
+    return r >= rMin_ && r <= rMax_ && z >= zMin_ && z <= zMax_ && containsPhi(phi);
+  }
+
+  // whether the interval [min,max] overlaps with or lies inside the region
+  bool overlapsR(const double min, const double max) const { return max >= rMin_ && min <= rMax_; }
+  bool overlapsZ(const double min, const double max) const { return max >= zMin_ && min <= zMax_; }
+  bool overlapsPhi(const double min, const double max) const;
+  bool insideR(const double min, const double max) const { return min >= rMin_ && max <= rMax_; }
+  bool insideZ(const double min, const double max) const { return min >= zMin_ && max <= zMax_; }
+  bool insidePhi(const double min, const double max) const;
+
+
+private:
+  TString name_;
+  unsigned int subDetMask_;
+  double rMin_;
+  double rMax_;
+  double zMin_;
+  double zMax_;
+  double phiMin_;
+  double phiMax_;
+
+  bool wraps() const { return phiMin_ > phiMax_; }
+  bool containsPhi(const float phi) const {
+    return wraps() ? ( phi >= phiMin_ || phi <= phiMax_ ) : ( phi >= phiMin_ && phi <= phiMax_ );
+  }
+};
+
+
+// Uniform grid in (r,z,phi) over the module positions, separately for
+// each sub-detector, built once per alignTree.
+//
+// The modules are stored ordered by cell, so a region query visits only
+// the cells overlapping the region: modules of cells inside the region
+// are taken as they are, only those of cells on the border are tested.
+// The cost is proportional to the number of matching modules rather
+// than to the number of modules in the tracker.
+class ModuleGrid {
+public:
+  ModuleGrid(const unsigned int nRBins = 8, const unsigned int nZBins = 16, const unsigned int nPhiBins = 16)
+    : nSubDet_(6), nRBins_(nRBins), nZBins_(nZBins), nPhiBins_(nPhiBins) {}
+
+  // subDets as sublevel in alignTree (1-6); the index of a module
+  // in these vectors is its slot
+  void build(const std::vector<int>& subDets, const std::vector<float>& r, const std::vector<float>& z, const std::vector<float>& phi);
+
+  // appends the slots of the modules inside the region
+  void query(const Region& region, std::vector<size_t>& slots) const;
+
+  size_t nModules() const { return slots_.size(); }
+
+
+private:
+  int nSubDet_;
+  unsigned int nRBins_;
+  unsigned int nZBins_;
+  unsigned int nPhiBins_;
+
+  // per sub-detector
+  std::vector<float> rMin_;
+  std::vector<float> rWidth_;
+  std::vector<float> zMin_;
+  std::vector<float> zWidth_;
+
+  // modules ordered by cell; the modules of cell c are
+  // [cellStart_[c],cellStart_[c+1])
+  std::vector<size_t> cellStart_;
+  std::vector<size_t> slots_;
+  std::vector<float> r_;
+  std::vector<float> z_;
+  std::vector<float> phi_;
+
+  size_t cell(const int subDet, const unsigned int rBin, const unsigned int zBin, const unsigned int phiBin) const {
+    return ((static_cast<size_t>(subDet-1)*nRBins_ + rBin)*nZBins_ + zBin)*nPhiBins_ + phiBin;
+  }
+  unsigned int bin(const float x, const float min, const float width, const unsigned int nBins) const;
+  double phiWidth() const { return 2.*M_PI/nPhiBins_; }
+};
+
+
+Region& Region::subDet(const TString& label) {
+  const TString labels[6] = { "PXB", "PXF", "TIB", "TID", "TOB", "TEC" };
+  for(int i = 0; i < 6; ++i) {
+    if( label == labels[i] ) {
+      subDetMask_ |= 1u << i;
+      return *this;
+    }
+  }
+  std::cerr << "\n\nERROR in Region: unknown sub-detector '" << label << "'\n" << std::endl;
+  throw std::exception();
+}
+
+
+bool Region::overlapsPhi(const double min, const double max) const {
+  if( wraps() ) return max >= phiMin_ || min <= phiMax_;
+  return max >= phiMin_ && min <= phiMax_;
+}
+
+
+bool Region::insidePhi(const double min, const double max) const {
+  if( wraps() ) return min >= phiMin_ || max <= phiMax_;
+  return min >= phiMin_ && max <= phiMax_;
+}
+
+
+unsigned int ModuleGrid::bin(const float x, const float min, const float width, const unsigned int nBins) const {
+  if( width <= 0. ) return 0;
+  const int b = static_cast<int>(std::floor((x-min)/width));
+  return static_cast<unsigned int>( std::max(0,std::min(b,static_cast<int>(nBins)-1)) );
+}
+
+
+void ModuleGrid::build(const std::vector<int>& subDets, const std::vector<float>& r, const std::vector<float>& z, const std::vector<float>& phi) {
+  const size_t n = subDets.size();
+  if( r.size() != n || z.size() != n || phi.size() != n ) {
+    std::cerr << "\n\nERROR in ModuleGrid: inconsistent number of module positions\n" << std::endl;
+    throw std::exception();
+  }
+
+  // bounding box per sub-detector
+  std::vector<float> rMax(nSubDet_,-1E10);
+  std::vector<float> zMax(nSubDet_,-1E10);
+  rMin_.assign(nSubDet_,1E10);
+  zMin_.assign(nSubDet_,1E10);
+  for(size_t i = 0; i < n; ++i) {
+    const int d = subDets[i]-1;
+    if( d < 0 || d >= nSubDet_ ) {
+      std::cerr << "\n\nERROR in ModuleGrid: unknown sub-detector '" << subDets[i] << "'\n" << std::endl;
+      throw std::exception();
+    }
+    rMin_[d] = std::min(rMin_[d],r[i]);
+    rMax[d]  = std::max(rMax[d], r[i]);
+    zMin_[d] = std::min(zMin_[d],z[i]);
+    zMax[d]  = std::max(zMax[d], z[i]);
+  }
+  rWidth_.assign(nSubDet_,0.);
+  zWidth_.assign(nSubDet_,0.);
+  for(int d = 0; d < nSubDet_; ++d) {
+    if( rMax[d] > rMin_[d] ) rWidth_[d] = (rMax[d]-rMin_[d])/nRBins_;
+    if( zMax[d] > zMin_[d] ) zWidth_[d] = (zMax[d]-zMin_[d])/nZBins_;
+  }
+
+  // counting sort of the modules by cell
+  const size_t nCells = cell(nSubDet_+1,0,0,0);
+  std::vector<size_t> cells(n);
+  cellStart_.assign(nCells+1,0);
+  for(size_t i = 0; i < n; ++i) {
+    const int d = subDets[i]-1;
+    cells[i] = cell(subDets[i],
+		    bin(r[i],rMin_[d],rWidth_[d],nRBins_),
+		    bin(z[i],zMin_[d],zWidth_[d],nZBins_),
+		    bin(phi[i],-M_PI,phiWidth(),nPhiBins_));
+    ++cellStart_[cells[i]+1];
+  }
+  for(size_t c = 0; c < nCells; ++c) {
+    cellStart_[c+1] += cellStart_[c];
+  }
+  std::vector<size_t> next(cellStart_.begin(),cellStart_.end()-1);
+  slots_.resize(n);
+  r_.resize(n);
+  z_.resize(n);
+  phi_.resize(n);
+  for(size_t i = 0; i < n; ++i) {
+    const size_t pos = next[cells[i]]++;
+    slots_[pos] = i;
+    r_[pos] = r[i];
+    z_[pos] = z[i];
+    phi_[pos] = phi[i];
+  }
+}
+
+
+void ModuleGrid::query(const Region& region, std::vector<size_t>& slots) const {
+  if( cellStart_.empty() ) return;
+
+  for(int subDet = 1; subDet <= nSubDet_; ++subDet) {
+    if( !region.containsSubDet(subDet) ) continue;
+    const int d = subDet-1;
+
+    // all modules lie inside the bounding box, hence
+    // [low,low+width] contains all modules of a bin
+    for(unsigned int rBin = 0; rBin < nRBins_; ++rBin) {
+      const double rLow = rMin_[d] + rBin*rWidth_[d];
+      const double rHigh = rLow + rWidth_[d];
+      if( !region.overlapsR(rLow,rHigh) ) continue;
+      const bool rInside = region.insideR(rLow,rHigh);
+
+      for(unsigned int zBin = 0; zBin < nZBins_; ++zBin) {
+	const double zLow = zMin_[d] + zBin*zWidth_[d];
+	const double zHigh = zLow + zWidth_[d];
+	if( !region.overlapsZ(zLow,zHigh) ) continue;
+	const bool zInside = region.insideZ(zLow,zHigh);
+
+	for(unsigned int phiBin = 0; phiBin < nPhiBins_; ++phiBin) {
+	  const double phiLow = -M_PI + phiBin*phiWidth();
+	  const double phiHigh = phiLow + phiWidth();
+	  if( !region.overlapsPhi(phiLow,phiHigh) ) continue;
+	  const bool inside = rInside && zInside && region.insidePhi(phiLow,phiHigh);
+
+	  const size_t c = cell(subDet,rBin,zBin,phiBin);
+	  if( inside ) {
+	    slots.insert(slots.end(),slots_.begin()+cellStart_[c],slots_.begin()+cellStart_[c+1]);
+	  } else {
+	    for(size_t i = cellStart_[c]; i < cellStart_[c+1]; ++i) {
+	      if( region.contains(r_[i],z_[i],phi_[i]) ) slots.push_back(slots_[i]);
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef RIGID_BODY_FIT_H
+#define RIGID_BODY_FIT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "TString.h"
+
+
+// Granularity of the structures whose rigid-body motion is fitted
+// - SubDetStructures    : whole sub-detectors
+// - HalfStructures      : the halves at z < 0 and z > 0 of each sub-detector
+// - LayerStructures     : layers in the barrel, as decoded by Tracker,
+//                         and disks/wheels of each side in the endcaps
+// - RingStructures      : rings within each layer or wheel
+// - MotherStructures    : the mother alignables of the DetUnits in the
+//                         alignTree (mid), e.g. ladders, rods and petals
+enum StructureLevel { SubDetStructures=0, HalfStructures, LayerStructures, RingStructures, MotherStructures };
+
+TString toStr(StructureLevel level) {
+  if( level == SubDetStructures ) return "subdetectors";
+  if( level == HalfStructures   ) return "halves";
+  if( level == LayerStructures  ) return "layers";
+  if( level == RingStructures   ) return "rings";
+  if( level == MotherStructures ) return "mothers";
+  return "UNKNOWN";
+}
+
+
+// Rigid-body motion of one structure: translation (x, y, z) of its
+// centre and small rotations (alpha, beta, gamma) about the global
+// x, y and z axes through the centre, in cm and rad
+struct StructureFit {
+  TString name;
+  int subDet;			// sublevel in alignTree (1-6)
+  unsigned int nModules;
+  bool valid;			// false if the motion is not fully determined
+  double centre[3];
+  double par[6];
+  double err[6];
+  double rms;			// of the residual module displacements
+};
+
+
+// Normal equations of the 6-parameter least-squares fit
+//   d = t + w x (p - c)
+// of the module displacements d at positions p, with translation t,
+// rotation w and the centre c of the structure. They are accumulated
+// about the origin, with the centre of the modules, and transformed
+// to the centre in solve(). Can be merged.
+class RigidBodyAccumulator {
+public:
+  RigidBodyAccumulator()
+    : n_(0), sumDD_(0.) {
+    std::fill(a_,a_+36,0.);
+    std::fill(b_,b_+6,0.);
+    std::fill(sumP_,sumP_+3,0.);
+  }
+
+  void add(const double x, const double y, const double z, const double dx, const double dy, const double dz);
+  void merge(const RigidBodyAccumulator& other);
+
+  unsigned int n() const { return n_; }
+
+  // fills centre, par, err, rms and valid of the fit
+  void solve(StructureFit& fit) const;
+
+
+private:
+  unsigned int n_;
+  double a_[36];		// [6x6] symmetric
+  double b_[6];
+  double sumDD_;
+  double sumP_[3];
+
+  static bool cholesky(double* l);
+};
+
+
+// Jacobian rows of (dx,dy,dz) w.r.t. (tx,ty,tz,wx,wy,wz) at p = (x,y,z):
+//   dx : 1 0 0   0  z -y
+//   dy : 0 1 0  -z  0  x
+//   dz : 0 0 1   y -x  0
+void RigidBodyAccumulator::add(const double x, const double y, const double z, const double dx, const double dy, const double dz) {
+  const double j[3][6] = { { 1., 0., 0., 0.,  z, -y },
+			   { 0., 1., 0., -z, 0.,  x },
+			   { 0., 0., 1.,  y, -x, 0. } };
+  const double d[3] = { dx, dy, dz };
+  for(int k = 0; k < 3; ++k) {
+    for(int p = 0; p < 6; ++p) {
+      if( j[k][p] == 0. ) continue;
+      b_[p] += j[k][p]*d[k];
+      for(int q = p; q < 6; ++q) {
+	a_[p*6+q] += j[k][p]*j[k][q];
+      }
+    }
+  }
+  sumDD_ += dx*dx + dy*dy + dz*dz;
+  sumP_[0] += x;
+  sumP_[1] += y;
+  sumP_[2] += z;
+  ++n_;
+}
+
+
+void RigidBodyAccumulator::merge(const RigidBodyAccumulator& other) {
+  for(int i = 0; i < 36; ++i) a_[i] += other.a_[i];
+  for(int i = 0; i < 6; ++i) b_[i] += other.b_[i];
+  for(int i = 0; i < 3; ++i) sumP_[i] += other.sumP_[i];
+  sumDD_ += other.sumDD_;
+  n_ += other.n_;
+}
+
+
+// In-place Cholesky decomposition A = L L^T of the 6x6 matrix (lower
+// triangle used); false if A is not positive definite within precision
+bool RigidBodyAccumulator::cholesky(double* l) {
+  double maxDiag = 0.;
+  for(int i = 0; i < 6; ++i) maxDiag = std::max(maxDiag,l[i*6+i]);
+  for(int j = 0; j < 6; ++j) {
+    double diag = l[j*6+j];
+    for(int k = 0; k < j; ++k) diag -= l[j*6+k]*l[j*6+k];
+    if( !( diag > 1E-12*maxDiag ) ) return false;
+    l[j*6+j] = std::sqrt(diag);
+    for(int i = j+1; i < 6; ++i) {
+      double sum = l[i*6+j];
+      for(int k = 0; k < j; ++k) sum -= l[i*6+k]*l[j*6+k];
+      l[i*6+j] = sum/l[j*6+j];
+    }
+  }
+
+  return true;
+}
+
+
+// With t0 = t + w x (-c) = t + [c]x w, the parameters about the centre
+// are (t,w) = T^-1 (t0,w) with T = [[1,[c]x],[0,1]], hence the normal
+// equations about the centre are A' = T^T A T and b' = T^T b
+void RigidBodyAccumulator::solve(StructureFit& fit) const {
+  fit.nModules = n_;
+  fit.valid = false;
+  fit.rms = 0.;
+  std::fill(fit.par,fit.par+6,0.);
+  std::fill(fit.err,fit.err+6,0.);
+  std::fill(fit.centre,fit.centre+3,0.);
+  if( n_ < 3 ) return;
+
+  const double c[3] = { sumP_[0]/n_, sumP_[1]/n_, sumP_[2]/n_ };
+  std::copy(c,c+3,fit.centre);
+  double t[36];
+  std::fill(t,t+36,0.);
+  for(int i = 0; i < 6; ++i) t[i*6+i] = 1.;
+  t[0*6+4] = -c[2]; t[0*6+5] =  c[1];
+  t[1*6+3] =  c[2]; t[1*6+5] = -c[0];
+  t[2*6+3] = -c[1]; t[2*6+4] =  c[0];
+
+  // symmetric A from the upper triangle
+  double a[36];
+  for(int p = 0; p < 6; ++p) {
+    for(int q = 0; q < 6; ++q) {
+      a[p*6+q] = p <= q ? a_[p*6+q] : a_[q*6+p];
+    }
+  }
+  double at[36];
+  double l[36];
+  double b[6];
+  for(int p = 0; p < 6; ++p) {
+    for(int q = 0; q < 6; ++q) {
+      double sum = 0.;
+      for(int k = 0; k < 6; ++k) sum += a[p*6+k]*t[k*6+q];
+      at[p*6+q] = sum;
+    }
+  }
+  for(int p = 0; p < 6; ++p) {
+    b[p] = 0.;
+    for(int k = 0; k < 6; ++k) b[p] += t[k*6+p]*b_[k];
+    for(int q = 0; q < 6; ++q) {
+      double sum = 0.;
+      for(int k = 0; k < 6; ++k) sum += t[k*6+p]*at[k*6+q];
+      l[p*6+q] = sum;
+    }
+  }
+  if( !cholesky(l) ) return;
+
+  // solve L L^T x = b, and the diagonal of A'^-1 from L^-1
+  double y[6];
+  for(int i = 0; i < 6; ++i) {
+    double sum = b[i];
+    for(int k = 0; k < i; ++k) sum -= l[i*6+k]*y[k];
+    y[i] = sum/l[i*6+i];
+  }
+  for(int i = 5; i >= 0; --i) {
+    double sum = y[i];
+    for(int k = i+1; k < 6; ++k) sum -= l[k*6+i]*fit.par[k];
+    fit.par[i] = sum/l[i*6+i];
+  }
+  double linv[36];
+  std::fill(linv,linv+36,0.);
+  for(int j = 0; j < 6; ++j) {
+    linv[j*6+j] = 1./l[j*6+j];
+    for(int i = j+1; i < 6; ++i) {
+      double sum = 0.;
+      for(int k = j; k < i; ++k) sum -= l[i*6+k]*linv[k*6+j];
+      linv[i*6+j] = sum/l[i*6+i];
+    }
+  }
+
+  // the errors are estimated from the scatter of the residuals, since
+  // the geometry comparison does not provide errors per module
+  double chi2 = sumDD_;
+  for(int p = 0; p < 6; ++p) chi2 -= fit.par[p]*b[p];
+  if( chi2 < 0. ) chi2 = 0.;	// rounding
+  const unsigned int nDof = 3*n_-6;
+  fit.rms = std::sqrt(chi2/(3*n_));
+  for(int p = 0; p < 6; ++p) {
+    double var = 0.;
+    for(int k = p; k < 6; ++k) var += linv[k*6+p]*linv[k*6+p];
+    fit.err[p] = nDof > 0 ? std::sqrt(var*chi2/nDof) : 0.;
+  }
+  fit.valid = true;
+}
+
+
+// Fits all structures, distributed over nThreads threads. The modules
+// of structure s are those with structures[i] == s; names and subDets
+// are per structure.
+std::vector<StructureFit> fitRigidBodies(const std::vector<size_t>& structures,
+					 const std::vector<TString>& names, const std::vector<int>& subDets,
+					 const std::vector<float>& x, const std::vector<float>& y, const std::vector<float>& z,
+					 const std::vector<float>& dx, const std::vector<float>& dy, const std::vector<float>& dz,
+					 const unsigned int nThreads = 1) {
+  const size_t nModules = structures.size();
+  const size_t nStructures = names.size();
+  if( x.size() != nModules || y.size() != nModules || z.size() != nModules ||
+      dx.size() != nModules || dy.size() != nModules || dz.size() != nModules || subDets.size() != nStructures ) {
+    std::cerr << "\n\nERROR in fitRigidBodies: inconsistent number of modules or structures\n" << std::endl;
+    throw std::exception();
+  }
+
+  // modules ordered by structure
+  std::vector<size_t> start(nStructures+1,0);
+  for(size_t i = 0; i < nModules; ++i) {
+    if( structures[i] >= nStructures ) {
+      std::cerr << "\n\nERROR in fitRigidBodies: unknown structure " << structures[i] << "\n" << std::endl;
+      throw std::exception();
+    }
+    ++start[structures[i]+1];
+  }
+  for(size_t s = 0; s < nStructures; ++s) start[s+1] += start[s];
+  std::vector<size_t> modules(nModules);
+  std::vector<size_t> next(start.begin(),start.end()-1);
+  for(size_t i = 0; i < nModules; ++i) modules[next[structures[i]]++] = i;
+
+  std::vector<StructureFit> fits(nStructures);
+  std::atomic<size_t> nextStructure(0);
+  auto work = [&]() {
+    for(size_t s = nextStructure++; s < nStructures; s = nextStructure++) {
+      RigidBodyAccumulator acc;
+      for(size_t k = start[s]; k < start[s+1]; ++k) {
+	const size_t i = modules[k];
+	acc.add(x[i],y[i],z[i],dx[i],dy[i],dz[i]);
+      }
+      fits[s].name = names[s];
+      fits[s].subDet = subDets[s];
+      acc.solve(fits[s]);
+    }
+  };
+  if( nThreads <= 1 ) {
+    work();
+  } else {
+    std::vector<std::thread> threads;
+    for(unsigned int t = 0; t < nThreads; ++t) {
+      threads.push_back(std::thread(work));
+    }
+    for(unsigned int t = 0; t < nThreads; ++t) {
+      threads[t].join();
+    }
+  }
+
+  return fits;
+}
+
+
+// table in mum and murad
+void printStructureFits(std::ostream& out, const std::vector<StructureFit>& fits) {
+  char txt[400];
+  snprintf(txt,400,"%-20s %6s  %16s %16s %16s %16s %16s %16s %8s",
+	   "structure","nMod","dx [mum]","dy [mum]","dz [mum]","alpha [murad]","beta [murad]","gamma [murad]","rms");
+  out << txt << std::endl;
+  for(size_t s = 0; s < fits.size(); ++s) {
+    const StructureFit& f = fits[s];
+    if( !f.valid ) {
+      snprintf(txt,400,"%-20s %6u  not determined",f.name.Data(),f.nModules);
+      out << txt << std::endl;
+      continue;
+    }
+    TString line("");
+    snprintf(txt,400,"%-20s %6u ",f.name.Data(),f.nModules);
+    line += txt;
+    for(int p = 0; p < 6; ++p) {
+      const double scale = p < 3 ? 1E4 : 1E6;
+      snprintf(txt,400," % 8.2f +/-%5.2f",scale*f.par[p],scale*f.err[p]);
+      line += txt;
+    }
+    snprintf(txt,400," %8.2f",1E4*f.rms);
+    line += txt;
+    out << line << std::endl;
+  }
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef WEAK_MODES_H
+#define WEAK_MODES_H
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include "TString.h"
+
+
+// The standard weak-mode shapes, following the definitions of the systematic
+// misalignment scenarios (Alignment/TrackerAlignment/TrackerSystematicMisalignments):
+// - Twist      : dphi = eps * z
+// - Sagitta    : dy   = eps * r
+// - Radial     : dr   = eps * r
+// - Telescope  : dz   = eps * r
+// - Skew       : dz   = eps * cos(phi - delta)
+// - Elliptical : dr   = eps * r * cos(2 phi)
+// - Bowing     : dr   = eps * (zMax^2 - z^2)
+// Coordinates in cm and rad, as stored in the alignTree.
+//
+// Modes which displace the modules in the same coordinate are not
+// independent, e.g. a radial expansion also has a bowing component,
+// and are therefore fitted jointly: radial, elliptical and bowing to
+// dr, and telescope and skew to dz. The skew is fitted as
+//   dz = a * cos(phi) + b * sin(phi)
+// with eps = sqrt(a^2 + b^2) and delta = atan2(b,a).
+enum WeakMode { Twist=0, Sagitta, Radial, Telescope, Skew, Elliptical, Bowing, NWeakModes };
+
+TString toStr(WeakMode mode) {
+  if( mode == Twist      ) return "twist";
+  if( mode == Sagitta    ) return "sagitta";
+  if( mode == Radial     ) return "radial";
+  if( mode == Telescope  ) return "telescope";
+  if( mode == Skew       ) return "skew";
+  if( mode == Elliptical ) return "elliptical";
+  if( mode == Bowing     ) return "bowing";
+  return "UNKNOWN";
+}
+
+
+// Normal equations of the linear least-squares fit
+//   d = sum_k p_k * f_k
+// of the displacement d to the shapes f_k, k < nPars <= maxNPars.
+// Needs O(1) memory and can be merged with the results from other
+// chunks of data.
+class WeakModeAccumulator {
+public:
+  static const int maxNPars = 3;
+
+  WeakModeAccumulator(const int nPars = 1);
+
+  void add(const double* f, const double d);
+  void merge(const WeakModeAccumulator& other);
+
+  unsigned int n() const { return n_; }
+  int nPars() const { return nPars_; }
+
+  // Parameters and their covariance [nPars x nPars]; false if the
+  // shapes are not independent for the added modules
+  bool solve(double* pars, double* cov) const;
+
+
+private:
+  int nPars_;
+  unsigned int n_;
+  double sumFF_[maxNPars*maxNPars];
+  double sumFD_[maxNPars];
+  double sumDD_;
+};
+
+
+WeakModeAccumulator::WeakModeAccumulator(const int nPars)
+  : nPars_(nPars), n_(0), sumDD_(0.) {
+  if( nPars_ < 1 || nPars_ > maxNPars ) {
+    std::cerr << "\n\nERROR in WeakModeAccumulator: " << nPars_ << " parameters not supported\n" << std::endl;
+    throw std::exception();
+  }
+  for(int i = 0; i < maxNPars*maxNPars; ++i) sumFF_[i] = 0.;
+  for(int i = 0; i < maxNPars; ++i) sumFD_[i] = 0.;
+}
+
+
+void WeakModeAccumulator::add(const double* f, const double d) {
+  ++n_;
+  for(int i = 0; i < nPars_; ++i) {
+    sumFD_[i] += f[i]*d;
+    for(int j = 0; j < nPars_; ++j) {
+      sumFF_[i*maxNPars+j] += f[i]*f[j];
+    }
+  }
+  sumDD_ += d*d;
+}
+
+
+void WeakModeAccumulator::merge(const WeakModeAccumulator& other) {
+  if( other.nPars_ != nPars_ ) {
+    std::cerr << "\n\nERROR in WeakModeAccumulator: merging fits with different numbers of parameters\n" << std::endl;
+    throw std::exception();
+  }
+  n_ += other.n_;
+  for(int i = 0; i < maxNPars*maxNPars; ++i) sumFF_[i] += other.sumFF_[i];
+  for(int i = 0; i < maxNPars; ++i) sumFD_[i] += other.sumFD_[i];
+  sumDD_ += other.sumDD_;
+}
+
+
+// Gauss-Jordan inversion of the (at most 3x3) normal matrix. The
+// uncertainties are estimated from the scatter of the residuals,
+// since the geometry comparison does not provide errors per module.
+bool WeakModeAccumulator::solve(double* pars, double* cov) const {
+  const int n = nPars_;
+  for(int i = 0; i < n; ++i) {
+    pars[i] = 0.;
+    for(int j = 0; j < n; ++j) cov[i*n+j] = 0.;
+  }
+  if( n_ <= static_cast<unsigned int>(n) ) return false;
+
+  double a[maxNPars][2*maxNPars];
+  double maxDiag = 0.;
+  for(int i = 0; i < n; ++i) {
+    for(int j = 0; j < n; ++j) {
+      a[i][j] = sumFF_[i*maxNPars+j];
+      a[i][n+j] = i == j ? 1. : 0.;
+    }
+    maxDiag = std::max(maxDiag,a[i][i]);
+  }
+  for(int c = 0; c < n; ++c) {
+    int pivot = c;
+    for(int r = c+1; r < n; ++r) {
+      if( std::abs(a[r][c]) > std::abs(a[pivot][c]) ) pivot = r;
+    }
+    if( !( std::abs(a[pivot][c]) > 1E-12*maxDiag ) ) return false;
+    for(int j = 0; j < 2*n; ++j) std::swap(a[c][j],a[pivot][j]);
+    const double norm = a[c][c];
+    for(int j = 0; j < 2*n; ++j) a[c][j] /= norm;
+    for(int r = 0; r < n; ++r) {
+      if( r == c ) continue;
+      const double factor = a[r][c];
+      for(int j = 0; j < 2*n; ++j) a[r][j] -= factor*a[c][j];
+    }
+  }
+
+  double chi2 = sumDD_;
+  for(int i = 0; i < n; ++i) {
+    for(int j = 0; j < n; ++j) pars[i] += a[i][n+j]*sumFD_[j];
+    chi2 -= pars[i]*sumFD_[i];
+  }
+  if( chi2 < 0. ) chi2 = 0.;	// rounding
+  const double sigma2 = chi2/(n_-n);
+  for(int i = 0; i < n; ++i) {
+    for(int j = 0; j < n; ++j) cov[i*n+j] = sigma2*a[i][n+j];
+  }
+
+  return true;
+}
+
+
+// Fitted amplitude of one weak mode; the phase only for the skew
+struct WeakModeResult {
+  WeakModeResult()
+    : n(0), valid(false), amplitude(0.), error(0.), phase(0.), phaseError(0.) {}
+
+  unsigned int n;
+  bool valid;			// false if not determined by the modules
+  double amplitude;
+  double error;
+  double phase;
+  double phaseError;
+};
+
+
+// Weak-mode amplitudes per sub-detector. The modules are added
+// one by one, e.g. while looping over the alignTree, and the
+// results of several instances, e.g. from different chunks of the
+// tree, can be merged.
+class WeakModeFitter {
+public:
+  // the joint fits, one per displacement
+  enum Fit { DphiFit=0, DyFit, DrFit, DzFit, NFits };
+
+  WeakModeFitter(const int nSubDet = 6);
+
+  void add(const int subDet,
+	   const double r, const double z, const double phi,
+	   const double dr, const double dz, const double dphi, const double dy);
+  void merge(const WeakModeFitter& other);
+
+  int nSubDet() const { return accs_.size(); }
+  WeakModeResult result(const int subDet, const WeakMode mode) const;
+
+  void printTable(std::ostream& out, const TString& id, const bool printHeader = true) const;
+
+  static TString subDetLabel(const int subDet);
+
+
+private:
+  std::vector< std::vector<WeakModeAccumulator> > accs_; // [nSubDet]x[NFits]
+
+  // fit and index of the (first) parameter of the mode in the fit
+  static void parameter(const WeakMode mode, Fit& fit, int& idx);
+};
+
+
+WeakModeFitter::WeakModeFitter(const int nSubDet) {
+  std::vector<WeakModeAccumulator> accs;
+  accs.push_back(WeakModeAccumulator(1)); // DphiFit: twist
+  accs.push_back(WeakModeAccumulator(1)); // DyFit  : sagitta
+  accs.push_back(WeakModeAccumulator(3)); // DrFit  : radial, elliptical, bowing
+  accs.push_back(WeakModeAccumulator(3)); // DzFit  : telescope, skew cos, skew sin
+  accs_.assign(nSubDet,accs);
+}
+
+
+// subDet counts from 0, i.e. it is sublevel-1
+void WeakModeFitter::add(const int subDet,
+			 const double r, const double z, const double phi,
+			 const double dr, const double dz, const double dphi, const double dy) {
+  const double zMax = 271.846;	// [cm] as in TrackerSystematicMisalignments
+  std::vector<WeakModeAccumulator>& accs = accs_.at(subDet);
+  const double fDphi[1] = { z };
+  const double fDy[1] = { r };
+  const double fDr[3] = { r, r*cos(2.*phi), zMax*zMax - z*z };
+  const double fDz[3] = { r, cos(phi), sin(phi) };
+  accs[DphiFit].add(fDphi,dphi);
+  accs[DyFit].add(fDy,dy);
+  accs[DrFit].add(fDr,dr);
+  accs[DzFit].add(fDz,dz);
+}
+
+
+void WeakModeFitter::merge(const WeakModeFitter& other) {
+  if( other.nSubDet() != nSubDet() ) {
+    std::cerr << "\n\nERROR in WeakModeFitter: merging fitters with different numbers of sub-detectors\n" << std::endl;
+    throw std::exception();
+  }
+  for(int d = 0; d < nSubDet(); ++d) {
+    for(int f = 0; f < NFits; ++f) {
+      accs_[d][f].merge(other.accs_[d][f]);
+    }
+  }
+}
+
+
+void WeakModeFitter::parameter(const WeakMode mode, Fit& fit, int& idx) {
+  fit = DphiFit;
+  idx = 0;
+  if(      mode == Sagitta    ) { fit = DyFit; idx = 0; }
+  else if( mode == Radial     ) { fit = DrFit; idx = 0; }
+  else if( mode == Elliptical ) { fit = DrFit; idx = 1; }
+  else if( mode == Bowing     ) { fit = DrFit; idx = 2; }
+  else if( mode == Telescope  ) { fit = DzFit; idx = 0; }
+  else if( mode == Skew       ) { fit = DzFit; idx = 1; }
+}
+
+
+WeakModeResult WeakModeFitter::result(const int subDet, const WeakMode mode) const {
+  Fit fit = DphiFit;
+  int idx = 0;
+  parameter(mode,fit,idx);
+  const WeakModeAccumulator& acc = accs_.at(subDet).at(fit);
+  const int n = acc.nPars();
+
+  WeakModeResult res;
+  res.n = acc.n();
+  double pars[WeakModeAccumulator::maxNPars];
+  double cov[WeakModeAccumulator::maxNPars*WeakModeAccumulator::maxNPars];
+  res.valid = acc.solve(pars,cov);
+  if( !res.valid ) return res;
+
+  if( mode != Skew ) {
+    res.amplitude = pars[idx];
+    res.error = std::sqrt(cov[idx*n+idx]);
+  } else {
+    // amplitude and phase of a cos(phi) + b sin(phi), propagated errors
+    const double a = pars[idx];
+    const double b = pars[idx+1];
+    const double caa = cov[idx*n+idx];
+    const double cbb = cov[(idx+1)*n+idx+1];
+    const double cab = cov[idx*n+idx+1];
+    const double amp2 = a*a + b*b;
+    res.amplitude = std::sqrt(amp2);
+    res.phase = std::atan2(b,a);
+    if( amp2 > 0. ) {
+      res.error = std::sqrt( std::max(0.,a*a*caa + b*b*cbb + 2.*a*b*cab)/amp2 );
+      res.phaseError = std::sqrt( std::max(0.,b*b*caa + a*a*cbb - 2.*a*b*cab) )/amp2;
+    } else {
+      res.error = std::sqrt(0.5*(caa+cbb));
+    }
+  }
+
+  return res;
+}
+
+
+TString WeakModeFitter::subDetLabel(const int subDet) {
+  if( subDet == 0 ) return "PXB";
+  if( subDet == 1 ) return "PXF";
+  if( subDet == 2 ) return "TIB";
+  if( subDet == 3 ) return "TID";
+  if( subDet == 4 ) return "TOB";
+  if( subDet == 5 ) return "TEC";
+
+  return "Det";
+}
+
+
+// One line per sub-detector and weak mode:
+// <id> <subdet> <mode> <nModules> <amplitude> <error> <amplitude/error> <phase> <error>
+// with the phase only for the skew. Modes not determined by the
+// modules of a sub-detector are omitted.
+void WeakModeFitter::printTable(std::ostream& out, const TString& id, const bool printHeader) const {
+  if( printHeader ) {
+    out << TString::Format("# %-38s %6s %-10s %7s %14s %14s %9s %8s %8s",
+			   "id","subdet","mode","n","amplitude","error","signif.","phase","error") << std::endl;
+  }
+  for(int d = 0; d < nSubDet(); ++d) {
+    for(int m = 0; m < NWeakModes; ++m) {
+      const WeakModeResult res = result(d,static_cast<WeakMode>(m));
+      if( !res.valid ) continue;
+      const double signif = res.error > 0. ? res.amplitude/res.error : 0.;
+      out << TString::Format("  %-38s %6s %-10s %7u % 14.6e %14.6e % 9.2f % 8.4f %8.4f",
+			     id.Data(),subDetLabel(d).Data(),toStr(static_cast<WeakMode>(m)).Data(),
+			     res.n,res.amplitude,res.error,signif,res.phase,res.phaseError) << std::endl;
+    }
+  }
+}
+
+#endif